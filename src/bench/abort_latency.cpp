@@ -0,0 +1,126 @@
+/*
+ #
+ #  File        : abort_latency.cpp
+ #                ( C++ source file )
+ #
+ #  Description : Measure the latency of abort requests under load.
+ #                Each pipeline runs in a thread, on an already constructed interpreter.
+ #                The abort flag is set after a delay, and the time the interpreter takes to
+ #                return is measured. Pipelines use the kernels that poll the abort flag from
+ #                all their threads (patch-based and diffusion inpainting, comparison operators
+ #                with math expressions).
+ #                Returns a non-zero exit code if a latency exceeds the specified bound, or if
+ #                a pipeline ends before the abort request.
+ #
+ #  Usage       : ./abort_latency [delay_ms] [max_latency_ms] [pipeline...]
+ #
+ #  Copyright   : David Tschumperle
+ #                ( http://tschumperle.users.greyc.fr/ )
+ #
+ #  License     : CeCILL v2.0
+ #                ( http://www.cecill.info/licences/Licence_CeCILL_V2-en.html )
+ #
+ #  This software is governed by the CeCILL  license under French law and
+ #  abiding by the rules of distribution of free software.  You can  use,
+ #  modify and/ or redistribute the software under the terms of the CeCILL
+ #  license as circulated by CEA, CNRS and INRIA at the following URL
+ #  "http://www.cecill.info".
+ #
+ #  As a counterpart to the access to the source code and  rights to copy,
+ #  modify and redistribute granted by the license, users are provided only
+ #  with a limited warranty  and the software's author,  the holder of the
+ #  economic rights,  and the successive licensors  have only  limited
+ #  liability.
+ #
+ #  In this respect, the user's attention is drawn to the risks associated
+ #  with loading,  using,  modifying and/or developing or reproducing the
+ #  software by the user in light of its specific status of free software,
+ #  that may mean  that it is complicated to manipulate,  and  that  also
+ #  therefore means  that it is reserved for developers  and  experienced
+ #  professionals having in-depth computer knowledge. Users are therefore
+ #  encouraged to load and test the software's suitability as regards their
+ #  requirements in conditions enabling the security of their systems and/or
+ #  data to be ensured and, more generally, to use and operate it in the
+ #  same conditions as regards security.
+ #
+ #  The fact that you are presently reading this means that you have had
+ #  knowledge of the CeCILL license and that you accept its terms.
+ #
+*/
+
+/*
+    Note : To compile this test, using g++, use :
+
+    g++ -o abort_latency abort_latency.cpp -I.. -lgmic -lfftw3 -lpthread
+*/
+
+#include "gmic.h"
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+
+static double get_time() {
+  struct timeval tv;
+  gettimeofday(&tv,0);
+  return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+struct st_run {
+  gmic *interpreter;
+  const char *pipeline;
+  bool is_abort;
+  volatile bool is_done;
+  double end_time;
+};
+
+static void *run(void *arg) {
+  st_run &st = *(st_run*)arg;
+  gmic_list<float> images;
+  gmic_list<char> images_names;
+  try {
+    st.interpreter->run(st.pipeline,images,images_names,0,&st.is_abort);
+  } catch (gmic_exception&) {} // Aborted pipelines may also end with an error.
+  st.end_time = get_time();
+  st.is_done = true;
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *const default_pipelines[] = {
+    "-v - 1024,1024,1,3 -rand 0,255 1024,1024 -f[1] 'x>200 && x<800 && y>200 && y<800' "
+    "-repeat 1000 -inpaint[0] [1],15,60 -done",
+    "-v - 2048,2048,1,3 -rand 0,255 2048,2048 -f[1] 'x>100 && x<1900 && y>100 && y<1900' "
+    "-repeat 1000 -inpaint[0] [1],0,3 -done",
+    "-v - 4096,4096,1,3 -rand 0,255 -repeat 100000 -gt[0] 'cos(x*y/1000)*sin(x+y)*128+128' -done"
+  };
+  const double
+    delay = argc>1?std::atof(argv[1]):1000,
+    max_latency = argc>2?std::atof(argv[2]):500;
+  const char *const *const pipelines = argc>3?argv + 3:default_pipelines;
+  const int nb_pipelines = argc>3?argc - 3:(int)(sizeof(default_pipelines)/sizeof(char*));
+
+  gmic interpreter; // Construct interpreter (and parse the standard library) before measuring.
+  int res = 0;
+  std::fprintf(stderr,"%12s %12s  %s\n","latency(ms)","status","pipeline");
+  for (int p = 0; p<nb_pipelines; ++p) {
+    st_run st;
+    st.interpreter = &interpreter;
+    st.pipeline = pipelines[p];
+    st.is_abort = false;
+    st.is_done = false;
+    pthread_t thread;
+    if (pthread_create(&thread,0,run,&st)) { std::fprintf(stderr,"Cannot create thread.\n"); return 1; }
+    usleep((useconds_t)(delay*1000));
+    const bool is_early = st.is_done;
+    const double abort_time = get_time();
+    st.is_abort = true;
+    pthread_join(thread,0);
+    const double latency = 1000*(st.end_time - abort_time);
+    const char *const status = is_early?"too short":latency>max_latency?"too slow":"ok";
+    if (is_early || latency>max_latency) res = 1;
+    std::fprintf(stderr,"%12.1f %12s  %s\n",is_early?0.:latency,status,pipelines[p]);
+  }
+  return res;
+}
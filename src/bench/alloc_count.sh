@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+#  File        : alloc_count.sh
+#                ( Benchmark of heap allocations per item )
+#
+#  Description : Count heap allocations made per item by the interpreter, with valgrind,
+#                for one or several G'MIC binaries (e.g. built before and after a change).
+#                Allocations of N and 2N loop iterations are counted, so that their difference
+#                excludes the startup of the interpreter.
+#                Items with no special characters and items with substitutions are measured separately.
+#
+#  Usage       : [N=iterations] ./alloc_count.sh [gmic_binary...]
+#                (binary defaults to $GMIC, or 'gmic'; requires 'valgrind').
+#
+N=${N:-1000}
+[ $# -eq 0 ] && set -- "${GMIC:-gmic}"
+
+allocs() { # Number of allocations reported by valgrind.
+  valgrind "$gmic" -v - "$@" 2>&1 >/dev/null |
+    sed -n 's/.*total heap usage: *\([0-9,]*\) allocs.*/\1/p' | tr -d ,
+}
+
+per_item() { # Allocations per item, for loop body "$1" of "$2" items (plus '-done').
+  a1=$(allocs -repeat "$N" $1 -done)
+  a2=$(allocs -repeat $((2*N)) $1 -done)
+  [ -z "$a1" ] || [ -z "$a2" ] && { echo "failed: $gmic" >&2; echo nan; return; }
+  echo "$a1 $a2 $N $2" | awk '{ printf "%.2f", ($2 - $1)/($3*($4 + 1)) }'
+}
+
+printf "%-40s %20s %20s\n" binary "plain (allocs/item)" "substituted (allocs/item)"
+for gmic in "$@"; do
+  printf "%-40s %20s %20s\n" "$gmic" \
+    "$(per_item "-skip abc -skip def,ghi" 2)" \
+    "$(per_item '-skip {1+2},$> -skip $<' 2)"
+done
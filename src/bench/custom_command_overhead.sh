@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+#  File        : custom_command_overhead.sh
+#                ( Benchmark of custom command calls )
+#
+#  Description : Measure the time per call of custom commands with arguments,
+#                for one or several G'MIC binaries (e.g. built before and after a change).
+#                Custom commands have tiny bodies on a 1x1 image, so that the time is
+#                dominated by the substitution of their arguments and the parsing of their bodies.
+#
+#  Usage       : [N=calls] ./custom_command_overhead.sh [gmic_binary...]
+#                (binary defaults to $GMIC, or 'gmic').
+#
+N=${N:-100000}
+[ $# -eq 0 ] && set -- "${GMIC:-gmic}"
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+cat > "$TMP/bench.gmic" <<GMIC
+bench_leaf :
+  -skip \$1,\$2,\${3-4}
+bench_nested :
+  -bench_leaf \$1,\$2,\$1,\$2 -bench_leaf \$2,\$1,\$2,\$1
+GMIC
+
+seconds() {
+  t0=$(date +%s.%N)
+  "$gmic" -v - -m "$TMP/bench.gmic" 1 "$@" >/dev/null 2>&1 || echo "failed: $gmic $*" >&2
+  t1=$(date +%s.%N)
+  echo "$t0 $t1" | awk '{ printf "%.6f", $2 - $1 }'
+}
+
+printf "%-40s %16s %16s\n" binary "leaf (us/call)" "nested (us/call)"
+for gmic in "$@"; do
+  t_init=$(seconds -repeat 0 -done)
+  t_leaf=$(seconds -repeat "$N" -bench_leaf 1,2,3,4 -done)
+  t_nested=$(seconds -repeat "$N" -bench_nested 1,2 -done)
+  # Startup time (with the parsing of the standard library) is subtracted. A nested call makes 3 calls.
+  echo "$gmic $t_init $t_leaf $t_nested $N" |
+    awk '{ printf "%-40s %16.3f %16.3f\n",$1,1e6*($3 - $2)/$5,1e6*($4 - $2)/(3*$5) }'
+done
@@ -0,0 +1,32 @@
+#!/bin/sh
+#
+#  File        : dispatch_rate.sh
+#                ( Benchmark of native command dispatch )
+#
+#  Description : Measure how many items per second the interpreter runs in tight '-repeat' loops
+#                of native commands, for one or several G'MIC binaries (e.g. built before and
+#                after a change). Loop bodies use commands found late in their first-letter block,
+#                and do nearly nothing, so that the time is dominated by the dispatch of items.
+#
+#  Usage       : [N=iterations] ./dispatch_rate.sh [gmic_binary...]
+#                (binary defaults to $GMIC, or 'gmic').
+#
+N=${N:-1000000}
+[ $# -eq 0 ] && set -- "${GMIC:-gmic}"
+
+seconds() {
+  t0=$(date +%s.%N)
+  "$gmic" -v - "$@" >/dev/null 2>&1 || echo "failed: $gmic $*" >&2
+  t1=$(date +%s.%N)
+  echo "$t0 $t1" | awk '{ printf "%.6f", $2 - $1 }'
+}
+
+printf "%-40s %22s %22s\n" binary "empty loop (items/s)" "3-item loop (items/s)"
+for gmic in "$@"; do
+  t_init=$(seconds -repeat 0 -done)
+  t_empty=$(seconds -repeat "$N" -done)
+  t_body=$(seconds -repeat "$N" -skip 0 -status 0 -done)
+  # Startup time is subtracted. Each iteration runs the items of the body, plus '-done'.
+  echo "$gmic $t_init $t_empty $t_body $N" |
+    awk '{ printf "%-40s %22.0f %22.0f\n",$1,$5/($3 - $2),3*$5/($4 - $2) }'
+done
@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+#  File        : parallel_scaling.sh
+#                ( Benchmark of command '-parallel' )
+#
+#  Description : Measure how command '-parallel' scales with the number of commands
+#                run concurrently, in thread and process modes.
+#                Each command runs the same CPU-bound pipeline on its own image.
+#
+#  Usage       : [GMIC=/path/to/gmic] ./parallel_scaling.sh [max_workers] [image_size]
+#
+GMIC=${GMIC:-gmic}
+N=${1:-$(nproc)}
+S=${2:-1024}
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+cat > "$TMP/bench.gmic" <<GMIC
+bench_work :
+  -repeat 4 -blur 2 -sharpen 50 -erode 3 -dilate 3 -done
+GMIC
+
+seconds() {
+  t0=$(date +%s.%N)
+  "$GMIC" -v - -m "$TMP/bench.gmic" "$@" >/dev/null 2>&1 || echo "failed: $GMIC $*" >&2
+  t1=$(date +%s.%N)
+  echo "$t0 $t1" | awk '{ printf "%.3f", $2 - $1 }'
+}
+
+printf "%8s %12s %12s %12s %12s\n" workers "thread(s)" "speedup" "process(s)" "speedup"
+n=1
+while [ "$n" -le "$N" ]; do
+  commands=""
+  i=0
+  while [ "$i" -lt "$n" ]; do
+    commands="$commands${commands:+,}-bench_work[$i]"
+    i=$((i + 1))
+  done
+  init="$S,$S,1,3 -rand[-1] 0,255 -repeat $((n - 1)) --rand[-1] 0,255 -done"
+  t_thread=$(seconds $init -parallel "$commands")
+  t_process=$(seconds $init -parallel "process,$commands")
+  [ "$n" -eq 1 ] && { t1_thread=$t_thread; t1_process=$t_process; }
+  # Ideal scaling keeps the time constant: speedup is n*t(1)/t(n).
+  echo "$n $t_thread $t1_thread $t_process $t1_process" |
+    awk '{ printf "%8d %12.3f %12.2f %12.3f %12.2f\n",$1,$2,$1*$3/$2,$4,$1*$5/$4 }'
+  n=$((n + 1))
+done
@@ -76,7 +76,7 @@ CImg<T> get_gmic_invert_endianness(const char *const stype) const {
 template<typename t>
 CImg<T>& operator_eq(const t val) {
 #ifdef cimg_use_openmp
-#pragma omp parallel for if (size()>=131072)
+#pragma omp parallel for if (size()>=_gmic_parallel_thresholds.pointwise_size)
 #endif
   cimg_rof(*this,ptrd,T) *ptrd = (T)(*ptrd == (T)val);
   return *this;
@@ -90,23 +90,29 @@ CImg<T>& operator_eq(const char *const expression) {
       &base = _base?_base:*this;
     _cimg_math_parser mp(base,this,expression + (*expression=='>' || *expression=='<'?1:0),"operator_eq");
     T *ptrd = *expression=='<'?end() - 1:_data;
-    if (*expression=='<') cimg_rofXYZC(*this,x,y,z,c) { *ptrd = (T)(*ptrd == (T)mp(x,y,z,c)); --ptrd; }
-    else if (*expression=='>') cimg_forXYZC(*this,x,y,z,c) { *ptrd = (T)(*ptrd == (T)mp(x,y,z,c)); ++ptrd; }
-    else {
+    if (*expression=='<') {
+      cimg_rofYZC(*this,y,z,c) if (!gmic_is_abort())
+        cimg_rofX(*this,x) { *ptrd = (T)(*ptrd == (T)mp(x,y,z,c)); --ptrd; }
+    } else if (*expression=='>') {
+      cimg_forYZC(*this,y,z,c) if (!gmic_is_abort())
+        cimg_forX(*this,x) { *ptrd = (T)(*ptrd == (T)mp(x,y,z,c)); ++ptrd; }
+    } else {
 #ifdef cimg_use_openmp
-      if (_width>=512 && _height*_depth*_spectrum>=2 && std::strlen(expression)>=6)
+      if (_width>=_gmic_parallel_thresholds.expression_width && _height*_depth*_spectrum>=2 &&
+          std::strlen(expression)>=_gmic_parallel_thresholds.expression_length)
 #pragma omp parallel
         {
           _cimg_math_parser _mp = omp_get_thread_num()?mp:_cimg_math_parser(), &lmp = omp_get_thread_num()?_mp:mp;
 #pragma omp for collapse(3)
-          cimg_forYZC(*this,y,z,c) {
+          cimg_forYZC(*this,y,z,c) if (!gmic_is_abort()) { // Skip remaining rows on abort.
             T *ptrd = data(0,y,z,c);
             cimg_forX(*this,x) { *ptrd = (T)(*ptrd == (T)lmp(x,y,z,c)); ++ptrd; }
           }
         }
       else
 #endif
-        cimg_forXYZC(*this,x,y,z,c) { *ptrd = (T)(*ptrd == (T)mp(x,y,z,c)); ++ptrd; }
+        cimg_forYZC(*this,y,z,c) if (!gmic_is_abort())
+          cimg_forX(*this,x) { *ptrd = (T)(*ptrd == (T)mp(x,y,z,c)); ++ptrd; }
     }
   } catch (CImgException&) {
     cimg::exception_mode(omode);
@@ -115,6 +121,7 @@ CImg<T>& operator_eq(const char *const expression) {
     operator_eq(values);
   }
   cimg::exception_mode(omode);
+  gmic_test_abort();
   return *this;
 }
 
@@ -136,7 +143,7 @@ CImg<T>& operator_eq(const CImg<t>& img) {
 template<typename t>
 CImg<T>& operator_neq(const t val) {
 #ifdef cimg_use_openmp
-#pragma omp parallel for if (size()>=131072)
+#pragma omp parallel for if (size()>=_gmic_parallel_thresholds.pointwise_size)
 #endif
   cimg_rof(*this,ptrd,T) *ptrd = (T)(*ptrd != (T)val);
   return *this;
@@ -150,23 +157,29 @@ CImg<T>& operator_neq(const char *const expression) {
       &base = _base?_base:*this;
     _cimg_math_parser mp(base,this,expression + (*expression=='>' || *expression=='<'?1:0),"operator_neq");
     T *ptrd = *expression=='<'?end() - 1:_data;
-    if (*expression=='<') cimg_rofXYZC(*this,x,y,z,c) { *ptrd = (T)(*ptrd != (T)mp(x,y,z,c)); --ptrd; }
-    else if (*expression=='>') cimg_forXYZC(*this,x,y,z,c) { *ptrd = (T)(*ptrd != (T)mp(x,y,z,c)); ++ptrd; }
-    else {
+    if (*expression=='<') {
+      cimg_rofYZC(*this,y,z,c) if (!gmic_is_abort())
+        cimg_rofX(*this,x) { *ptrd = (T)(*ptrd != (T)mp(x,y,z,c)); --ptrd; }
+    } else if (*expression=='>') {
+      cimg_forYZC(*this,y,z,c) if (!gmic_is_abort())
+        cimg_forX(*this,x) { *ptrd = (T)(*ptrd != (T)mp(x,y,z,c)); ++ptrd; }
+    } else {
 #ifdef cimg_use_openmp
-      if (_width>=512 && _height*_depth*_spectrum>=2 && std::strlen(expression)>=6)
+      if (_width>=_gmic_parallel_thresholds.expression_width && _height*_depth*_spectrum>=2 &&
+          std::strlen(expression)>=_gmic_parallel_thresholds.expression_length)
 #pragma omp parallel
         {
           _cimg_math_parser _mp = omp_get_thread_num()?mp:_cimg_math_parser(), &lmp = omp_get_thread_num()?_mp:mp;
 #pragma omp for collapse(3)
-          cimg_forYZC(*this,y,z,c) {
+          cimg_forYZC(*this,y,z,c) if (!gmic_is_abort()) {
             T *ptrd = data(0,y,z,c);
             cimg_forX(*this,x) { *ptrd = (T)(*ptrd != (T)lmp(x,y,z,c)); ++ptrd; }
           }
         }
       else
 #endif
-        cimg_forXYZC(*this,x,y,z,c) { *ptrd = (T)(*ptrd != (T)mp(x,y,z,c)); ++ptrd; }
+        cimg_forYZC(*this,y,z,c) if (!gmic_is_abort())
+          cimg_forX(*this,x) { *ptrd = (T)(*ptrd != (T)mp(x,y,z,c)); ++ptrd; }
     }
   } catch (CImgException&) {
     cimg::exception_mode(omode);
@@ -175,6 +188,7 @@ CImg<T>& operator_neq(const char *const expression) {
     operator_neq(values);
   }
   cimg::exception_mode(omode);
+  gmic_test_abort();
   return *this;
 }
 
@@ -196,7 +210,7 @@ CImg<T>& operator_neq(const CImg<t>& img) {
 template<typename t>
 CImg<T>& operator_gt(const t val) {
 #ifdef cimg_use_openmp
-#pragma omp parallel for if (size()>=131072)
+#pragma omp parallel for if (size()>=_gmic_parallel_thresholds.pointwise_size)
 #endif
   cimg_rof(*this,ptrd,T) *ptrd = (T)(*ptrd > (T)val);
   return *this;
@@ -210,23 +224,29 @@ CImg<T>& operator_gt(const char *const expression) {
       &base = _base?_base:*this;
     _cimg_math_parser mp(base,this,expression + (*expression=='>' || *expression=='<'?1:0),"operator_gt");
     T *ptrd = *expression=='<'?end() - 1:_data;
-    if (*expression=='<') cimg_rofXYZC(*this,x,y,z,c) { *ptrd = (T)(*ptrd > (T)mp(x,y,z,c)); --ptrd; }
-    else if (*expression=='>') cimg_forXYZC(*this,x,y,z,c) { *ptrd = (T)(*ptrd > (T)mp(x,y,z,c)); ++ptrd; }
-    else {
+    if (*expression=='<') {
+      cimg_rofYZC(*this,y,z,c) if (!gmic_is_abort())
+        cimg_rofX(*this,x) { *ptrd = (T)(*ptrd > (T)mp(x,y,z,c)); --ptrd; }
+    } else if (*expression=='>') {
+      cimg_forYZC(*this,y,z,c) if (!gmic_is_abort())
+        cimg_forX(*this,x) { *ptrd = (T)(*ptrd > (T)mp(x,y,z,c)); ++ptrd; }
+    } else {
 #ifdef cimg_use_openmp
-      if (_width>=512 && _height*_depth*_spectrum>=2 && std::strlen(expression)>=6)
+      if (_width>=_gmic_parallel_thresholds.expression_width && _height*_depth*_spectrum>=2 &&
+          std::strlen(expression)>=_gmic_parallel_thresholds.expression_length)
 #pragma omp parallel
         {
           _cimg_math_parser _mp = omp_get_thread_num()?mp:_cimg_math_parser(), &lmp = omp_get_thread_num()?_mp:mp;
 #pragma omp for collapse(3)
-          cimg_forYZC(*this,y,z,c) {
+          cimg_forYZC(*this,y,z,c) if (!gmic_is_abort()) {
             T *ptrd = data(0,y,z,c);
             cimg_forX(*this,x) { *ptrd = (T)(*ptrd > (T)lmp(x,y,z,c)); ++ptrd; }
           }
         }
       else
 #endif
-        cimg_forXYZC(*this,x,y,z,c) { *ptrd = (T)(*ptrd > (T)mp(x,y,z,c)); ++ptrd; }
+        cimg_forYZC(*this,y,z,c) if (!gmic_is_abort())
+          cimg_forX(*this,x) { *ptrd = (T)(*ptrd > (T)mp(x,y,z,c)); ++ptrd; }
     }
   } catch (CImgException&) {
     cimg::exception_mode(omode);
@@ -235,6 +255,7 @@ CImg<T>& operator_gt(const char *const expression) {
     operator_gt(values);
   }
   cimg::exception_mode(omode);
+  gmic_test_abort();
   return *this;
 }
 
@@ -256,7 +277,7 @@ CImg<T>& operator_gt(const CImg<t>& img) {
 template<typename t>
 CImg<T>& operator_ge(const t val) {
 #ifdef cimg_use_openmp
-#pragma omp parallel for if (size()>=131072)
+#pragma omp parallel for if (size()>=_gmic_parallel_thresholds.pointwise_size)
 #endif
   cimg_rof(*this,ptrd,T) *ptrd = (T)(*ptrd >= (T)val);
   return *this;
@@ -270,23 +291,29 @@ CImg<T>& operator_ge(const char *const expression) {
       &base = _base?_base:*this;
     _cimg_math_parser mp(base,this,expression + (*expression=='>' || *expression=='<'?1:0),"operator_ge");
     T *ptrd = *expression=='<'?end() - 1:_data;
-    if (*expression=='<') cimg_rofXYZC(*this,x,y,z,c) { *ptrd = (T)(*ptrd >= (T)mp(x,y,z,c)); --ptrd; }
-    else if (*expression=='>') cimg_forXYZC(*this,x,y,z,c) { *ptrd = (T)(*ptrd >= (T)mp(x,y,z,c)); ++ptrd; }
-    else {
+    if (*expression=='<') {
+      cimg_rofYZC(*this,y,z,c) if (!gmic_is_abort())
+        cimg_rofX(*this,x) { *ptrd = (T)(*ptrd >= (T)mp(x,y,z,c)); --ptrd; }
+    } else if (*expression=='>') {
+      cimg_forYZC(*this,y,z,c) if (!gmic_is_abort())
+        cimg_forX(*this,x) { *ptrd = (T)(*ptrd >= (T)mp(x,y,z,c)); ++ptrd; }
+    } else {
 #ifdef cimg_use_openmp
-      if (_width>=512 && _height*_depth*_spectrum>=2 && std::strlen(expression)>=6)
+      if (_width>=_gmic_parallel_thresholds.expression_width && _height*_depth*_spectrum>=2 &&
+          std::strlen(expression)>=_gmic_parallel_thresholds.expression_length)
 #pragma omp parallel
         {
           _cimg_math_parser _mp = omp_get_thread_num()?mp:_cimg_math_parser(), &lmp = omp_get_thread_num()?_mp:mp;
 #pragma omp for collapse(3)
-          cimg_forYZC(*this,y,z,c) {
+          cimg_forYZC(*this,y,z,c) if (!gmic_is_abort()) {
             T *ptrd = data(0,y,z,c);
             cimg_forX(*this,x) { *ptrd = (T)(*ptrd >= (T)lmp(x,y,z,c)); ++ptrd; }
           }
         }
       else
 #endif
-        cimg_forXYZC(*this,x,y,z,c) { *ptrd = (T)(*ptrd >= (T)mp(x,y,z,c)); ++ptrd; }
+        cimg_forYZC(*this,y,z,c) if (!gmic_is_abort())
+          cimg_forX(*this,x) { *ptrd = (T)(*ptrd >= (T)mp(x,y,z,c)); ++ptrd; }
     }
   } catch (CImgException&) {
     cimg::exception_mode(omode);
@@ -295,6 +322,7 @@ CImg<T>& operator_ge(const char *const expression) {
     operator_ge(values);
   }
   cimg::exception_mode(omode);
+  gmic_test_abort();
   return *this;
 }
 
@@ -316,7 +344,7 @@ CImg<T>& operator_ge(const CImg<t>& img) {
 template<typename t>
 CImg<T>& operator_lt(const t val) {
 #ifdef cimg_use_openmp
-#pragma omp parallel for if (size()>=131072)
+#pragma omp parallel for if (size()>=_gmic_parallel_thresholds.pointwise_size)
 #endif
   cimg_rof(*this,ptrd,T) *ptrd = (T)(*ptrd < (T)val);
   return *this;
@@ -330,23 +358,29 @@ CImg<T>& operator_lt(const char *const expression) {
       &base = _base?_base:*this;
     _cimg_math_parser mp(base,this,expression + (*expression=='>' || *expression=='<'?1:0),"operator_lt");
     T *ptrd = *expression=='<'?end() - 1:_data;
-    if (*expression=='<') cimg_rofXYZC(*this,x,y,z,c) { *ptrd = (T)(*ptrd < (T)mp(x,y,z,c)); --ptrd; }
-    else if (*expression=='>') cimg_forXYZC(*this,x,y,z,c) { *ptrd = (T)(*ptrd < (T)mp(x,y,z,c)); ++ptrd; }
-    else {
+    if (*expression=='<') {
+      cimg_rofYZC(*this,y,z,c) if (!gmic_is_abort())
+        cimg_rofX(*this,x) { *ptrd = (T)(*ptrd < (T)mp(x,y,z,c)); --ptrd; }
+    } else if (*expression=='>') {
+      cimg_forYZC(*this,y,z,c) if (!gmic_is_abort())
+        cimg_forX(*this,x) { *ptrd = (T)(*ptrd < (T)mp(x,y,z,c)); ++ptrd; }
+    } else {
 #ifdef cimg_use_openmp
-      if (_width>=512 && _height*_depth*_spectrum>=2 && std::strlen(expression)>=6)
+      if (_width>=_gmic_parallel_thresholds.expression_width && _height*_depth*_spectrum>=2 &&
+          std::strlen(expression)>=_gmic_parallel_thresholds.expression_length)
 #pragma omp parallel
         {
           _cimg_math_parser _mp = omp_get_thread_num()?mp:_cimg_math_parser(), &lmp = omp_get_thread_num()?_mp:mp;
 #pragma omp for collapse(3)
-          cimg_forYZC(*this,y,z,c) {
+          cimg_forYZC(*this,y,z,c) if (!gmic_is_abort()) {
             T *ptrd = data(0,y,z,c);
             cimg_forX(*this,x) { *ptrd = (T)(*ptrd < (T)lmp(x,y,z,c)); ++ptrd; }
           }
         }
       else
 #endif
-        cimg_forXYZC(*this,x,y,z,c) { *ptrd = (T)(*ptrd < (T)mp(x,y,z,c)); ++ptrd; }
+        cimg_forYZC(*this,y,z,c) if (!gmic_is_abort())
+          cimg_forX(*this,x) { *ptrd = (T)(*ptrd < (T)mp(x,y,z,c)); ++ptrd; }
     }
   } catch (CImgException&) {
     cimg::exception_mode(omode);
@@ -355,6 +389,7 @@ CImg<T>& operator_lt(const char *const expression) {
     operator_lt(values);
   }
   cimg::exception_mode(omode);
+  gmic_test_abort();
   return *this;
 }
 
@@ -376,7 +411,7 @@ CImg<T>& operator_lt(const CImg<t>& img) {
 template<typename t>
 CImg<T>& operator_le(const t val) {
 #ifdef cimg_use_openmp
-#pragma omp parallel for if (size()>=131072)
+#pragma omp parallel for if (size()>=_gmic_parallel_thresholds.pointwise_size)
 #endif
   cimg_rof(*this,ptrd,T) *ptrd = (T)(*ptrd <= (T)val);
   return *this;
@@ -390,23 +425,29 @@ CImg<T>& operator_le(const char *const expression) {
       &base = _base?_base:*this;
     _cimg_math_parser mp(base,this,expression + (*expression=='>' || *expression=='<'?1:0),"operator_le");
     T *ptrd = *expression=='<'?end() - 1:_data;
-    if (*expression=='<') cimg_rofXYZC(*this,x,y,z,c) { *ptrd = (T)(*ptrd <= (T)mp(x,y,z,c)); --ptrd; }
-    else if (*expression=='>') cimg_forXYZC(*this,x,y,z,c) { *ptrd = (T)(*ptrd <= (T)mp(x,y,z,c)); ++ptrd; }
-    else {
+    if (*expression=='<') {
+      cimg_rofYZC(*this,y,z,c) if (!gmic_is_abort())
+        cimg_rofX(*this,x) { *ptrd = (T)(*ptrd <= (T)mp(x,y,z,c)); --ptrd; }
+    } else if (*expression=='>') {
+      cimg_forYZC(*this,y,z,c) if (!gmic_is_abort())
+        cimg_forX(*this,x) { *ptrd = (T)(*ptrd <= (T)mp(x,y,z,c)); ++ptrd; }
+    } else {
 #ifdef cimg_use_openmp
-      if (_width>=512 && _height*_depth*_spectrum>=2 && std::strlen(expression)>=6)
+      if (_width>=_gmic_parallel_thresholds.expression_width && _height*_depth*_spectrum>=2 &&
+          std::strlen(expression)>=_gmic_parallel_thresholds.expression_length)
 #pragma omp parallel
         {
           _cimg_math_parser _mp = omp_get_thread_num()?mp:_cimg_math_parser(), &lmp = omp_get_thread_num()?_mp:mp;
 #pragma omp for collapse(3)
-          cimg_forYZC(*this,y,z,c) {
+          cimg_forYZC(*this,y,z,c) if (!gmic_is_abort()) {
             T *ptrd = data(0,y,z,c);
             cimg_forX(*this,x) { *ptrd = (T)(*ptrd <= (T)lmp(x,y,z,c)); ++ptrd; }
           }
         }
       else
 #endif
-        cimg_forXYZC(*this,x,y,z,c) { *ptrd = (T)(*ptrd <= (T)mp(x,y,z,c)); ++ptrd; }
+        cimg_forYZC(*this,y,z,c) if (!gmic_is_abort())
+          cimg_forX(*this,x) { *ptrd = (T)(*ptrd <= (T)mp(x,y,z,c)); ++ptrd; }
     }
   } catch (CImgException&) {
     cimg::exception_mode(omode);
@@ -415,6 +456,7 @@ CImg<T>& operator_le(const char *const expression) {
     operator_le(values);
   }
   cimg::exception_mode(omode);
+  gmic_test_abort();
   return *this;
 }
 
@@ -1358,6 +1400,7 @@ CImg<T>& inpaint(const CImg<t>& mask, const unsigned int method) {
   bool is_pixel = false;
 
   do {
+    gmic_test_abort(); // Check abort once per filling pass.
     is_pixel = false;
 
     if (depth()==1) { // 2d image.
@@ -1627,6 +1670,7 @@ CImg<T>& inpaint_patch(const CImg<t>& mask, const unsigned int patch_size=11,
   unsigned int target_index = 0;
 
   while (true) {
+    gmic_test_abort(); // Check abort once per filled patch.
 
     // Extract mask border points and compute priorities to find target point.
     unsigned int nb_border_points = 0;
@@ -1765,6 +1809,7 @@ CImg<T>& inpaint_patch(const CImg<t>& mask, const unsigned int patch_size=11,
     float best_ssd = cimg::type<float>::max();
     int best_x = -1, best_y = -1;
     for (unsigned int C = 0; C<nb_lookup_candidates; ++C) {
+      gmic_test_abort();
       const int
         xl = (int)lookup_candidates(0,C),
         yl = (int)lookup_candidates(1,C),
@@ -1903,6 +1948,7 @@ CImg<T>& inpaint_patch(const CImg<t>& mask, const unsigned int patch_size=11,
     // Generate blending scales.
     CImg<T> result = _inpaint_patch_crop(ox,oy,ox + dx - 1,oy + dy - 1,0);
     for (unsigned int blend_iter = 1; blend_iter<=blend_scales; ++blend_iter) {
+      gmic_test_abort();
       const unsigned int
         _blend_width = blend_iter*blend_size/blend_scales,
         blend_width = _blend_width?_blend_width + 1 - (_blend_width%2):0;
@@ -2082,6 +2128,71 @@ using namespace cimg_library;
 #define gmic_pixel_type float
 #endif
 
+// Split a command argument into comma-separated typed fields, in a single pass.
+// Fields are numbers (type 'n'), numbers with a '%' suffix (type '%'), selections '[...]' (type '[')
+// or anything else (type 's'). Only the first 'max_fields' fields are stored.
+struct _gmic_fields {
+  enum { max_fields = 16 };
+  double values[max_fields];
+  const char *fields[max_fields];
+  unsigned int lengths[max_fields], nb_fields;
+  char types[max_fields];
+
+  _gmic_fields(const char *const argument):nb_fields(0) {
+    if (!argument || !*argument) return;
+    for (const char *ptr = argument; ; ++ptr) {
+      const char *const field = ptr;
+      unsigned int depth = 0;
+      while (*ptr && (depth || *ptr!=',')) {
+        if (*ptr=='[') ++depth; else if (*ptr==']' && depth) --depth;
+        ++ptr;
+      }
+      if (nb_fields<max_fields) {
+        const unsigned int l = (unsigned int)(ptr - field);
+        char type = 's';
+        double value = 0;
+        if (l && *field=='[' && field[l - 1]==']') type = '[';
+        else if (l) {
+          char *end = 0;
+          value = std::strtod(field,&end);
+          if (end!=field) {
+            if (end==ptr) type = 'n';
+            else if (*end=='%' && end + 1==ptr) type = '%';
+          }
+        }
+        values[nb_fields] = value;
+        fields[nb_fields] = field;
+        lengths[nb_fields] = l;
+        types[nb_fields] = type;
+      }
+      ++nb_fields;
+      if (!*ptr) break;
+    }
+  }
+
+  // Return true if fields match a signature, e.g. "nnn".
+  // In a signature, 'n' matches numbers, '%' matches numbers with or without '%', and 's' matches anything.
+  bool is(const char *const signature) const {
+    unsigned int l = 0;
+    for (const char *s = signature; *s; ++s, ++l) {
+      if (l>=nb_fields || l>=max_fields) return false;
+      const char type = types[l];
+      if (*s!='s' && *s!=type && (*s!='%' || type!='n')) return false;
+    }
+    return l==nb_fields;
+  }
+
+  // Return true if all fields are numbers (possibly with a '%' suffix if 'allow_percent' is set).
+  bool is_numeric(const bool allow_percent=false) const {
+    if (!nb_fields || nb_fields>max_fields) return false;
+    for (unsigned int l = 0; l<nb_fields; ++l)
+      if (types[l]!='n' && (!allow_percent || types[l]!='%')) return false;
+    return true;
+  }
+
+  float operator[](const unsigned int l) const { return (float)values[l]; }
+};
+
 // Return image argument as a shared or non-shared copy of one existing image.
 inline bool _gmic_image_arg(const unsigned int ind, const CImg<unsigned int>& selection) {
   cimg_forY(selection,l) if (selection[l]==ind) return true;
@@ -2104,8 +2215,20 @@ void gmic::_gmic_substitute_args(const char *const argument, const char *const a
 
 #define gmic_substitute_args() { \
   const char *const argument0 = argument; \
-  substitute_item(argument,images,images_names,parent_images,parent_images_names,variables_sizes).move_to(_argument); \
-  _gmic_substitute_args(argument = _argument,argument0,command,images); \
+  if (std::strchr(argument,'{') || std::strchr(argument,'$')) { \
+    substitute_item(argument,images,images_names,parent_images,parent_images_names,variables_sizes).move_to(_argument); \
+    argument = _argument; \
+  } \
+  _gmic_substitute_args(argument,argument0,command,images); \
+}
+
+// Macro for replacing a '$name' argument read as a numeric variable by its value (for messages only).
+#define gmic_substitute_numeric_arg() { \
+  if (is_very_verbose) { \
+    _argument.assign(32); \
+    cimg_snprintf(_argument,_argument.width(),"%.16g",value); \
+    argument = _argument; \
+  } \
 }
 
 // Macro for computing a readable version of a command argument.
@@ -2117,6 +2240,59 @@ inline char *_gmic_argument_text(const char *const argument, CImg<char>& argumen
 #define gmic_argument_text_printed() _gmic_argument_text(argument,argument_text,is_verbose)
 #define gmic_argument_text() _gmic_argument_text(argument,argument_text,true)
 
+// Identifiers of native commands.
+#define gmic_native_commands(cmd) \
+  cmd(_status) cmd(abs) cmd(acos) cmd(add) cmd(add3d) cmd(and) cmd(append) cmd(asin) cmd(atan) \
+  cmd(atan2) cmd(async) cmd(atomic) cmd(autocrop) cmd(await) cmd(barrier) cmd(bilateral) \
+  cmd(blur) cmd(boxfilter) cmd(break) cmd(buffer_pool) cmd(bsl) cmd(bsr) cmd(camera) \
+  cmd(channels) cmd(check) cmd(check3d) cmd(col3d) cmd(color3d) cmd(columns) cmd(command) \
+  cmd(compact) cmd(continue) cmd(convolve) cmd(correlate) cmd(cos) cmd(cosh) cmd(crop) \
+  cmd(cumulate) cmd(cursor) cmd(cut) cmd(debug) cmd(denoise) cmd(deriche) cmd(dijkstra) \
+  cmd(dilate) cmd(discard) cmd(displacement) cmd(display) cmd(display3d) cmd(distance) cmd(div) \
+  cmd(div3d) cmd(do) cmd(done) cmd(double3d) cmd(e) cmd(echo) cmd(eigen) cmd(elevation3d) \
+  cmd(elif) cmd(ellipse) cmd(else) cmd(endian) cmd(endif) cmd(endl) cmd(endlocal) cmd(eq) \
+  cmd(equalize) cmd(erode) cmd(error) cmd(exec) cmd(exp) cmd(fft) cmd(files) cmd(fill) cmd(flood) \
+  cmd(focale3d) cmd(ge) cmd(gradient) cmd(graph) cmd(gt) cmd(guided) cmd(hessian) cmd(histogram) \
+  cmd(hsi2rgb) cmd(hsl2rgb) cmd(hsv2rgb) cmd(i) cmd(if) cmd(ifft) cmd(image) cmd(index) \
+  cmd(inpaint) cmd(input) cmd(invert) cmd(isoline3d) cmd(isosurface3d) cmd(keep) cmd(lab2rgb) \
+  cmd(label) cmd(le) cmd(light3d) cmd(line) cmd(local) cmd(log) cmd(log10) cmd(log2) cmd(lt) \
+  cmd(mandelbrot) cmd(map) cmd(max) cmd(mdiv) cmd(median) cmd(memory_profile) cmd(min) \
+  cmd(mirror) cmd(mmul) cmd(mod) cmd(mode3d) cmd(moded3d) cmd(move) cmd(mse) cmd(mul) cmd(mul3d) \
+  cmd(mutex) cmd(name) cmd(neq) cmd(noarg) cmd(noise) cmd(normalize) cmd(object3d) cmd(onfail) \
+  cmd(opacity3d) cmd(or) cmd(output) cmd(parallel) cmd(parallel_thresholds) cmd(parallel_tiles) \
+  cmd(pass) cmd(permute) cmd(plasma) cmd(plot) cmd(point) cmd(polygon) cmd(pow) cmd(primitives3d) \
+  cmd(print) cmd(progress) cmd(quit) cmd(quiver) cmd(rand) cmd(remove) cmd(repeat) cmd(resize) \
+  cmd(return) cmd(reverse) cmd(reverse3d) cmd(rgb2hsi) cmd(rgb2hsl) cmd(rgb2hsv) cmd(rgb2lab) \
+  cmd(rgb2srgb) cmd(rol) cmd(ror) cmd(rotate) cmd(rotate3d) cmd(round) cmd(rows) cmd(select) \
+  cmd(semaphore) cmd(serialize) cmd(set) cmd(shared) cmd(sharpen) cmd(shift) cmd(sign) cmd(sin) \
+  cmd(sinc) cmd(sinh) cmd(skip) cmd(slices) cmd(smooth) cmd(solve) cmd(sort) cmd(specl3d) \
+  cmd(specs3d) cmd(sphere3d) cmd(split) cmd(split3d) cmd(sqr) cmd(sqrt) cmd(srand) cmd(srgb2rgb) \
+  cmd(status) cmd(stream_cimg) cmd(streamline3d) cmd(structuretensors) cmd(sub) cmd(sub3d) \
+  cmd(svd) cmd(tan) cmd(tanh) cmd(text) cmd(texturize3d) cmd(threshold) cmd(trisolve) \
+  cmd(uncommand) cmd(unroll) cmd(unserialize) cmd(v) cmd(vanvliet) cmd(verbose) cmd(wait) \
+  cmd(warn) cmd(warp) cmd(watershed) cmd(while) cmd(window) cmd(xor)
+
+#define _gmic_native_command_id(name) gmic_cmd_##name,
+#define _gmic_native_command_name(name) "-" #name,
+enum { gmic_cmd_none = 0, gmic_native_commands(_gmic_native_command_id) gmic_cmd_end };
+static const char *const gmic_native_commands_names[] = {
+  "", gmic_native_commands(_gmic_native_command_name) 0
+};
+
+// Macros for jumping to the end of blocks (instead of scanning the commands line).
+#define gmic_block_end(p,row) \
+  ((p)<commands_line._width?(commands_info._height>2?commands_info: \
+                             commands_info.append(commands_line_blocks(commands_line),'y'))((p),(row)):~0U)
+
+#define gmic_skip_debug_info(p0,p1) \
+  if ((p1)>(p0)) { \
+    const unsigned int _pd = commands_info((p1) - 1,8); \
+    if (_pd!=~0U && _pd>=(p0) && \
+        cimg_sscanf(commands_line[_pd].data() + 1,"%x,%x",&_debug_line,&(_debug_filename=0))>0) { \
+      is_debug_info = true; next_debug_line = _debug_line; next_debug_filename = _debug_filename; \
+    } \
+  }
+
 // Macro for having 'get' or 'non-get' versions of G'MIC commands.
 #define gmic_apply(function) { \
     __ind = (unsigned int)selection[l]; \
@@ -2127,11 +2303,298 @@ inline char *_gmic_argument_text(const char *const argument, CImg<char>& argumen
     } else images[__ind].function; \
   }
 
+// Manage runtime thresholds for parallel evaluation.
+// Defaults are overridden by file 'parallel_thresholds.cfg' of the resource directory (written by
+// '-parallel_thresholds calibrate'), then by environment variables 'GMIC_PARALLEL_*' and 'GMIC_MAX_THREADS'.
+inline unsigned int gmic_nb_threads() {
+  const unsigned int nb_cpus = cimg::nb_cpus(), max_threads = _gmic_parallel_thresholds.max_threads;
+  return max_threads && max_threads<nb_cpus?max_threads:nb_cpus;
+}
+
+// Apply the maximal number of threads to OpenMP, only when it has been set (otherwise, 'OMP_NUM_THREADS'
+// or the limit set by the host application is kept). Resetting it to 0 restores the previous OpenMP setting.
+inline void gmic_apply_max_threads() {
+#ifdef cimg_use_openmp
+  static int default_nb_threads = 0; // OpenMP setting overridden by 'max_threads' (protected by mutex 25).
+  cimg::mutex(25);
+  int nb_threads = 0;
+  if (_gmic_parallel_thresholds.max_threads) {
+    if (!default_nb_threads) default_nb_threads = omp_get_max_threads();
+    nb_threads = (int)gmic_nb_threads();
+  } else if (default_nb_threads) {
+    nb_threads = default_nb_threads;
+    default_nb_threads = 0;
+  }
+  cimg::mutex(25,0);
+  if (nb_threads) omp_set_num_threads(nb_threads);
+#endif // #ifdef cimg_use_openmp
+}
+
+// Parse thresholds 'pointwise_size,_selection_size,_expression_width,_expression_length,_max_threads'.
+// Omitted values are kept unchanged. Return false if string is invalid.
+inline bool gmic_parse_parallel_thresholds(const char *const str, gmic_parallel_thresholds &thresholds) {
+  gmic_parallel_thresholds res = thresholds;
+  char end = 0;
+  const int nb_values = cimg_sscanf(str,"%lu,%lu,%u,%u,%u%c",
+                                    &res.pointwise_size,&res.selection_size,
+                                    &res.expression_width,&res.expression_length,&res.max_threads,&end);
+  if (nb_values<1 || nb_values>5) return false;
+  thresholds = res;
+  return true;
+}
+
+inline const char *gmic_parallel_thresholds_filename(CImg<char>& filename) {
+  filename.assign(1024);
+  cimg_snprintf(filename,filename.width(),"%sparallel_thresholds.cfg",gmic::path_rc());
+  return filename;
+}
+
+inline bool gmic_getenv_ulong(const char *const name, unsigned long &value) {
+  const char *const env = getenv(name);
+  char end = 0;
+  return env && cimg_sscanf(env,"%lu%c",&value,&end)==1;
+}
+
+inline void gmic_init_parallel_thresholds() {
+  static bool is_initialized = false;
+  if (!is_initialized) {
+    CImg<char> filename;
+    gmic_parallel_thresholds_filename(filename); // Get path before locking (uses mutex 28).
+    cimg::mutex(25);
+    if (!is_initialized) {
+      gmic_parallel_thresholds &thresholds = _gmic_parallel_thresholds, res = thresholds;
+      std::FILE *const file = std::fopen(filename,"r");
+      if (file) {
+        if (std::fscanf(file,"%lu,%lu,%u,%u,%u",&res.pointwise_size,&res.selection_size,
+                        &res.expression_width,&res.expression_length,&res.max_threads)==5)
+          thresholds = res;
+        std::fclose(file);
+      }
+      unsigned long value = 0;
+      if (gmic_getenv_ulong("GMIC_PARALLEL_POINTWISE_SIZE",value)) thresholds.pointwise_size = value;
+      if (gmic_getenv_ulong("GMIC_PARALLEL_SELECTION_SIZE",value)) thresholds.selection_size = value;
+      if (gmic_getenv_ulong("GMIC_PARALLEL_EXPRESSION_WIDTH",value))
+        thresholds.expression_width = (unsigned int)value;
+      if (gmic_getenv_ulong("GMIC_PARALLEL_EXPRESSION_LENGTH",value))
+        thresholds.expression_length = (unsigned int)value;
+      if (gmic_getenv_ulong("GMIC_MAX_THREADS",value)) thresholds.max_threads = (unsigned int)value;
+      is_initialized = true;
+    }
+    cimg::mutex(25,0);
+  }
+  gmic_apply_max_threads();
+}
+
+inline bool gmic_save_parallel_thresholds() {
+  CImg<char> filename;
+  if (!gmic::init_rc()) return false;
+  std::FILE *const file = std::fopen(gmic_parallel_thresholds_filename(filename),"w");
+  if (!file) return false;
+  const gmic_parallel_thresholds &thresholds = _gmic_parallel_thresholds;
+  std::fprintf(file,"%lu,%lu,%u,%u,%u\n",
+               thresholds.pointwise_size,thresholds.selection_size,
+               thresholds.expression_width,thresholds.expression_length,thresholds.max_threads);
+  std::fclose(file);
+  return true;
+}
+
+#ifdef cimg_use_openmp
+// Apply the comparison operator '>' on 'img', as its sequential or parallel evaluation mode does
+// (without reading the current thresholds).
+inline void gmic_calibrate_comparison(CImg<float>& img, const char *const expression, const bool is_parallel) {
+  if (!expression) {
+#pragma omp parallel for if (is_parallel)
+    cimg_rof(img,ptrd,float) *ptrd = (float)(*ptrd>0.5f);
+    return;
+  }
+  CImg<float>::_cimg_math_parser mp(img,&img,expression,"parallel_thresholds");
+  if (is_parallel)
+#pragma omp parallel
+    {
+      CImg<float>::_cimg_math_parser
+        _mp = omp_get_thread_num()?mp:CImg<float>::_cimg_math_parser(), &lmp = omp_get_thread_num()?_mp:mp;
+#pragma omp for collapse(3)
+      cimg_forYZC(img,y,z,c) {
+        float *ptrd = img.data(0,y,z,c);
+        cimg_forX(img,x) { *ptrd = (float)(*ptrd>(float)lmp(x,y,z,c)); ++ptrd; }
+      }
+    }
+  else {
+    float *ptrd = img.data();
+    cimg_forYZC(img,y,z,c) cimg_forX(img,x) { *ptrd = (float)(*ptrd>(float)mp(x,y,z,c)); ++ptrd; }
+  }
+}
+
+// Return mean time (in ms) of a comparison operator applied on 'img', in the specified evaluation mode.
+inline double gmic_time_comparison(CImg<float>& img, const char *const expression, const bool is_parallel) {
+  gmic_calibrate_comparison(img,expression,is_parallel); // Warm-up.
+  const unsigned long time0 = cimg::time();
+  unsigned long elapsed = 0;
+  unsigned int nb_iterations = 0;
+  do {
+    gmic_calibrate_comparison(img,expression,is_parallel);
+    ++nb_iterations;
+  } while ((elapsed = cimg::time() - time0)<30);
+  return (double)elapsed/nb_iterations;
+}
+
+// Measure the sequential/parallel crossovers of comparison operators on the current machine.
+// A threshold is the smallest size for which parallel evaluation is faster, for all larger sizes.
+// Measurements run on each call, with their own evaluation modes: thresholds in use are unchanged until
+// the new ones are published (mutex 25). Concurrent calibrations are serialized by a dedicated lock.
+// Thresholds 'selection_size' and 'expression_length' are not measured.
+inline void gmic_calibrate_parallel_thresholds() {
+  static struct _gmic_calibration_lock {
+    omp_lock_t lock;
+    _gmic_calibration_lock() { omp_init_lock(&lock); }
+    ~_gmic_calibration_lock() { omp_destroy_lock(&lock); }
+  } calibration;
+  omp_set_lock(&calibration.lock);
+  unsigned long pointwise_size = ~0UL;
+  unsigned int expression_width = ~0U;
+  CImg<float> img;
+
+  for (unsigned long siz = 1UL<<22; siz>=(1UL<<10); siz>>=1) {
+    img.assign(1,siz).rand(0,1);
+    const double time_sequential = gmic_time_comparison(img,0,false);
+    if (gmic_time_comparison(img,0,true)>=time_sequential) break;
+    pointwise_size = siz;
+  }
+
+  for (unsigned int w = 8192; w>=16; w>>=1) {
+    img.assign(w,4*gmic_nb_threads()).rand(0,1);
+    const double time_sequential = gmic_time_comparison(img,"i + x*y",false);
+    if (gmic_time_comparison(img,"i + x*y",true)>=time_sequential) break;
+    expression_width = w;
+  }
+
+  cimg::mutex(25);
+  _gmic_parallel_thresholds.pointwise_size = pointwise_size;
+  _gmic_parallel_thresholds.expression_width = expression_width;
+  cimg::mutex(25,0);
+  omp_unset_lock(&calibration.lock);
+}
+#endif // #ifdef cimg_use_openmp
+
+// Macros and functions for applying commands on several selected images in parallel.
+// Only used for commands whose images are processed independently (with non-image arguments),
+// and when selected images are small (otherwise, the CImg methods are parallelized themselves).
+// This is opt-in: threshold 'selection_size' is 0 (disabled) by default, e.g. set 'GMIC_PARALLEL_SELECTION_SIZE=262144'.
+// Results are computed aside, and selected images are modified only if all of them succeed.
+#ifdef cimg_use_openmp
+#ifdef _MSC_VER
+#define _gmic_pragma(p) __pragma(p)
+#else // #ifdef _MSC_VER
+#define _gmic_pragma(p) _Pragma(#p)
+#endif // #ifdef _MSC_VER
+#define gmic_pragma_openmp(p) _gmic_pragma(omp p)
+#else // #ifdef cimg_use_openmp
+#define gmic_pragma_openmp(p)
+#endif // #ifdef cimg_use_openmp
+
+template<typename T>
+inline bool gmic_is_parallel_selection(const CImgList<T>& images, const CImg<unsigned int>& selection) {
+#ifdef cimg_use_openmp
+  const unsigned long selection_size = _gmic_parallel_thresholds.selection_size;
+  if (!selection_size || selection._height<2 || gmic_nb_threads()<2) return false;
+  cimg_forY(selection,l) if (images[selection[l]].size()>selection_size) return false;
+  const CImg<unsigned int> sorted = selection.get_sort(); // An image selected twice is processed twice.
+  for (unsigned int l = 1; l<sorted._height; ++l) if (sorted[l]==sorted[l - 1]) return false;
+  return true;
+#else // #ifdef cimg_use_openmp
+  cimg::unused(images,selection);
+  return false;
+#endif // #ifdef cimg_use_openmp
+}
+
+// Keep the exception thrown for the first selected image (with its type), to make errors deterministic
+// and rethrow them as in the serial path.
+struct _gmic_parallel_exception {
+  enum { type_none = 0, type_abort, type_argument, type_instance, type_io, type_display, type_warning, type_other,
+         type_interpreter, type_bad_alloc };
+  CImg<char> message, command_help;
+  int pos;
+  unsigned int type;
+
+  _gmic_parallel_exception():pos(-1),type(type_none) {}
+
+  void set(const int l, const unsigned int _type, const char *const _message=0,
+           const char *const _command_help=0) {
+#ifdef cimg_use_openmp
+#pragma omp critical
+#endif // #ifdef cimg_use_openmp
+    if (pos<0 || l<pos) {
+      pos = l;
+      type = _type;
+      if (_message) CImg<char>::string(_message).move_to(message); else message.assign();
+      if (_command_help) CImg<char>::string(_command_help).move_to(command_help); else command_help.assign();
+    }
+  }
+
+  operator bool() const {
+    return pos>=0;
+  }
+
+  void rethrow() const {
+    const char *const _message = message?message.data():"";
+    switch (type) {
+    case type_abort : throw CImgAbortException("");
+    case type_argument : throw CImgArgumentException("%s",_message);
+    case type_instance : throw CImgInstanceException("%s",_message);
+    case type_io : throw CImgIOException("%s",_message);
+    case type_display : throw CImgDisplayException("%s",_message);
+    case type_warning : throw CImgWarningException("%s",_message);
+    case type_interpreter : throw gmic_exception(command_help?command_help.data():0,_message);
+    case type_bad_alloc : throw std::bad_alloc();
+    default : throw CImgException("%s",_message);
+    }
+  }
+};
+
+#define gmic_apply_parallel(function) { \
+    if (!gmic_is_parallel_selection(images,selection)) cimg_forY(selection,l) gmic_apply(function) \
+    else { \
+      cimg_forY(selection,l) gmic_check(images[selection[l]]); \
+      const unsigned int __off = images._width; \
+      if (is_get_version) { \
+        images.insert(selection._height); \
+        cimg_forY(selection,l) images_names[selection[l]].get_copymark().move_to(images_names); \
+      } \
+      CImgList<T> __results(is_get_version?0:selection._height); \
+      _gmic_parallel_exception __exception; \
+      gmic_pragma_openmp(parallel for) \
+      cimg_forY(selection,l) try { \
+        if (is_get_version) images[selection[l]].get_##function.move_to(images[__off + l]); \
+        else images[selection[l]].get_##function.move_to(__results[l]); \
+      } catch (CImgAbortException&) { __exception.set(l,_gmic_parallel_exception::type_abort); } \
+      catch (CImgArgumentException &e) { __exception.set(l,_gmic_parallel_exception::type_argument,e.what()); } \
+      catch (CImgInstanceException &e) { __exception.set(l,_gmic_parallel_exception::type_instance,e.what()); } \
+      catch (CImgIOException &e) { __exception.set(l,_gmic_parallel_exception::type_io,e.what()); } \
+      catch (CImgDisplayException &e) { __exception.set(l,_gmic_parallel_exception::type_display,e.what()); } \
+      catch (CImgWarningException &e) { __exception.set(l,_gmic_parallel_exception::type_warning,e.what()); } \
+      catch (CImgException &e) { __exception.set(l,_gmic_parallel_exception::type_other,e.what()); } \
+      catch (gmic_exception &e) { \
+        __exception.set(l,_gmic_parallel_exception::type_interpreter,e.what(),e.command_help()); \
+      } catch (std::bad_alloc&) { __exception.set(l,_gmic_parallel_exception::type_bad_alloc); } \
+      if (__exception) { \
+        if (is_get_version) { \
+          images.remove(__off,images.width() - 1); \
+          images_names.remove(__off,images_names.width() - 1); \
+        } \
+        __exception.rethrow(); \
+      } \
+      cimglist_for(__results,l) { \
+        CImg<T> &__img = images[selection[l]]; \
+        if (__img._is_shared) __img = __results[l]; else __img.swap(__results[l]); \
+      } \
+    } \
+  }
+
 // Macro for simple commands that has no arguments and act on images.
 #define gmic_simple_command(command_name,function,description) \
-  if (!std::strcmp(command_name,command)) { \
+  if (command_id==gmic_cmd_##command_name) { \
     print(images,0,description,gmic_selection.data()); \
-    cimg_forY(selection,l) gmic_apply(function()); \
+    gmic_apply_parallel(function()); \
     is_released = false; continue; \
 }
 
@@ -2141,7 +2604,7 @@ inline char *_gmic_argument_text(const char *const argument, CImg<char>& argumen
                                 function2,description2,arg2_1,arg2_2, \
                                 description3,arg3_1,arg3_2, \
                                 description4) \
- if (!std::strcmp(command_name,command)) { \
+ if (command_id==gmic_cmd_##command_name) { \
    gmic_substitute_args(); \
    value = 0; \
    sep = 0; \
@@ -2168,7 +2631,7 @@ inline char *_gmic_argument_text(const char *const argument, CImg<char>& argumen
       ++position; \
    } else if (cimg_sscanf(argument,"[%255[a-zA-Z0-9_.%+-]%c%c",indices,&sep,&end)==2 && \
               sep==']' \
-              && (ind=selection2cimg(indices,images.size(),images_names,command_name,\
+              && (ind=selection2cimg(indices,images.size(),images_names,"-" #command_name, \
                                      true,false,CImg<char>::empty())).  \
               height()==1) { \
      print(images,0,description2 ".",arg2_1,arg2_2); \
@@ -2216,182 +2679,2536 @@ inline char *_gmic_argument_text(const char *const argument, CImg<char>& argumen
    }
 
 // Manage mutexes.
+// (counters of locks and contended locks are updated while holding the mutex).
 struct _gmic_mutex {
+  unsigned int nb_locks[256], nb_contentions[256];
 #if cimg_OS==2
   HANDLE mutex[256];
-  _gmic_mutex() { for (unsigned int i = 0; i<256; ++i) mutex[i] = CreateMutex(0,FALSE,0); }
-  void lock(const unsigned int n) { WaitForSingleObject(mutex[n],INFINITE); }
+  _gmic_mutex() {
+    for (unsigned int i = 0; i<256; ++i) { mutex[i] = CreateMutex(0,FALSE,0); nb_locks[i] = nb_contentions[i] = 0; }
+  }
+  void lock(const unsigned int n) {
+    const bool is_contended = WaitForSingleObject(mutex[n],0)==WAIT_TIMEOUT;
+    if (is_contended) WaitForSingleObject(mutex[n],INFINITE);
+    ++nb_locks[n]; if (is_contended) ++nb_contentions[n];
+  }
   void unlock(const unsigned int n) { ReleaseMutex(mutex[n]); }
 #elif defined(_PTHREAD_H) // #if cimg_OS==2
   pthread_mutex_t mutex[256];
-  _gmic_mutex() { for (unsigned int i = 0; i<256; ++i) pthread_mutex_init(&mutex[i],0); }
-  void lock(const unsigned int n) { pthread_mutex_lock(&mutex[n]); }
+  _gmic_mutex() {
+    for (unsigned int i = 0; i<256; ++i) { pthread_mutex_init(&mutex[i],0); nb_locks[i] = nb_contentions[i] = 0; }
+  }
+  void lock(const unsigned int n) {
+    const bool is_contended = pthread_mutex_trylock(&mutex[n])!=0;
+    if (is_contended) pthread_mutex_lock(&mutex[n]);
+    ++nb_locks[n]; if (is_contended) ++nb_contentions[n];
+  }
   void unlock(const unsigned int n) { pthread_mutex_unlock(&mutex[n]); }
 #else // #if cimg_OS==2
-  _gmic_mutex() {}
-  void lock(const unsigned int) {}
+  _gmic_mutex() { for (unsigned int i = 0; i<256; ++i) nb_locks[i] = nb_contentions[i] = 0; }
+  void lock(const unsigned int n) { ++nb_locks[n]; }
   void unlock(const unsigned int) {}
 #endif // #if cimg_OS==2
 };
 inline _gmic_mutex& gmic_mutex() { static _gmic_mutex val; return val; }
 
-// Thread structure and routine for command '-parallel'.
-template<typename T>
-struct st_gmic_parallel {
-  CImgList<char> *images_names, *parent_images_names, commands_line;
-  CImgList<st_gmic_parallel<T> > *threads_data;
-  CImgList<T> *images, *parent_images;
-  CImg<unsigned int> variables_sizes;
-  volatile bool is_thread_running;
-  gmic_exception exception;
-  gmic gmic_instance;
-#ifdef gmic_is_parallel
-#if cimg_OS!=2
-  pthread_t thread_id;
-#else // #if cimg_OS!=2
-  HANDLE thread_id;
-#endif // #if cimg_OS!=2
-#endif // #ifdef gmic_is_parallel
-  st_gmic_parallel() { variables_sizes.assign(512); }
-};
+// Manage cache of compiled math expressions (used by '{...}' substitutions and command '-check').
+// Only expressions that do not depend on image content are compiled once and re-evaluated,
+// other expressions are recorded as such and must be evaluated with 'CImg<T>::eval()'.
+struct _gmic_math_cache {
+  typedef CImg<double>::_cimg_math_parser math_parser;
+  enum { capacity = 64 };
+  math_parser *parsers[capacity];
+  CImg<char> expressions[capacity];
+  unsigned long stamps[capacity], stamp;
+  unsigned int hashes[capacity], nb_hits, nb_misses, nb_dependents;
+
+  _gmic_math_cache():stamp(0),nb_hits(0),nb_misses(0),nb_dependents(0) {
+    for (unsigned int i = 0; i<capacity; ++i) { parsers[i] = 0; stamps[i] = 0; hashes[i] = 0; }
+  }
 
-template<typename T>
-#if cimg_OS!=2
-static void *gmic_parallel(void *arg)
-#else // #if cimg_OS!=2
-static DWORD WINAPI gmic_parallel(void *arg)
-#endif // #if cimg_OS!=2
-{
-  st_gmic_parallel<T> &st = *(st_gmic_parallel<T>*)arg;
-  unsigned int pos = 0;
-  try {
-    st.gmic_instance.is_debug_info = false;
-    st.gmic_instance._run(st.commands_line,pos,*st.images,*st.images_names,
-                          *st.parent_images,*st.parent_images_names,
-                          st.variables_sizes,0,0);
-  } catch (gmic_exception &e) {
+  ~_gmic_math_cache() {
+    for (unsigned int i = 0; i<capacity; ++i) delete parsers[i];
+  }
 
-    // Send all remaining running threads the 'abort' signal.
-#ifdef gmic_is_parallel
-    CImgList<st_gmic_parallel<T> > &threads_data = *st.threads_data;
-    cimglist_for(threads_data,i) cimg_forY(threads_data[i],l)
-      if (&threads_data(i,l)!=&st && threads_data(i,l).is_thread_running) {
-        threads_data(i,l).gmic_instance.is_abort_thread = true;
-#if cimg_OS!=2
-        pthread_join(threads_data(i,l).thread_id,0);
-#else // #if cimg_OS!=2
-        WaitForSingleObject(threads_data(i,l).thread_id,INFINITE);
-        CloseHandle(threads_data(i,l).thread_id);
-#endif // #if cimg_OS!=2
-        threads_data(i,l).is_thread_running = false;
+  // Return true if all identifiers of an expression are known to be image-independent and deterministic.
+  static bool is_independent(const char *const expression) {
+    static const char *const names[] = {
+      "abs","acos","asin","atan","atan2","c","cbrt","ceil","cos","cosh","cut","e","exp","floor","if","inf",
+      "isbool","isinf","isint","isnan","isval","log","log10","log2","max","min","nan","pi","round","sign",
+      "sin","sinc","sinh","sqr","sqrt","tan","tanh","x","y","z", 0 };
+    for (const char *s = expression; *s; ) {
+      const char c = *s;
+      if (c=='\'' || c=='\"' || c=='#' || c=='[') return false;
+      if ((c>='0' && c<='9') || c=='.') { // Skip numbers (including exponents).
+        while ((*s>='0' && *s<='9') || *s=='.' || (*s>='a' && *s<='z') || (*s>='A' && *s<='Z') || *s=='_') ++s;
+        continue;
       }
-#endif // #ifdef gmic_is_parallel
+      if ((c>='a' && c<='z') || (c>='A' && c<='Z') || c=='_') {
+        const char *const s0 = s;
+        while ((*s>='0' && *s<='9') || (*s>='a' && *s<='z') || (*s>='A' && *s<='Z') || *s=='_') ++s;
+        const unsigned int l = (unsigned int)(s - s0);
+        bool is_known = false;
+        for (const char *const *p = names; *p && !is_known; ++p)
+          is_known = !std::strncmp(*p,s0,l) && !(*p)[l];
+        if (!is_known) return false;
+        continue;
+      }
+      ++s;
+    }
+    return true;
+  }
 
-    st.exception._command_help.assign(e._command_help);
-    st.exception._message.assign(e._message);
+  // Return compiled expression, or 0 if expression must be evaluated on its image.
+  math_parser *get(const char *const expression) {
+    unsigned int hash = 0;
+    for (const char *s = expression; *s; ++s) hash = 31*hash + (unsigned char)*s;
+    for (unsigned int i = 0; i<capacity; ++i)
+      if (!expressions[i].is_empty() && hashes[i]==hash && !std::strcmp(expressions[i]._data,expression)) {
+        stamps[i] = ++stamp;
+        if (!parsers[i]) { ++nb_dependents; return 0; }
+        ++nb_hits; return parsers[i];
+      }
+    math_parser *mp = 0;
+    if (is_independent(expression)) {
+      try { mp = new math_parser(CImg<double>::empty(),0,expression,"eval"); }
+      catch (CImgException&) { return 0; } // Let 'CImg<T>::eval()' report the error.
+      ++nb_misses;
+    } else ++nb_dependents;
+    unsigned int ind = 0;
+    for (unsigned int i = 1; i<capacity; ++i) if (stamps[i]<stamps[ind]) ind = i;
+    delete parsers[ind];
+    parsers[ind] = mp;
+    CImg<char>(expression,(unsigned int)std::strlen(expression) + 1).move_to(expressions[ind]);
+    hashes[ind] = hash;
+    stamps[ind] = ++stamp;
+    return mp;
   }
-#if defined(gmic_is_parallel) && cimg_OS!=2
-  pthread_exit(0);
-#endif // #if defined(gmic_is_parallel) && cimg_OS!=2
-  return 0;
-}
 
-// Return Levenshtein distance between two strings.
-// (adapted from http://rosettacode.org/wiki/Levenshtein_distance#C)
-int gmic::_levenshtein(const char *const s, const char *const t,
-                       CImg<int>& d, const int i, const int j) {
-  const int ls = d.width() - 1, lt = d.height() - 1;
-  if (d(i,j)>=0) return d(i,j);
-  int x;
-  if (i==ls) x = lt - j;
-  else if (j==lt) x = ls - i;
-  else if (s[i]==t[j]) x = _levenshtein(s,t,d,i + 1,j + 1);
-  else {
-    x = _levenshtein(s,t,d,i + 1,j + 1);
-    int y;
-    if ((y=_levenshtein(s,t,d,i,j + 1))<x) x = y;
-    if ((y=_levenshtein(s,t,d,i + 1,j))<x) x = y;
-    ++x;
+  // Evaluate expression, using the compiled version when possible.
+  template<typename T>
+  double eval(const CImg<T>& img, const char *const expression) {
+    math_parser *const mp = get(expression);
+    return mp?(*mp)(0,0,0,0):img.eval(expression);
   }
-  return d(i,j) = x;
-}
+};
 
-int gmic::levenshtein(const char *const s, const char *const t) {
-  const char *const ns = s?s:"", *const nt = t?t:"";
-  const int ls = (int)std::strlen(ns), lt = (int)std::strlen(nt);
-  if (!ls) return lt; else if (!lt) return ls;
-  CImg<int> d(1 + ls,1 + lt,1,1,-1);
-  return _levenshtein(ns,nt,d,0,0);
-}
+// Manage stacks of reusable scratch frames, indexed by recursion depth.
+template<typename F>
+struct _gmic_frames {
+  F **frames;
+  unsigned int depth, capacity;
 
-// Return true if specified filename corresponds to an existing file or directory.
-bool gmic::check_filename(const char *const filename) {
-  bool res = false;
-#if cimg_OS==2
-  const unsigned int attr = (unsigned int)GetFileAttributesA(filename);
-  res = (attr!=~0U);
-#else // #if cimg_OS==2
-  try {
-    std::FILE *file = cimg::fopen(filename,"r");
-    if (file) { res = true; cimg::fclose(file); }
-  } catch (CImgException&) {}
-#endif // #if cimg_OS==2
-  return res;
-}
+  _gmic_frames():frames(0),depth(0),capacity(0) {}
 
-// Return a 8-bits hashcode from a string.
-unsigned int gmic::hashcode(const char *const str, const bool is_variable) {
-  if (!str) return 0U;
-  unsigned int hash = 0U;
-  if (is_variable) {
-    if (*str=='_') return str[1]=='_'?511U:510U;
-    for (const char *s = str; *s; ++s) (hash*=31)+=*s;
-    return hash%510;
+  ~_gmic_frames() {
+    for (unsigned int i = 0; i<capacity; ++i) delete frames[i];
+    delete[] frames;
   }
-  for (const char *s = str; *s; ++s) (hash*=31)+=*s;
-  return hash&511;
-}
 
-// Tells if the the implementation of a G'MIC command contains arguments.
-bool gmic::command_has_arguments(const char *const command) {
-  if (!command || !*command) return false;
-  for (const char *s = std::strchr(command,'$'); s; s = std::strchr(s,'$')) {
-    const char c = *(++s);
-    if (c=='#' ||
-        c=='*' ||
-        c=='=' ||
-        (c>'0' && c<='9') ||
-        (c=='-' && *(s + 1)>'0' && *(s + 1)<='9') ||
-        (c=='\"' && *(s + 1)=='*' && *(s + 2)=='\"') ||
-        (c=='{' && (*(s + 1)=='^' ||
-                    (*(s + 1)>'0' && *(s + 1)<='9') ||
-                    (*(s + 1)=='-' && *(s + 2)>'0' && *(s + 2)<='9')))) return true;
+  F& enter() {
+    if (depth==capacity) {
+      const unsigned int ncapacity = capacity?2*capacity:16;
+      F **const nframes = new F*[ncapacity];
+      for (unsigned int i = 0; i<ncapacity; ++i) nframes[i] = i<capacity?frames[i]:0;
+      delete[] frames;
+      frames = nframes;
+      capacity = ncapacity;
+    }
+    if (!frames[depth]) frames[depth] = new F;
+    return *frames[depth++];
   }
-  return false;
-}
 
-// Compute the basename of a filename.
-const char* gmic::basename(const char *const str)  {
-  if (!str) return str;
-  const unsigned int l = (unsigned int)std::strlen(str);
-  if (*str=='[' && (str[l - 1]==']' || str[l - 1]=='.')) return str;
-  const char *p = 0, *np = str;
-  while (np>=str && (p=np)) np = std::strchr(np,'/') + 1;
-  np = p;
-  while (np>=str && (p=np)) np = std::strchr(np,'\\') + 1;
-  return p;
-}
+  void leave() { --depth; }
+};
 
-// Replace special characters in a string.
-char *gmic::strreplace_fw(char *const str) {
-  if (str) for (char *s = str ; *s; ++s) {
-      const char c = *s;
-      if (c<' ')
-        *s = c==_dollar?'$':c==_lbrace?'{':c==_rbrace?'}':c==_comma?',':
-          c==_dquote?'\"':c;
+// Scoped access to the scratch frame of the current recursion depth (released on exceptions too).
+template<typename F>
+struct _gmic_frame {
+  _gmic_frames<F> &frames;
+  F &frame;
+  _gmic_frame(_gmic_frames<F> &p_frames):frames(p_frames),frame(p_frames.enter()) {}
+  ~_gmic_frame() { frames.leave(); }
+};
+
+// Scratch frame of 'gmic::substitute_item()', with a growable string builder for the substituted item.
+struct _gmic_substitution_frame {
+  CImg<char> items, inbraces, substr;
+  unsigned int siz;
+
+  _gmic_substitution_frame():substr(40),siz(0) {}
+
+  void append(const char *const str, const unsigned int l) {
+    if (siz + l>=items._width) {
+      CImg<char> nitems(cimg::max(2*items._width,siz + l + 1,64U));
+      if (siz) std::memcpy(nitems._data,items._data,siz);
+      nitems.move_to(items);
     }
-  return str;
-}
+    if (l) std::memcpy(items._data + siz,str,l);
+    siz+=l;
+  }
+
+  void append(const char *const str) { append(str,(unsigned int)std::strlen(str)); }
+};
+typedef _gmic_frames<_gmic_substitution_frame> _gmic_substitution_frames;
+
+// Scratch frame of 'gmic::_run()', holding the string variables widely used by commands.
+struct _gmic_run_frame {
+  CImg<char> formula, color, message, title, indices, argx, argy, argz, argc, current_command,
+    argument_text, command, restriction;
+  _gmic_run_frame():formula(4096),color(4096),message(1024),title(256),indices(256),
+                    argx(256),argy(256),argz(256),argc(256),current_command(256),argument_text(81),
+                    command(256),restriction(256) {}
+};
+typedef _gmic_frames<_gmic_run_frame> _gmic_run_frames;
+
+#ifdef _MSC_VER
+#define gmic_memory_barrier() MemoryBarrier()
+#else // #ifdef _MSC_VER
+#define gmic_memory_barrier() __sync_synchronize()
+#endif // #ifdef _MSC_VER
+
+// Manage memory-mapped .cimg files (command '-input').
+// Images of a mapped file are shared images that refer to a private (copy-on-write) mapping of the file.
+// Like deferred copies, they are turned into actual copies only before a command modifies them in place.
+// Lock-free compare-and-swap.
+#ifdef _MSC_VER
+#define gmic_cas(ptr,expected,desired) \
+  (unsigned long long)InterlockedCompareExchange64((volatile LONGLONG*)(ptr),(LONGLONG)(desired),(LONGLONG)(expected))
+#define gmic_cas_pointer(ptr,expected,desired) \
+  InterlockedCompareExchangePointer((PVOID volatile*)(ptr),(PVOID)(desired),(PVOID)(expected))
+#else // #ifdef _MSC_VER
+#define gmic_cas(ptr,expected,desired) __sync_val_compare_and_swap(ptr,expected,desired)
+#define gmic_cas_pointer(ptr,expected,desired) __sync_val_compare_and_swap(ptr,expected,desired)
+#endif // #ifdef _MSC_VER
+
+// Number of deferred copies and mapped files of all interpreters (updated with compare-and-swap).
+// When zero, no image has to be turned into an actual copy before being modified.
+static volatile unsigned long long _gmic_nb_shared_buffers = 0;
+
+inline void gmic_count_shared_buffers(const long long n) {
+  for (unsigned long long old = _gmic_nb_shared_buffers, prev;
+       (prev = gmic_cas(&_gmic_nb_shared_buffers,old,old + n))!=old; ) old = prev;
+}
+
+// Mappings are shared by an interpreter and its threads. They are added under mutex 27, and removed only
+// by the interpreter itself when none of its threads runs, so they can be looked up without lock.
+// When all slots are used, files are loaded the usual way.
+struct _gmic_mapped_files {
+  char *ptrs[256];
+  std::size_t sizes[256];
+  unsigned long long devs[256], inos[256]; // Identity of the mapped files.
+  volatile unsigned int siz;
+
+  _gmic_mapped_files():siz(0) {}
+  ~_gmic_mapped_files() { unmap(); }
+
+  bool add(char *const ptr, const std::size_t size, const unsigned long long dev, const unsigned long long ino) {
+    cimg::mutex(27);
+    const bool res = siz<256;
+    if (res) {
+      ptrs[siz] = ptr; sizes[siz] = size; devs[siz] = dev; inos[siz] = ino;
+      gmic_memory_barrier();
+      ++siz;
+      gmic_count_shared_buffers(1);
+    }
+    cimg::mutex(27,0);
+    return res;
+  }
+
+  bool contains(const void *const ptr) const {
+    for (unsigned int i = 0; i<siz; ++i) if ((const char*)ptr>=ptrs[i] && (const char*)ptr<ptrs[i] + sizes[i])
+      return true;
+    return false;
+  }
+
+  // Unmap files that are not referenced anymore by the images of a list
+  // (which must hold all the images of the interpreter, and no thread of the interpreter must run).
+  template<typename T>
+  void collect(const CImgList<T>& images) {
+    cimg::mutex(27);
+    unsigned int nsiz = 0;
+    for (unsigned int i = 0; i<siz; ++i) {
+      bool is_used = false;
+      cimglist_for(images,l) {
+        const char *const ptr = (const char*)images[l]._data;
+        if (images[l]._is_shared && ptr>=ptrs[i] && ptr<ptrs[i] + sizes[i]) { is_used = true; break; }
+      }
+      if (is_used) {
+        ptrs[nsiz] = ptrs[i]; sizes[nsiz] = sizes[i]; devs[nsiz] = devs[i]; inos[nsiz] = inos[i];
+        ++nsiz;
+      }
+#if cimg_OS==1
+      else munmap(ptrs[i],sizes[i]);
+#endif // #if cimg_OS==1
+    }
+    gmic_count_shared_buffers((long long)nsiz - siz);
+    siz = nsiz;
+    cimg::mutex(27,0);
+  }
+
+  // Remove a mapped file before it gets overwritten, so that its mappings keep referring to its former
+  // content (instead of a truncated file, whose access would crash).
+  void detach(const char *const filename) const {
+#if cimg_OS==1
+    struct stat st;
+    if (!siz || stat(filename,&st)) return;
+    for (unsigned int i = 0; i<siz; ++i)
+      if (devs[i]==(unsigned long long)st.st_dev && inos[i]==(unsigned long long)st.st_ino) {
+        std::remove(filename);
+        break;
+      }
+#else // #if cimg_OS==1
+    cimg::unused(filename);
+#endif // #if cimg_OS==1
+  }
+
+  // Turn images that refer to a mapped file into actual copies, then release all mappings.
+  template<typename T>
+  void release(CImgList<T>& images) {
+    if (!siz) return;
+    cimglist_for(images,l) if (images[l]._is_shared && contains(images[l]._data)) {
+      CImg<T> copy(images[l],false);
+      images[l].swap(copy);
+    }
+    unmap();
+  }
+
+  void unmap() {
+    cimg::mutex(27);
+#if cimg_OS==1
+    for (unsigned int i = 0; i<siz; ++i) munmap(ptrs[i],sizes[i]);
+#endif // #if cimg_OS==1
+    gmic_count_shared_buffers(-(long long)siz);
+    siz = 0;
+    cimg::mutex(27,0);
+  }
+};
+
+// Manage deferred copies of images.
+// A deferred copy is a shared image that refers to the pixel buffer of an image of a parent environment.
+// It is turned into an actual copy only before a command modifies it in place.
+struct _gmic_deferred_images {
+  const void **data;
+  unsigned int siz, capacity;
+
+  _gmic_deferred_images():data(0),siz(0),capacity(0) {}
+  ~_gmic_deferred_images() { delete[] data; }
+
+  void add(const void *const ptr) {
+    if (siz==capacity) {
+      const unsigned int ncapacity = capacity?2*capacity:64;
+      const void **const ndata = new const void*[ncapacity];
+      if (siz) std::memcpy(ndata,data,siz*sizeof(const void*));
+      delete[] data;
+      data = ndata;
+      capacity = ncapacity;
+    }
+    data[siz++] = ptr;
+    gmic_count_shared_buffers(1);
+  }
+
+  bool contains(const void *const ptr) const {
+    for (unsigned int i = 0; i<siz; ++i) if (data[i]==ptr) return true;
+    return false;
+  }
+
+  // Turn an image into an actual copy, if it is a deferred copy (or an image of a mapped file).
+  template<typename T>
+  void materialize(CImg<T>& img, const _gmic_mapped_files& mapped) const {
+    if (img._is_shared && ((siz && contains(img._data)) || mapped.contains(img._data))) {
+      CImg<T> copy(img,false);
+      img.swap(copy);
+    }
+  }
+};
+
+// Scope of the deferred copies made for a custom command (released on exceptions too).
+struct _gmic_deferred_scope {
+  _gmic_deferred_images &deferred;
+  const unsigned int siz;
+  _gmic_deferred_scope(_gmic_deferred_images &p_deferred):deferred(p_deferred),siz(p_deferred.siz) {}
+  ~_gmic_deferred_scope() { gmic_count_shared_buffers((long long)siz - deferred.siz); deferred.siz = siz; }
+};
+
+// Return true if a native command never modifies the pixel values of its selected images in place.
+inline bool gmic_is_readonly_command(const unsigned int command_id) {
+  switch (command_id) {
+  case gmic_cmd__status : case gmic_cmd_await : case gmic_cmd_break : case gmic_cmd_camera : case gmic_cmd_check :
+  case gmic_cmd_command : case gmic_cmd_continue : case gmic_cmd_cursor : case gmic_cmd_debug :
+  case gmic_cmd_display : case gmic_cmd_display3d : case gmic_cmd_do : case gmic_cmd_done :
+  case gmic_cmd_double3d : case gmic_cmd_e : case gmic_cmd_echo : case gmic_cmd_elif : case gmic_cmd_else :
+  case gmic_cmd_endif : case gmic_cmd_endl : case gmic_cmd_endlocal : case gmic_cmd_error : case gmic_cmd_exec :
+  case gmic_cmd_files : case gmic_cmd_focale3d : case gmic_cmd_i : case gmic_cmd_if : case gmic_cmd_input :
+  case gmic_cmd_keep : case gmic_cmd_local : case gmic_cmd_mode3d : case gmic_cmd_moded3d : case gmic_cmd_move :
+  case gmic_cmd_mutex : case gmic_cmd_name : case gmic_cmd_noarg : case gmic_cmd_onfail : case gmic_cmd_output :
+  case gmic_cmd_pass : case gmic_cmd_plot : case gmic_cmd_print : case gmic_cmd_progress : case gmic_cmd_quit :
+  case gmic_cmd_remove : case gmic_cmd_repeat : case gmic_cmd_return : case gmic_cmd_reverse :
+  case gmic_cmd_skip : case gmic_cmd_specl3d : case gmic_cmd_specs3d : case gmic_cmd_srand :
+  case gmic_cmd_status : case gmic_cmd_uncommand : case gmic_cmd_v : case gmic_cmd_verbose : case gmic_cmd_wait :
+  case gmic_cmd_warn : case gmic_cmd_while : case gmic_cmd_window :
+    return true;
+  default :
+    return false;
+  }
+}
+
+// Manage local variables.
+// Variable names are interned in an open-addressing hash table, whose slots refer to the most recent
+// definition of each name. Definitions are stacked and linked to the definitions they hide, so that
+// leaving a scope costs only the number of variables defined in this scope.
+struct _gmic_variables {
+  CImgList<char> names, values;
+  CImg<unsigned int> slots;
+  CImg<int> heads, previous;
+  unsigned int nb_names, siz;
+
+  _gmic_variables():nb_names(0),siz(0) {
+    names.assign(64);
+    heads.assign(64,1,1,1,-1);
+    slots.assign(64);
+    previous.assign(64);
+  }
+
+  static unsigned int hash(const char *const name) {
+    unsigned int res = 0;
+    for (const char *s = name; *s; ++s) res = 31*res + (unsigned char)*s;
+    return res;
+  }
+
+  // Return slot of a name, or ~0U if name has not been interned yet (and 'is_insert' is false).
+  unsigned int slot(const char *const name, const bool is_insert) {
+    if (is_insert && 2*(nb_names + 1)>names._width) rehash(2*names._width);
+    const unsigned int mask = names._width - 1;
+    for (unsigned int i = hash(name)&mask; ; i = (i + 1)&mask) {
+      if (names[i].is_empty()) {
+        if (!is_insert) return ~0U;
+        CImg<char>::string(name).move_to(names[i]);
+        heads[i] = -1;
+        ++nb_names;
+        return i;
+      }
+      if (!std::strcmp(names[i]._data,name)) return i;
+    }
+  }
+
+  void rehash(const unsigned int width) {
+    CImgList<char> nnames(width);
+    CImg<int> nheads(width,1,1,1,-1);
+    CImg<unsigned int> nslots(names._width,1,1,1,~0U);
+    const unsigned int mask = width - 1;
+    cimglist_for(names,i) if (!names[i].is_empty()) {
+      unsigned int j = hash(names[i]._data)&mask;
+      while (!nnames[j].is_empty()) j = (j + 1)&mask;
+      names[i].move_to(nnames[j]);
+      nheads[j] = heads[i];
+      nslots[i] = j;
+    }
+    for (unsigned int e = 0; e<siz; ++e) if (slots[e]!=~0U) slots[e] = nslots[slots[e]];
+    names.swap(nnames);
+    heads.swap(nheads);
+  }
+
+  // Return index of the definition of a name visible from a scope starting at 'marker', or -1.
+  int find(const char *const name, const unsigned int marker) {
+    const unsigned int s = slot(name,false);
+    if (s==~0U) return -1;
+    const int e = heads[s];
+    return e>=(int)marker?e:-1;
+  }
+
+  // Add new definition of a variable and return its index.
+  unsigned int push(const char *const name, CImg<char>& value) {
+    const unsigned int s = slot(name,true);
+    if (siz>=slots._width) {
+      slots.resize(2*slots._width,1,1,1,0);
+      previous.resize(2*previous._width,1,1,1,0);
+    }
+    slots[siz] = s;
+    previous[siz] = heads[s];
+    heads[s] = (int)siz;
+    value.move_to(values);
+    return siz++;
+  }
+
+  // Remove a single definition (not necessarily the most recent one).
+  void remove(const unsigned int e) {
+    const unsigned int s = slots[e];
+    if (s==~0U) return;
+    if (heads[s]==(int)e) heads[s] = previous[e];
+    else for (int f = heads[s]; f>=0; f = previous[f]) if (previous[f]==(int)e) { previous[f] = previous[e]; break; }
+    slots[e] = ~0U;
+    values[e].assign();
+    unsigned int nsiz = siz;
+    while (nsiz && slots[nsiz - 1]==~0U) --nsiz;
+    if (nsiz<siz) { values.remove(nsiz,siz - 1); siz = nsiz; }
+  }
+
+  // Remove all definitions made since 'marker'.
+  void pop(const unsigned int marker) {
+    if (marker>=siz) return;
+    for (unsigned int e = siz; e>marker; --e) {
+      const unsigned int s = slots[e - 1];
+      if (s!=~0U) heads[s] = previous[e - 1];
+    }
+    values.remove(marker,siz - 1);
+    siz = marker;
+  }
+};
+
+// Buffered logging of interpreter messages.
+// Each interpreter formats its messages into its own log ring, without lock (single producer).
+// Rings are drained in order by the thread holding mutex 29 (single consumer): the background log writer,
+// or any thread that writes to the output directly (see 'gmic_lock_output()').
+// The writer sleeps until a record is pushed, and is stopped when the last ring is unregistered.
+// Records are written directly when the output stream changes, and are all written before 'run()' returns,
+// so that no record refers to a stream closed by the caller.
+#ifndef va_copy
+#define va_copy(dest,src) ((dest)=(src))
+#endif // #ifndef va_copy
+
+struct _gmic_log_ring {
+  CImg<char> record, data;
+  unsigned int record_siz;
+  volatile unsigned int head, tail;
+  _gmic_log_ring *prev, *next;
+  std::FILE *file; // Output stream of the last pushed record.
+  bool is_registered;
+
+  _gmic_log_ring():record_siz(0),head(0),tail(0),prev(0),next(0),file(0),is_registered(false) {}
+  ~_gmic_log_ring();
+
+  // Append formatted text to the current record.
+  void printf(const char *const format, ...) {
+    va_list ap, _ap;
+    va_start(ap,format);
+    for (;;) {
+      const unsigned int avail = record._width - record_siz;
+      int l = -1;
+      if (avail) {
+        va_copy(_ap,ap);
+        l = cimg_vsnprintf(record._data + record_siz,avail,format,_ap);
+        va_end(_ap);
+      }
+      if (l>=0 && (unsigned int)l<avail) { record_siz+=l; break; }
+      record.resize(cimg::max(2*record._width,record_siz + (l>0?l:0) + 1,256U),1,1,1,0);
+    }
+    va_end(ap);
+  }
+
+  void putc(const char c) {
+    if (record_siz + 1>=record._width) record.resize(cimg::max(2*record._width,256U),1,1,1,0);
+    record[record_siz++] = c;
+  }
+
+  void _write(unsigned int &pos, const void *const ptr, const unsigned int siz) {
+    const unsigned int off = pos&(data._width - 1), l = cimg::min(siz,data._width - off);
+    std::memcpy(data._data + off,ptr,l);
+    if (l<siz) std::memcpy(data._data,(const char*)ptr + l,siz - l);
+    pos+=siz;
+  }
+
+  void _read(unsigned int &pos, void *const ptr, const unsigned int siz) const {
+    const unsigned int off = pos&(data._width - 1), l = cimg::min(siz,data._width - off);
+    std::memcpy(ptr,data._data + off,l);
+    if (l<siz) std::memcpy((char*)ptr + l,data._data,siz - l);
+    pos+=siz;
+  }
+
+  // Push current record into the ring (return false if not enough space).
+  bool push(std::FILE *const file) {
+    const unsigned int siz = record_siz + sizeof(unsigned int) + sizeof(std::FILE*);
+    if (siz>data._width - (head - tail)) return false;
+    unsigned int pos = head;
+    _write(pos,&record_siz,sizeof(unsigned int));
+    _write(pos,&file,sizeof(std::FILE*));
+    _write(pos,record._data,record_siz);
+    gmic_memory_barrier();
+    head = pos;
+    return true;
+  }
+
+  // Write pushed records to their output streams (mutex 29 must be locked).
+  // Argument 'file' is the last stream written, not flushed yet.
+  void drain(std::FILE* &file) {
+    const unsigned int _head = head;
+    gmic_memory_barrier();
+    unsigned int pos = tail;
+    while (pos!=_head) {
+      unsigned int siz = 0;
+      std::FILE *nfile = 0;
+      _read(pos,&siz,sizeof(unsigned int));
+      _read(pos,&nfile,sizeof(std::FILE*));
+      if (file && file!=nfile) std::fflush(file);
+      file = nfile;
+      const unsigned int off = pos&(data._width - 1), l = cimg::min(siz,data._width - off);
+      std::fwrite(data._data + off,1,l,file);
+      if (l<siz) std::fwrite(data._data,1,siz - l,file);
+      pos+=siz;
+    }
+    gmic_memory_barrier();
+    tail = pos;
+  }
+
+  void commit(const bool is_sync=false);
+};
+
+// Registered log rings, and background log writer (protected by mutex 29).
+// The writer waits on condition 'cond' until a record is pushed ('is_pending') or it is asked to stop.
+// 'mutex' protects 'is_pending' and the stop requests, and is never held while taking mutex 29.
+struct _gmic_log {
+  _gmic_log_ring *rings;
+  bool is_writer;
+#if defined(gmic_is_parallel) && cimg_OS!=2
+  struct writer_thread {
+    _gmic_log *log;
+    pthread_t thread_id;
+    bool is_stop;
+  } *writer;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  volatile bool is_pending;
+
+  _gmic_log():rings(0),is_writer(false),writer(0),is_pending(false) {
+    pthread_mutex_init(&mutex,0);
+    pthread_cond_init(&cond,0);
+  }
+#else // #if defined(gmic_is_parallel) && cimg_OS!=2
+  _gmic_log():rings(0),is_writer(false) {}
+#endif // #if defined(gmic_is_parallel) && cimg_OS!=2
+
+  void drain(std::FILE* &file) {
+    for (_gmic_log_ring *ring = rings; ring; ring = ring->next) ring->drain(file);
+  }
+
+#if defined(gmic_is_parallel) && cimg_OS!=2
+  // Drain rings each time a record is pushed. A stopped writer drains them a last time before ending
+  // (it may have been woken up in place of a new writer).
+  static void *writer_routine(void *arg) {
+    writer_thread &w = *(writer_thread*)arg;
+    _gmic_log &log = *w.log;
+    for (bool is_stop = false; !is_stop; ) {
+      pthread_mutex_lock(&log.mutex);
+      while (!log.is_pending && !w.is_stop) pthread_cond_wait(&log.cond,&log.mutex);
+      is_stop = w.is_stop;
+      log.is_pending = false;
+      pthread_mutex_unlock(&log.mutex);
+      std::FILE *file = 0;
+      cimg::mutex(29);
+      log.drain(file);
+      if (file) std::fflush(file);
+      cimg::mutex(29,0);
+    }
+    return 0;
+  }
+
+  // Wake up the writer after a record has been pushed.
+  void notify() {
+    gmic_memory_barrier(); // Pushed record must be visible to a writer that has just reset 'is_pending'.
+    if (is_pending) return;
+    pthread_mutex_lock(&mutex);
+    is_pending = true;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+  }
+
+  // Start background log writer (mutex 29 must be locked).
+  void start_writer() {
+    writer = new writer_thread;
+    writer->log = this;
+    writer->is_stop = false;
+    if (pthread_create(&writer->thread_id,0,writer_routine,writer)) { delete writer; writer = 0; }
+    is_writer = writer!=0;
+  }
+
+  // Ask background log writer to stop (mutex 29 must be locked), and return it, to be joined once
+  // mutex 29 is unlocked.
+  writer_thread *stop_writer() {
+    writer_thread *const w = writer;
+    if (!w) return 0;
+    writer = 0;
+    is_writer = false;
+    pthread_mutex_lock(&mutex);
+    w->is_stop = true;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+    return w;
+  }
+
+  static void join_writer(writer_thread *const w) {
+    if (!w) return;
+    pthread_join(w->thread_id,0);
+    delete w;
+  }
+#endif // #if defined(gmic_is_parallel) && cimg_OS!=2
+};
+
+inline _gmic_log& gmic_log() {
+  static _gmic_log val;
+  return val;
+}
+
+// Lock output for direct writing, after having written all pending log records.
+inline void gmic_lock_output() {
+  std::FILE *file = 0;
+  cimg::mutex(29);
+  gmic_log().drain(file);
+  if (file && file!=cimg::output()) std::fflush(file);
+}
+
+// Write all pending log records.
+inline void gmic_flush_log() {
+  gmic_lock_output();
+  std::fflush(cimg::output());
+  cimg::mutex(29,0);
+}
+
+// Push current record of a log ring, or write it directly if the ring is full or 'is_sync' is set.
+// Writing is always direct when no background log writer is available.
+inline void _gmic_log_ring::commit(const bool is_sync) {
+  std::FILE *const nfile = cimg::output();
+  if (is_registered && !is_sync && nfile==file && push(nfile)) {
+#if defined(gmic_is_parallel) && cimg_OS!=2
+    gmic_log().notify();
+#endif // #if defined(gmic_is_parallel) && cimg_OS!=2
+  } else {
+    file = nfile;
+    _gmic_log &log = gmic_log();
+    gmic_lock_output();
+#if defined(gmic_is_parallel) && cimg_OS!=2
+    if (!is_registered) { // Register ring, and start background log writer if necessary.
+      if (!log.is_writer) log.start_writer();
+      if (log.is_writer) {
+        data.assign(32768);
+        next = log.rings;
+        if (next) next->prev = this;
+        log.rings = this;
+        is_registered = true;
+      }
+    }
+#else // #if defined(gmic_is_parallel) && cimg_OS!=2
+    cimg::unused(log);
+#endif // #if defined(gmic_is_parallel) && cimg_OS!=2
+    std::fwrite(record._data,1,record_siz,file);
+    std::fflush(file);
+    cimg::mutex(29,0);
+  }
+  record_siz = 0;
+}
+
+inline _gmic_log_ring::~_gmic_log_ring() {
+  if (!is_registered) return;
+  _gmic_log &log = gmic_log();
+  gmic_lock_output();
+  if (prev) prev->next = next; else log.rings = next;
+  if (next) next->prev = prev;
+  std::fflush(cimg::output());
+#if defined(gmic_is_parallel) && cimg_OS!=2
+  _gmic_log::writer_thread *const writer = log.rings?0:log.stop_writer(); // Last ring: stop the writer.
+  cimg::mutex(29,0);
+  _gmic_log::join_writer(writer);
+#else // #if defined(gmic_is_parallel) && cimg_OS!=2
+  cimg::mutex(29,0);
+#endif // #if defined(gmic_is_parallel) && cimg_OS!=2
+}
+
+// Numeric cells of thread-global variables, for command '-atomic'.
+// Once a thread-global variable has been used by '-atomic', its value is stored in a cell, updated with
+// lock-free compare-and-swap operations. Cells are never removed, so they can be looked up without lock.
+
+struct _gmic_atomic_variable {
+  CImg<char> name;
+  volatile unsigned long long bits;
+  _gmic_atomic_variable *next;
+
+  static unsigned long long to_bits(const double value) {
+    unsigned long long res; std::memcpy(&res,&value,sizeof(double)); return res;
+  }
+  static double to_double(const unsigned long long bits) {
+    double res; std::memcpy(&res,&bits,sizeof(double)); return res;
+  }
+
+  double get() {
+    return to_double(gmic_cas(&bits,0ULL,0ULL));
+  }
+
+  // Apply operation ('+' for add, '=' for set, '<' for min, '>' for max), and return previous value.
+  double fetch(const char operation, const double value) {
+    for (;;) {
+      const unsigned long long obits = bits;
+      const double ovalue = to_double(obits),
+        nvalue = operation=='+'?ovalue + value:operation=='<'?cimg::min(ovalue,value):
+        operation=='>'?cimg::max(ovalue,value):value;
+      if (gmic_cas(&bits,obits,to_bits(nvalue))==obits) return ovalue;
+    }
+  }
+
+  // Set value to 'desired' if current value is 'expected', and return previous value.
+  double compare_exchange(const double expected, const double desired) {
+    for (;;) {
+      const unsigned long long obits = bits;
+      const double ovalue = to_double(obits);
+      if (ovalue!=expected || gmic_cas(&bits,obits,to_bits(desired))==obits) return ovalue;
+    }
+  }
+};
+
+struct _gmic_atomic_variables {
+  _gmic_atomic_variable *volatile buckets[512];
+
+  _gmic_atomic_variables() { std::memset((void*)buckets,0,sizeof(buckets)); }
+  ~_gmic_atomic_variables() {
+    for (unsigned int i = 0; i<512; ++i)
+      for (_gmic_atomic_variable *p = buckets[i], *q; p; p = q) { q = p->next; delete p; }
+  }
+
+  static unsigned int hash(const char *const name) {
+    unsigned int hash = 5381;
+    for (const char *s = name; *s; ++s) hash = 33*hash + (unsigned char)*s;
+    return hash&511;
+  }
+
+  _gmic_atomic_variable *find(const char *const name) const {
+    for (_gmic_atomic_variable *p = buckets[hash(name)]; p; p = p->next)
+      if (!std::strcmp(p->name,name)) return p;
+    return 0;
+  }
+
+  // Return cell of a variable, inserting it with the specified initial value if it does not exist yet.
+  _gmic_atomic_variable *insert(const char *const name, const double value) {
+    const unsigned int h = hash(name);
+    _gmic_atomic_variable *const cell = new _gmic_atomic_variable;
+    CImg<char>::string(name).move_to(cell->name);
+    cell->bits = _gmic_atomic_variable::to_bits(value);
+    for (;;) {
+      _gmic_atomic_variable *const head = buckets[h];
+      for (_gmic_atomic_variable *p = head; p; p = p->next)
+        if (!std::strcmp(p->name,name)) { delete cell; return p; }
+      cell->next = head;
+      if (gmic_cas_pointer(&buckets[h],head,cell)==head) return cell;
+    }
+  }
+};
+
+// Manage pool of large image buffers of an interpreter.
+// Buffers of at least 256KB of images discarded by the interpreter (removed images) are kept, up to a maximal
+// amount of retained memory, and reused by the next image of the same size and type it creates, instead of
+// being given back to the system and allocated (and zeroed) again for the next frame.
+// Buffers stay owned by images (allocated with 'new[]' by CImg): the pool only moves them from an image to another.
+// Each interpreter has its own pool, only used by the thread that runs it, so that no lock is needed.
+// Enabled by defining 'gmic_use_buffer_pool' (otherwise, images are allocated and freed as usual).
+struct _gmic_buffer_pool {
+  struct block {
+    void *data;
+    std::size_t size;
+    void (*release)(void*); // Also identifies the pixel type of the buffer.
+  };
+  block *blocks;
+  unsigned int siz, capacity;
+  std::size_t retained_size, max_retained_size;
+  unsigned long nb_hits, nb_misses;
+
+  _gmic_buffer_pool():blocks(0),siz(0),capacity(0),retained_size(0),max_retained_size((std::size_t)1<<28),
+                      nb_hits(0),nb_misses(0) {}
+  ~_gmic_buffer_pool() { trim(0); delete[] blocks; }
+
+  template<typename T>
+  static void release(void *const data) { delete[] (T*)data; }
+
+  // Give buffer of an image to the pool (the image is emptied).
+  template<typename T>
+  void give(CImg<T>& img) {
+#ifdef gmic_use_buffer_pool
+    const std::size_t size = img.size()*sizeof(T);
+    if (!img._is_shared && size>=262144 && size<=max_retained_size) {
+      trim(max_retained_size - size);
+      if (siz==capacity) {
+        const unsigned int ncapacity = capacity?2*capacity:16;
+        block *const nblocks = new block[ncapacity];
+        if (siz) std::memcpy(nblocks,blocks,siz*sizeof(block));
+        delete[] blocks;
+        blocks = nblocks; capacity = ncapacity;
+      }
+      block &b = blocks[siz++];
+      b.data = img._data; b.size = size; b.release = release<T>;
+      retained_size+=size;
+      img._data = 0; img._width = img._height = img._depth = img._spectrum = 0;
+      return;
+    }
+#endif // #ifdef gmic_use_buffer_pool
+    img.assign();
+  }
+
+  // Assign image to specified dimensions (values are not initialized), reusing a buffer of the pool if one
+  // of the same size and type is retained.
+  template<typename T>
+  CImg<T>& take(CImg<T>& img, const unsigned int w, const unsigned int h, const unsigned int d,
+                const unsigned int s) {
+#ifdef gmic_use_buffer_pool
+    const std::size_t size = (std::size_t)w*h*d*s*sizeof(T);
+    if (size>=262144 && !img._is_shared && img.size()*sizeof(T)!=size) {
+      for (unsigned int i = siz; i>0; --i) { // Most recently given buffers first.
+        block &b = blocks[i - 1];
+        if (b.size==size && b.release==release<T>) {
+          img.assign();
+          img._data = (T*)b.data; img._width = w; img._height = h; img._depth = d; img._spectrum = s;
+          retained_size-=size;
+          if (i<siz) std::memmove(blocks + i - 1,blocks + i,(siz - i)*sizeof(block));
+          --siz;
+          ++nb_hits;
+          return img;
+        }
+      }
+      ++nb_misses;
+    }
+#endif // #ifdef gmic_use_buffer_pool
+    return img.assign(w,h,d,s);
+  }
+
+  // Release buffers until at most 'p_retained_size' bytes are retained (oldest first).
+  void trim(const std::size_t p_retained_size) {
+    unsigned int n = 0;
+    while (n<siz && retained_size>p_retained_size) {
+      block &b = blocks[n++];
+      b.release(b.data);
+      retained_size-=b.size;
+    }
+    if (n) { siz-=n; if (siz) std::memmove(blocks,blocks + n,siz*sizeof(block)); }
+  }
+};
+
+// Count peak amount of memory used by image lists (in bytes, process-wide).
+struct _gmic_memory_counters {
+  volatile unsigned long long peak;
+};
+static _gmic_memory_counters _gmic_memory = { 0 };
+
+inline void gmic_memory_peak(const unsigned long long size) {
+  unsigned long long peak;
+  while ((peak = _gmic_memory.peak)<size && gmic_cas(&_gmic_memory.peak,peak,size)!=peak) {}
+}
+
+// Get size of the buffers owned by an image list (in bytes).
+template<typename T>
+inline unsigned long long gmic_list_size(const CImgList<T>& images) {
+  unsigned long long siz = 0;
+  cimglist_for(images,l) if (!images[l]._is_shared) siz+=(unsigned long long)images[l].size()*sizeof(T);
+  return siz;
+}
+
+// Get current and peak amounts of memory (in bytes).
+// Only the size 'list_size' of the current image list is known, and peaks are the maximal list sizes
+// observed at command boundaries.
+inline void gmic_memory_stats(const unsigned long long list_size,
+                              unsigned long long &current, unsigned long long &peak) {
+  gmic_memory_peak(current = list_size);
+  peak = _gmic_memory.peak;
+}
+
+// Get human-readable memory size.
+inline char *gmic_memory_size(const unsigned long long size, char *const str) {
+  if (size<1024) cimg_snprintf(str,16,"%u b",(unsigned int)size);
+  else if (size<1024*1024) cimg_snprintf(str,16,"%.1f Kio",size/1024.);
+  else if (size<1024*1024*1024) cimg_snprintf(str,16,"%.1f Mio",size/(1024.*1024));
+  else cimg_snprintf(str,16,"%.1f Gio",size/(1024.*1024*1024));
+  return str;
+}
+
+// Memory profile of commands (command '-memory_profile', or debug mode).
+// Each interpreter has its own profile. An entry is identified by the entry of the command it is run from
+// ('parent', ~0U at top level) and by its command key (identifier of a native command, or hash of the name of
+// a custom command). Entries are looked up in a hash table, and their printed name (call stack and command name)
+// is built only when an entry is created. For each of them, store the number of calls, the peak memory reached
+// while running, the maximal increase of memory during a call (new images) and the maximal size of the image
+// list at the end of a call. Memory is measured as the size of image lists, at command boundaries.
+// Windows still open when the profile is restarted are discarded (their generation does not match).
+struct _gmic_memory_profile {
+  CImgList<char> names;
+  CImg<unsigned long long> stats;
+  CImg<unsigned int> keys, table; // Parent, command key and name offset of entries, hash table of their indices + 1.
+  unsigned long long window_peak; // Peak since the start of the innermost open window.
+  unsigned int siz, generation, current; // 'current' is the entry of the innermost open window (~0U if none).
+  bool is_enabled;
+
+  _gmic_memory_profile():window_peak(0),siz(0),generation(0),current(~0U),is_enabled(false) {}
+
+  // Start (or restart) profile.
+  void start() {
+    names.assign();
+    table.assign();
+    siz = 0;
+    ++generation;
+    current = ~0U;
+    window_peak = 0;
+    is_enabled = true;
+  }
+
+  void stop() {
+    is_enabled = false;
+  }
+
+  // Get key of a command.
+  static unsigned int key(const unsigned int command_id, const char *const name) {
+    if (command_id) return command_id;
+    unsigned int hash = 2166136261U;
+    for (const char *p = name; *p; ++p) hash = (hash^(unsigned char)*p)*16777619U;
+    return hash | 0x80000000U;
+  }
+
+  unsigned int hash(const unsigned int parent, const unsigned int key) const {
+    return ((parent*2654435761U)^(key*40503U))&(table._width - 1);
+  }
+
+  // Find entry of a command (return ~0U if it does not exist yet).
+  unsigned int find(const unsigned int parent, const unsigned int key, const char *const name) const {
+    if (!table) return ~0U;
+    for (unsigned int h = hash(parent,key); table[h]; h = (h + 1)&(table._width - 1)) {
+      const unsigned int i = table[h] - 1, *const k = keys.data(0,i);
+      if (k[0]==parent && k[1]==key && !std::strcmp(names[i].data() + k[2],name)) return i;
+    }
+    return ~0U;
+  }
+
+  // Create entry of a command, run from call stack 'scope'.
+  unsigned int insert(const unsigned int parent, const unsigned int key, const char *const scope,
+                      const char *const name) {
+    if (2*(siz + 1)>table._width) {
+      table.assign(cimg::max(64U,2*table._width),1,1,1,0);
+      for (unsigned int i = 0; i<siz; ++i) {
+        unsigned int h = hash(keys(0,i),keys(1,i));
+        while (table[h]) h = (h + 1)&(table._width - 1);
+        table[h] = i + 1;
+      }
+    }
+    if (siz==stats._height) {
+      stats.resize(4,cimg::max(64U,2*siz),1,1,0);
+      keys.resize(3,stats._height,1,1,0);
+    }
+    std::memset(stats.data(0,siz),0,4*sizeof(unsigned long long));
+    const unsigned int l_scope = (unsigned int)std::strlen(scope);
+    CImg<char> str(l_scope + (unsigned int)std::strlen(name) + 1);
+    std::memcpy(str,scope,l_scope);
+    std::strcpy(str.data() + l_scope,name);
+    str.move_to(names);
+    keys(0,siz) = parent; keys(1,siz) = key; keys(2,siz) = l_scope;
+    unsigned int h = hash(parent,key);
+    while (table[h]) h = (h + 1)&(table._width - 1);
+    table[h] = siz + 1;
+    return siz++;
+  }
+
+  void add(const unsigned int ind, const unsigned long long peak, const unsigned long long increase,
+           const unsigned long long list_size) {
+    unsigned long long *const ptr = stats.data(0,ind);
+    ++ptr[0];
+    if (peak>ptr[1]) ptr[1] = peak;
+    if (increase>ptr[2]) ptr[2] = increase;
+    if (list_size>ptr[3]) ptr[3] = list_size;
+  }
+};
+
+// Memory window of the command currently run by an environment, for the memory profile.
+// Nested windows (commands run by custom commands) restore the peak and the entry of the enclosing window
+// when closed.
+struct _gmic_memory_window {
+  _gmic_memory_profile *profile;
+  unsigned int ind, generation, parent, key, saved_current;
+  unsigned long long start, saved_peak;
+
+  _gmic_memory_window():profile(0),ind(~0U),generation(0),parent(~0U),key(0),saved_current(~0U),
+                        start(0),saved_peak(0) {}
+  ~_gmic_memory_window() { if (ind!=~0U) restore(); }
+
+  // Open window of a command. Return 'false' if its entry does not exist yet (then call 'create()').
+  bool open(_gmic_memory_profile &p_profile, const unsigned int command_id, const char *const name,
+            const unsigned long long list_size) {
+    unsigned long long peak;
+    if (ind!=~0U) close(list_size);
+    gmic_memory_stats(list_size,start,peak);
+    profile = &p_profile;
+    generation = profile->generation;
+    saved_peak = profile->window_peak;
+    saved_current = parent = profile->current;
+    profile->window_peak = start;
+    key = _gmic_memory_profile::key(command_id,name);
+    ind = profile->find(parent,key,name);
+    if (ind==~0U) return false;
+    profile->current = ind;
+    return true;
+  }
+
+  void create(const char *const scope, const char *const name) {
+    profile->current = ind = profile->insert(parent,key,scope,name);
+  }
+
+  void close(const unsigned long long list_size) {
+    unsigned long long current, peak;
+    gmic_memory_stats(list_size,current,peak);
+    if (generation==profile->generation) {
+      if (list_size>profile->window_peak) profile->window_peak = list_size;
+      peak = profile->window_peak;
+      profile->add(ind,peak,peak>start?peak - start:0,list_size);
+    }
+    restore();
+  }
+
+  void restore() {
+    if (generation==profile->generation) {
+      if (saved_peak>profile->window_peak) profile->window_peak = saved_peak;
+      profile->current = saved_current;
+    }
+    ind = ~0U;
+  }
+};
+
+// Compact storage of images (command '-compact').
+// A compact image is stored in the image list as a one-row image of type 'T', that starts with a header
+// (magic number, actual dimensions and storage type) followed by its values stored as uchar, ushort or half.
+// Compact images are self-describing, so copies of compact images are compact images as well.
+// Commands get regular images: the interpreter uncompacts the images accessed by a command just before
+// running it. They stay regular images until the environment ends or '-compact' is called on them again,
+// then are compacted back (see '_gmic_compact_pending'), so values are quantized only once.
+static const char _gmic_compact_magic[8] = { 'G','M','I','C','c','p','t',0 };
+
+inline const char *gmic_compact_type(const unsigned int type) {
+  return type==1?"uchar":type==2?"ushort":type==3?"half":"float";
+}
+
+// Convert a float value to a half-float (rounded to nearest even), and back.
+inline unsigned short gmic_float2half(const float value) {
+  unsigned int bits;
+  std::memcpy(&bits,&value,sizeof(float));
+  const unsigned int sign = (bits>>16)&0x8000, mantissa = bits&0x7fffff;
+  const int exponent = (int)((bits>>23)&0xff) - 112;
+  if (exponent>=31) // Overflow, infinity or NaN.
+    return (unsigned short)(sign | 0x7c00 | ((bits&0x7fffffff)>0x7f800000?0x200:0));
+  if (exponent<=0) { // Subnormal or zero.
+    if (exponent<-10) return (unsigned short)sign;
+    const unsigned int m = mantissa | 0x800000, shift = (unsigned int)(14 - exponent),
+      rem = m&((1U<<shift) - 1), half = 1U<<(shift - 1);
+    unsigned int res = m>>shift;
+    if (rem>half || (rem==half && (res&1))) ++res;
+    return (unsigned short)(sign | res);
+  }
+  unsigned int res = ((unsigned int)exponent<<10) | (mantissa>>13);
+  const unsigned int rem = mantissa&0x1fff;
+  if (rem>0x1000 || (rem==0x1000 && (res&1))) ++res; // May carry into exponent (up to infinity).
+  return (unsigned short)(sign | res);
+}
+
+inline float gmic_half2float(const unsigned short value) {
+  const unsigned int sign = (unsigned int)(value&0x8000)<<16, exponent = (value>>10)&0x1f, mantissa = value&0x3ff;
+  unsigned int bits = sign;
+  if (!exponent) { // Zero or subnormal.
+    if (mantissa) {
+      unsigned int e = 113, m = mantissa;
+      while (!(m&0x400)) { m<<=1; --e; }
+      bits|=(e<<23) | ((m&0x3ff)<<13);
+    }
+  } else if (exponent==31) bits|=0x7f800000 | (mantissa<<13);
+  else bits|=((exponent + 112)<<23) | (mantissa<<13);
+  float res;
+  std::memcpy(&res,&bits,sizeof(float));
+  return res;
+}
+
+// Get dimensions and storage type of a compact image (return 0 if the image is not compact).
+template<typename T>
+inline unsigned int gmic_compact_info(const CImg<T>& img, unsigned int *const dims=0) {
+  const unsigned int header_size = (32 + sizeof(T) - 1)/sizeof(T);
+  if (img._height!=1 || img._depth!=1 || img._spectrum!=1 || img._width<header_size ||
+      std::memcmp(img._data,_gmic_compact_magic,8)) return 0;
+  unsigned int _dims[5];
+  std::memcpy(_dims,(const char*)img._data + 8,sizeof(_dims));
+  const unsigned int nb_bytes = _dims[4]==1?1:2;
+  if (!_dims[4] || _dims[4]>3 ||
+      img._width!=header_size + ((unsigned long)_dims[0]*_dims[1]*_dims[2]*_dims[3]*nb_bytes + sizeof(T) - 1)/
+      sizeof(T)) return 0;
+  if (dims) std::memcpy(dims,_dims,4*sizeof(unsigned int));
+  return _dims[4];
+}
+
+// Store an image compactly (type can be 1:uchar, 2:ushort or 3:half).
+// Return 'false' if it cannot be stored more compactly than with type 'T'.
+template<typename T>
+static bool gmic_compact(CImg<T>& img, const unsigned int type) {
+  const unsigned int nb_bytes = type==1?1:2, header_size = (32 + sizeof(T) - 1)/sizeof(T);
+  if (img.is_empty() || !type || nb_bytes>=sizeof(T) || gmic_compact_info(img)) return false;
+  const unsigned long siz = (unsigned long)img.size();
+  CImg<T> res((unsigned int)(header_size + (siz*nb_bytes + sizeof(T) - 1)/sizeof(T)),1,1,1,(T)0);
+  const unsigned int header[5] = { img._width,img._height,img._depth,img._spectrum,type };
+  std::memcpy(res._data,_gmic_compact_magic,8);
+  std::memcpy((char*)res._data + 8,header,sizeof(header));
+  unsigned char buf[8192], *const ptrd = (unsigned char*)(res._data + header_size);
+  const unsigned long nb_block = sizeof(buf)/nb_bytes;
+  for (unsigned long off = 0; off<siz; off+=nb_block) {
+    const unsigned int n = (unsigned int)cimg::min(nb_block,siz - off);
+    const T *const ptrs = img._data + off;
+    if (type==1) for (unsigned int k = 0; k<n; ++k) buf[k] = (unsigned char)cimg::cut((double)ptrs[k] + 0.5,0.,255.);
+    else for (unsigned int k = 0; k<n; ++k) {
+        const unsigned short val = type==2?(unsigned short)cimg::cut((double)ptrs[k] + 0.5,0.,65535.):
+          gmic_float2half((float)ptrs[k]);
+        std::memcpy(buf + 2*k,&val,2);
+      }
+    std::memcpy(ptrd + off*nb_bytes,buf,n*nb_bytes);
+  }
+  img.swap(res);
+  return true;
+}
+
+// Turn a compact image back into a regular image. Return its storage type (0 if it was not compact).
+template<typename T>
+static unsigned int gmic_uncompact(CImg<T>& img) {
+  unsigned int dims[4];
+  const unsigned int type = gmic_compact_info(img,dims);
+  if (!type) return 0;
+  CImg<T> res(dims[0],dims[1],dims[2],dims[3]);
+  const unsigned long siz = (unsigned long)res.size();
+  const unsigned char *const ptrs = (const unsigned char*)(img._data + (32 + sizeof(T) - 1)/sizeof(T));
+  T *ptrd = res._data;
+  if (type==1) for (unsigned long off = 0; off<siz; ++off) *(ptrd++) = (T)ptrs[off];
+  else for (unsigned long off = 0; off<siz; ++off) {
+      unsigned short val;
+      std::memcpy(&val,ptrs + 2*off,2);
+      *(ptrd++) = type==2?(T)val:(T)gmic_half2float(val);
+    }
+  img.swap(res);
+  return type;
+}
+
+// Images uncompacted by an interpreter, to be compacted back when their environment ends.
+// Entries refer to an image by its list, position and buffer, as commands may replace its buffer
+// (e.g. '-resize') or move images in the list. They belong to the environment that uncompacted them
+// (identified by its initial callstack size), or to any environment of the list ('frame = ~0U', for
+// item substitutions).
+struct _gmic_compact_pending {
+  struct entry { const void *list, *data; unsigned int frame, ind, type, list_size; };
+  entry *entries;
+  unsigned int siz, capacity;
+  bool is_used; // Set once a compact image has been created by the interpreter (or by its parent).
+
+  _gmic_compact_pending():entries(0),siz(0),capacity(0),is_used(false) {}
+  ~_gmic_compact_pending() { delete[] entries; }
+
+  void add(const void *const list, const void *const data, const unsigned int frame, const unsigned int ind,
+           const unsigned int type, const unsigned int list_size) {
+    if (siz==capacity) {
+      const unsigned int ncapacity = capacity?2*capacity:64;
+      entry *const nentries = new entry[ncapacity];
+      if (siz) std::memcpy(nentries,entries,siz*sizeof(entry));
+      delete[] entries;
+      entries = nentries;
+      capacity = ncapacity;
+    }
+    const entry e = { list,data,frame,ind,type,list_size };
+    entries[siz++] = e;
+  }
+
+  bool is_in(const void *const list, const unsigned int frame, const entry& e) const {
+    return e.list==list && (e.frame==frame || e.frame==~0U);
+  }
+
+  // Find the current position of the image of an entry (-1 if it has been removed).
+  // An image whose buffer has been replaced is still found at the same position if the list size has not changed.
+  template<typename T>
+  static int find(const CImgList<T>& images, const entry& e) {
+    if (e.ind<images._width && images[e.ind]._data==e.data) return (int)e.ind;
+    cimglist_for(images,l) if (images[l]._data==e.data) return l;
+    return e.ind<images._width && images._width==e.list_size?(int)e.ind:-1;
+  }
+
+  // Follow the images of the entries of an environment after a command, and forget those of removed images.
+  template<typename T>
+  void track(const CImgList<T>& images, const unsigned int frame) {
+    for (unsigned int i = 0; i<siz; ) {
+      entry &e = entries[i];
+      if (!is_in(&images,frame,e)) { ++i; continue; }
+      const int ind = find(images,e);
+      if (ind<0) { e = entries[--siz]; continue; }
+      e.ind = (unsigned int)ind; e.data = images[ind]._data; e.list_size = images._width;
+      ++i;
+    }
+  }
+
+  // Uncompact an image. If 'is_kept' is true, it is compacted back when its environment ends.
+  template<typename T>
+  void uncompact(CImgList<T>& images, const unsigned int ind, const unsigned int frame, const bool is_kept=true) {
+    const unsigned int type = gmic_uncompact(images[ind]);
+    if (type && is_kept) add(&images,images[ind]._data,frame,ind,type,images._width);
+  }
+
+  // Uncompact images referenced by numbers in an argument ('[ind]', '[ind0-ind1]' or '#ind').
+  // Return 'false' if the argument has references that cannot be resolved here (e.g. image names).
+  template<typename T>
+  bool uncompact_references(CImgList<T>& images, const char *const argument, const unsigned int frame,
+                            const bool is_kept) {
+    for (const char *p = argument; *p; ++p) if (*p=='[' || *p=='#') {
+        const bool is_bracket = *p=='[';
+        int ind0 = 0, ind1 = 0, n = 0;
+        if (std::sscanf(p + 1,"%d%n",&ind0,&n)!=1) return false;
+        p+=n + 1;
+        ind1 = ind0;
+        if (is_bracket) {
+          if (*p=='-' && std::sscanf(p + 1,"%d%n",&ind1,&n)==1) p+=n + 1;
+          if (*p!=']') return false;
+        } else --p;
+        if (ind0<0) ind0+=images.width();
+        if (ind1<0) ind1+=images.width();
+        for (int l = cimg::max(ind0,0); l<=ind1 && l<images.width(); ++l) uncompact(images,l,frame,is_kept);
+      }
+    return true;
+  }
+
+  // Compact back the images of an environment (when it ends), and forget their entries.
+  template<typename T>
+  void compact(CImgList<T>& images, const unsigned int frame) {
+    track(images,frame);
+    for (unsigned int i = 0; i<siz; ) {
+      const entry &e = entries[i];
+      if (!is_in(&images,frame,e)) { ++i; continue; }
+      if (!images[e.ind]._is_shared) gmic_compact(images[e.ind],e.type);
+      entries[i] = entries[--siz];
+    }
+  }
+
+  // Forget the entry of an image (its storage type is set again by '-compact').
+  void forget(const void *const list, const void *const data) {
+    for (unsigned int i = 0; i<siz; )
+      if (entries[i].list==list && entries[i].data==data) entries[i] = entries[--siz];
+      else ++i;
+  }
+
+  // Forget the entries of an environment (images stay uncompacted).
+  void remove(const void *const list, const unsigned int frame) {
+    for (unsigned int i = 0; i<siz; )
+      if (is_in(list,frame,entries[i])) entries[i] = entries[--siz];
+      else ++i;
+  }
+};
+
+// Scope of the entries of an environment (released on exceptions too).
+struct _gmic_compact_scope {
+  _gmic_compact_pending &pending;
+  const void *const list;
+  const unsigned int frame;
+  _gmic_compact_scope(_gmic_compact_pending &p_pending, const void *const p_list, const unsigned int p_frame):
+    pending(p_pending),list(p_list),frame(p_frame) {}
+  ~_gmic_compact_scope() { if (pending.siz) pending.remove(list,frame); }
+};
+
+// Return true if a native command does not access the pixel values of its selected images
+// (compact images are then left compact).
+inline bool gmic_is_compact_transparent_command(const unsigned int command_id) {
+  switch (command_id) {
+  case gmic_cmd_compact : case gmic_cmd_i : case gmic_cmd_input : case gmic_cmd_keep : case gmic_cmd_local :
+  case gmic_cmd_move : case gmic_cmd_name : case gmic_cmd_remove : case gmic_cmd_reverse :
+    return true;
+  default :
+    return false;
+  }
+}
+
+// Return a new process-wide unique version number for the custom commands of an interpreter.
+inline unsigned long gmic_new_commands_version() {
+  static unsigned long version = 0;
+  cimg::mutex(25);
+  const unsigned long res = ++version;
+  cimg::mutex(25,0);
+  return res;
+}
+
+// Registry of asynchronous jobs launched by an interpreter (commands '-async' and '-await').
+// Only accessed by the thread running the interpreter. Job data are type-erased, as the registry
+// does not depend on the pixel type of the images.
+struct _gmic_async_job {
+  _gmic_async_job *next;
+  void *data;
+  const char *pixel_type;
+  void (*release)(void *const data, const bool is_abort);
+  unsigned int id;
+};
+
+struct _gmic_async_jobs {
+  _gmic_async_job *first;
+  unsigned int next_id;
+
+  _gmic_async_jobs():first(0),next_id(0) {}
+
+  ~_gmic_async_jobs() {
+    clear(true);
+  }
+
+  unsigned int insert(void *const data, const char *const pixel_type,
+                      void (*const release)(void *const, const bool)) {
+    _gmic_async_job *const job = new _gmic_async_job;
+    job->next = first;
+    job->data = data;
+    job->pixel_type = pixel_type;
+    job->release = release;
+    job->id = next_id++;
+    first = job;
+    return job->id;
+  }
+
+  // Unlink job from the registry and return its data (or 0 if not found).
+  void *remove(const unsigned int id, const char *const pixel_type) {
+    for (_gmic_async_job **pjob = &first; *pjob; pjob = &(*pjob)->next) {
+      _gmic_async_job *const job = *pjob;
+      if (job->id==id && job->pixel_type==pixel_type) {
+        void *const data = job->data;
+        *pjob = job->next;
+        delete job;
+        return data;
+      }
+    }
+    return 0;
+  }
+
+  // Wait for (or abort) all remaining jobs, and discard their images.
+  void clear(const bool is_abort) {
+    while (first) {
+      _gmic_async_job *const job = first;
+      first = job->next;
+      job->release(job->data,is_abort);
+      delete job;
+    }
+  }
+};
+
+// Interpreter context reused by threads of command '-parallel'.
+// It remembers which commands it shares with its last parent interpreter, so that the
+// 512 command lists need to be shared again only when one of both interpreters has changed them.
+struct _gmic_context {
+  gmic *instance;
+  const gmic *source;
+  unsigned long source_version, instance_version;
+};
+
+// Process-wide pool of idle interpreter contexts (shared by all threads, protected by mutex 25).
+// At most one context per thread allowed to run is kept. Idle contexts are freed when the last other
+// interpreter is destroyed ('nb_instances' counts all interpreters, including those of contexts).
+struct _gmic_contexts {
+  _gmic_context *data[256];
+  unsigned int siz, nb_instances;
+  _gmic_contexts():siz(0),nb_instances(0) {}
+};
+
+inline _gmic_contexts& gmic_contexts() {
+  static _gmic_contexts val;
+  return val;
+}
+
+inline _gmic_context *gmic_acquire_context() {
+  _gmic_contexts &contexts = gmic_contexts();
+  cimg::mutex(25);
+  _gmic_context *context = contexts.siz?contexts.data[--contexts.siz]:0;
+  cimg::mutex(25,0);
+  if (!context) {
+    context = new _gmic_context;
+    context->instance = new gmic(0,0,false);
+    context->source = 0;
+    context->source_version = context->instance_version = 0;
+  }
+  return context;
+}
+
+inline void gmic_release_context(_gmic_context *const context) {
+  gmic &gi = *context->instance;
+  CImgDisplay *const windows = (CImgDisplay*)gi.display_window;
+  for (unsigned int l = 0; l<10; ++l) windows[l].assign();
+  ((_gmic_variables*)gi.local_variables)->pop(0);
+  gi.dowhiles.assign();
+  gi.repeatdones.assign();
+  ((_gmic_async_jobs*)gi.async_jobs)->clear(false);
+  _gmic_contexts &contexts = gmic_contexts();
+  const unsigned int max_contexts = cimg::min(256U,gmic_nb_threads());
+  cimg::mutex(25);
+  const bool is_kept = contexts.siz<max_contexts;
+  if (is_kept) contexts.data[contexts.siz++] = context;
+  cimg::mutex(25,0);
+  if (!is_kept) { delete context->instance; delete context; }
+}
+
+// Count a new interpreter.
+inline void gmic_add_instance() {
+  cimg::mutex(25);
+  ++gmic_contexts().nb_instances;
+  cimg::mutex(25,0);
+}
+
+// Forget a destroyed interpreter, and free idle contexts if no other interpreter remains.
+inline void gmic_remove_instance() {
+  _gmic_contexts &contexts = gmic_contexts();
+  _gmic_context *idle[256];
+  unsigned int nb_idle = 0;
+  cimg::mutex(25);
+  if (--contexts.nb_instances==contexts.siz) {
+    nb_idle = contexts.siz;
+    std::memcpy(idle,contexts.data,nb_idle*sizeof(_gmic_context*));
+    contexts.siz = 0;
+  }
+  cimg::mutex(25,0);
+  for (unsigned int i = 0; i<nb_idle; ++i) { delete idle[i]->instance; delete idle[i]; }
+}
+
+#if defined(gmic_is_parallel) && cimg_OS!=2
+// Process-wide pool of long-lived worker threads for command '-parallel'.
+// A new worker is created only when no idle worker can take a queued job, so that all jobs
+// of a '-parallel' call still run concurrently (they may wait for each other).
+// Workers are stopped and joined when the pool is destroyed (at exit).
+struct _gmic_job {
+  void *(*routine)(void*);
+  void *arg;
+  volatile bool is_done;
+};
+
+struct _gmic_thread_pool {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond_job, cond_done;
+  _gmic_job **queue;
+  pthread_t *threads;
+  unsigned int queue_start, queue_size, queue_capacity, nb_workers, nb_idle, nb_running, threads_capacity;
+  bool is_stopped;
+
+  _gmic_thread_pool():queue(0),threads(0),queue_start(0),queue_size(0),queue_capacity(0),nb_workers(0),nb_idle(0),
+                      nb_running(0),threads_capacity(0),is_stopped(false) {
+    pthread_mutex_init(&mutex,0);
+    pthread_cond_init(&cond_job,0);
+    pthread_cond_init(&cond_done,0);
+  }
+
+  ~_gmic_thread_pool() {
+    pthread_mutex_lock(&mutex);
+    is_stopped = true;
+    pthread_cond_broadcast(&cond_job);
+    pthread_mutex_unlock(&mutex);
+    for (unsigned int i = 0; i<nb_workers; ++i) pthread_join(threads[i],0);
+    pthread_cond_destroy(&cond_done);
+    pthread_cond_destroy(&cond_job);
+    pthread_mutex_destroy(&mutex);
+    delete[] threads;
+    delete[] queue;
+  }
+
+  static void *worker(void *arg) {
+    _gmic_thread_pool &pool = *(_gmic_thread_pool*)arg;
+    pthread_mutex_lock(&pool.mutex);
+    for (;;) {
+      while (!pool.queue_size && !pool.is_stopped) {
+        ++pool.nb_idle;
+        pthread_cond_wait(&pool.cond_job,&pool.mutex);
+        --pool.nb_idle;
+      }
+      if (!pool.queue_size) break; // Pool stopped.
+      _gmic_job &job = *pool.queue[pool.queue_start];
+      pool.queue_start = (pool.queue_start + 1)%pool.queue_capacity;
+      --pool.queue_size;
+      ++pool.nb_running;
+      pthread_mutex_unlock(&pool.mutex);
+      job.routine(job.arg);
+      pthread_mutex_lock(&pool.mutex);
+      --pool.nb_running;
+      job.is_done = true;
+      pthread_cond_broadcast(&pool.cond_done);
+    }
+    pthread_mutex_unlock(&pool.mutex);
+    return 0;
+  }
+
+  // Queue a job for execution, and create a new worker if no idle one can take it.
+  // Return 'false' (and do not run the job) if no worker can be created for it. The job is never run
+  // in the calling thread, as it may wait for other jobs of the same call (with '-barrier' or '-semaphore').
+  bool submit(_gmic_job &job) {
+    pthread_mutex_lock(&mutex);
+    job.is_done = false;
+    if (queue_size==queue_capacity) {
+      const unsigned int ncapacity = queue_capacity?2*queue_capacity:16;
+      _gmic_job **const nqueue = new _gmic_job*[ncapacity];
+      for (unsigned int i = 0; i<queue_size; ++i) nqueue[i] = queue[(queue_start + i)%queue_capacity];
+      delete[] queue;
+      queue = nqueue; queue_start = 0; queue_capacity = ncapacity;
+    }
+    queue[(queue_start + queue_size++)%queue_capacity] = &job;
+    bool is_created = true;
+    if (nb_idle<queue_size) {
+      if (nb_workers==threads_capacity) {
+        const unsigned int ncapacity = threads_capacity?2*threads_capacity:16;
+        pthread_t *const nthreads = new pthread_t[ncapacity];
+        for (unsigned int i = 0; i<nb_workers; ++i) nthreads[i] = threads[i];
+        delete[] threads;
+        threads = nthreads; threads_capacity = ncapacity;
+      }
+      pthread_attr_t thread_attr;
+      if (!pthread_attr_init(&thread_attr)) {
+        pthread_attr_setstacksize(&thread_attr,8*1024*1024); // Reserve 8MB of stack size for each worker.
+        is_created = !pthread_create(threads + nb_workers,&thread_attr,worker,this);
+        pthread_attr_destroy(&thread_attr);
+      } else is_created = !pthread_create(threads + nb_workers,0,worker,this);
+      if (is_created) ++nb_workers;
+    }
+    if (!is_created) { // Could not create a new worker: withdraw the job.
+      --queue_size;
+      job.is_done = true;
+    } else pthread_cond_signal(&cond_job);
+    pthread_mutex_unlock(&mutex);
+    return is_created;
+  }
+
+  // Wait for the termination of a queued job.
+  void wait(_gmic_job &job) {
+    pthread_mutex_lock(&mutex);
+    while (!job.is_done) pthread_cond_wait(&cond_done,&mutex);
+    pthread_mutex_unlock(&mutex);
+  }
+
+  // Return number of jobs currently running.
+  unsigned int running() {
+    pthread_mutex_lock(&mutex);
+    const unsigned int res = nb_running;
+    pthread_mutex_unlock(&mutex);
+    return res;
+  }
+
+  // Forget workers of the parent process (to be called in a forked child, where they do not exist and
+  // cannot be joined).
+  // The mutex is held by the forking thread (see 'gmic_fork()').
+  void reset_after_fork() {
+    pthread_cond_init(&cond_job,0);
+    pthread_cond_init(&cond_done,0);
+    queue_start = queue_size = nb_workers = nb_idle = nb_running = 0;
+    pthread_mutex_unlock(&mutex);
+  }
+};
+
+inline _gmic_thread_pool& gmic_thread_pool() {
+  static _gmic_thread_pool val;
+  return val;
+}
+#endif // #if defined(gmic_is_parallel) && cimg_OS!=2
+
+// Shared state of the threads of commands '-parallel_tiles' and '-stream_cimg'.
+// Tiles are distributed dynamically among threads (protected by mutex 24, as are tile writes), for load balancing.
+// Tiles are read from/written to image 'n' of .cimg files when 'filename_in' is set.
+template<typename T>
+struct st_gmic_tiles {
+  const CImg<T> *img;
+  CImg<T> *res;
+  const char *command, *filename_in, *filename_out;
+  unsigned int n, width, height, depth, spectrum;
+  unsigned int nx, ny, nz, hx, hy, hz, nb_tiles, next_tile;
+  volatile bool is_failed;
+  st_gmic_tiles():img(0),res(0),command("parallel_tiles"),filename_in(0),filename_out(0),n(0) {}
+};
+
+// Get size of the pixel type of a .cimg file header (given without its endianness).
+// Return 0 for unknown pixel types.
+static unsigned int gmic_cimg_pixel_size(const char *const type) {
+  static const char *const names[] = {
+    "bool", "uchar", "unsigned char", "uint8", "char", "int8",
+    "ushort", "unsigned short", "uint16", "short", "int16",
+    "uint", "unsigned int", "uint32", "int", "int32", "float", "float32",
+    "ulong", "unsigned long", "long", "uint64", "unsigned int64", "int64", "double", "float64" };
+  static const unsigned int sizes[] = {
+    1, 1, 1, 1, 1, 1,
+    2, 2, 2, 2, 2,
+    4, 4, 4, 4, 4, 4, 4,
+    sizeof(long), sizeof(long), sizeof(long), 8, 8, 8, 8, 8 };
+  CImg<char> name = CImg<char>::string(type);
+  cimg_for(name,ptr,char) if (*ptr=='_') *ptr = ' '; // Both 'unsigned_char' and 'unsigned char' are found.
+  for (unsigned int k = 0; k<sizeof(sizes)/sizeof(unsigned int); ++k)
+    if (!std::strcmp(name,names[k])) return sizes[k];
+  return 0;
+}
+
+// Get dimensions of the images stored in a .cimg file, without reading their pixel data.
+// Optionally get the file offsets of the pixel data of each image, the pixel type and endianness
+// of the file (as 'type endian_endian') and the offset of the end of the pixel data.
+// Return 'false' if the file cannot be parsed, stores compressed images, or if its size exceeds the range of
+// file offsets (32-bit 'off_t' without large file support).
+static bool gmic_cimg_file_dims(const char *const filename, CImg<unsigned int> &dims,
+                                CImg<unsigned long long> *const offsets=0, CImg<char> *const type=0,
+                                unsigned long long *const file_end=0) {
+  std::FILE *const file = cimg::fopen(filename,"rb");
+  CImg<char> line(1024);
+  unsigned int N = 0, siz = 0;
+  do { *line = 0; if (std::fscanf(file,"%1023[^\n]",line.data())!=EOF) std::fgetc(file); else break; }
+  while (*line=='#' || !*line);
+  if (cimg_sscanf(line,"%u",&N)==1) {
+    char *const _type = line.data() + std::strspn(line.data(),"0123456789 ");
+    char *const _endian = std::strrchr(_type,' '); // Pixel type is followed by endianness.
+    if (_endian) { *_endian = 0; siz = gmic_cimg_pixel_size(_type); *_endian = ' '; }
+    if (type) CImg<char>::string(_type).move_to(*type);
+  }
+  bool res = siz!=0;
+  dims.assign(4,N,1,1,0);
+  if (offsets) offsets->assign(1,N,1,1,0);
+  unsigned long long end = 0;
+  for (unsigned int l = 0; res && l<N; ++l) {
+    unsigned int W, H, D, S;
+    if (std::fscanf(file,"%u %u %u %u",&W,&H,&D,&S)!=4) { res = false; break; }
+    int c = std::fgetc(file);
+    while (c==' ') c = std::fgetc(file);
+    if (c!='\n') { res = false; break; } // Compressed data (or invalid header).
+    dims(0,l) = W; dims(1,l) = H; dims(2,l) = D; dims(3,l) = S;
+    const unsigned long long off = (unsigned long long)W*H*D*S*siz;
+#if cimg_OS==2
+    const __int64 pos = _ftelli64(file);
+    if (offsets) (*offsets)[l] = (unsigned long long)pos;
+    res = pos>=0 && off<=0x7FFFFFFFFFFFFFFFULL - (unsigned long long)pos &&
+      !_fseeki64(file,(__int64)off,SEEK_CUR);
+#else // #if cimg_OS==2
+    // Largest positive 'off_t' (its size depends on '_FILE_OFFSET_BITS').
+    const unsigned long long max_off = ((1ULL<<(8*sizeof(off_t) - 2)) - 1)*2 + 1;
+    const off_t pos = ftello(file);
+    if (offsets) (*offsets)[l] = (unsigned long long)pos;
+    res = pos>=0 && off<=max_off - (unsigned long long)pos && !fseeko(file,(off_t)off,SEEK_CUR);
+#endif // #if cimg_OS==2
+    end = (unsigned long long)pos + off;
+  }
+  cimg::fclose(file);
+  if (file_end) *file_end = end;
+  return res;
+}
+
+// Create a .cimg file of zero-valued images of type 'T', with specified dimensions.
+template<typename T>
+static void gmic_save_empty_cimg(const char *const filename, const CImg<unsigned int> &dims) {
+  std::FILE *const file = cimg::fopen(filename,"wb");
+  std::fprintf(file,"%u %s %s_endian\n",
+               dims._height,CImg<T>::pixel_type(),cimg::endianness()?"big":"little");
+  const CImg<T> zeros(65536,1,1,1,(T)0);
+  cimg_forY(dims,l) {
+    std::fprintf(file,"%u %u %u %u\n",dims(0,l),dims(1,l),dims(2,l),dims(3,l));
+    for (unsigned long long siz = (unsigned long long)dims(0,l)*dims(1,l)*dims(2,l)*dims(3,l); siz; ) {
+      const unsigned long long n = cimg::min(siz,(unsigned long long)zeros._width);
+      cimg::fwrite(zeros._data,(unsigned int)n,file);
+      siz-=n;
+    }
+  }
+  cimg::fclose(file);
+}
+
+#ifdef MAP_NORESERVE
+#define _gmic_map_noreserve MAP_NORESERVE // Pages are committed only when modified.
+#else // #ifdef MAP_NORESERVE
+#define _gmic_map_noreserve 0
+#endif // #ifdef MAP_NORESERVE
+
+// Insert the images of a .cimg file as shared images referring to a private mapping of the file.
+// Only possible for uncompressed files storing pixels of type 'T' with native endianness, and
+// aligned pixel data (the header length depends on the image dimensions).
+// Return 'false' if the file cannot be mapped (then it must be loaded the usual way).
+template<typename T>
+static bool gmic_map_cimg(const char *const filename, CImgList<T>& images, _gmic_mapped_files& mapped) {
+#if cimg_OS==1
+  CImg<unsigned int> dims;
+  CImg<unsigned long long> offsets;
+  CImg<char> type, native_type(256);
+  if (!gmic_cimg_file_dims(filename,dims,&offsets,&type) || !dims) return false;
+  cimg_snprintf(native_type,native_type.width(),"%s %s_endian",
+                CImg<T>::pixel_type(),cimg::endianness()?"big":"little");
+  if (std::strcmp(type,native_type)) return false;
+  cimg_forY(offsets,l) if (offsets[l]%sizeof(T)) return false;
+  const int fd = open(filename,O_RDONLY);
+  if (fd<0) return false;
+  struct stat st;
+  const unsigned long long
+    last = dims._height - 1,
+    end = offsets[last] + (unsigned long long)dims(0,last)*dims(1,last)*dims(2,last)*dims(3,last)*sizeof(T);
+  void *const ptr = fstat(fd,&st) || (unsigned long long)st.st_size<end ||
+    (unsigned long long)st.st_size>(unsigned long long)~(std::size_t)0?MAP_FAILED: // Not addressable.
+    mmap(0,(std::size_t)st.st_size,PROT_READ | PROT_WRITE,MAP_PRIVATE | _gmic_map_noreserve,fd,0);
+  close(fd);
+  if (ptr==MAP_FAILED) return false;
+  if (!mapped.add((char*)ptr,(std::size_t)st.st_size,(unsigned long long)st.st_dev,(unsigned long long)st.st_ino)) {
+    munmap(ptr,(std::size_t)st.st_size); // No more slots: load file the usual way.
+    return false;
+  }
+  images.assign(dims._height);
+  cimglist_for(images,l) if (dims(0,l) && dims(1,l) && dims(2,l) && dims(3,l))
+    images[l].assign((T*)((char*)ptr + offsets[l]),dims(0,l),dims(1,l),dims(2,l),dims(3,l),true);
+  return true;
+#else // #if cimg_OS==1
+  cimg::unused(filename,images,mapped);
+  return false;
+#endif // #if cimg_OS==1
+}
+
+// Synchronization state shared by the threads of a same '-parallel' call (commands '-barrier' and '-semaphore').
+// Waiting threads are released when the group is aborted (a thread failed) or when the interpreter is aborted.
+struct _gmic_parallel_group {
+  unsigned int nb_threads, nb_waiting, generation, semaphores[256];
+  bool is_aborted;
+#if defined(gmic_is_parallel) && cimg_OS!=2
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  void lock() { pthread_mutex_lock(&mutex); }
+  void unlock() { pthread_mutex_unlock(&mutex); }
+  void notify() { pthread_cond_broadcast(&cond); }
+  void wait() { // Wake up periodically to check for interpreter abort.
+    struct timeval now;
+    gettimeofday(&now,0);
+    struct timespec deadline;
+    const unsigned long usec = now.tv_usec + 100000;
+    deadline.tv_sec = now.tv_sec + usec/1000000;
+    deadline.tv_nsec = (usec%1000000)*1000;
+    pthread_cond_timedwait(&cond,&mutex,&deadline);
+  }
+#elif defined(gmic_is_parallel) // #if defined(gmic_is_parallel) && cimg_OS!=2
+  HANDLE mutex;
+  void lock() { WaitForSingleObject(mutex,INFINITE); }
+  void unlock() { ReleaseMutex(mutex); }
+  void notify() {}
+  void wait() { unlock(); Sleep(1); lock(); }
+#else // #if defined(gmic_is_parallel) && cimg_OS!=2
+  void lock() {}
+  void unlock() {}
+  void notify() {}
+  void wait() {}
+#endif // #if defined(gmic_is_parallel) && cimg_OS!=2
+
+  _gmic_parallel_group(const unsigned int _nb_threads):
+    nb_threads(_nb_threads),nb_waiting(0),generation(0),is_aborted(false) {
+    std::memset(semaphores,0,sizeof(semaphores));
+#if defined(gmic_is_parallel) && cimg_OS!=2
+    pthread_mutex_init(&mutex,0);
+    pthread_cond_init(&cond,0);
+#elif defined(gmic_is_parallel) // #if defined(gmic_is_parallel) && cimg_OS!=2
+    mutex = CreateMutex(0,FALSE,0);
+#endif // #if defined(gmic_is_parallel) && cimg_OS!=2
+  }
+
+  ~_gmic_parallel_group() {
+#if defined(gmic_is_parallel) && cimg_OS!=2
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+#elif defined(gmic_is_parallel) // #if defined(gmic_is_parallel) && cimg_OS!=2
+    CloseHandle(mutex);
+#endif // #if defined(gmic_is_parallel) && cimg_OS!=2
+  }
+
+  void _release() {
+    nb_waiting = 0; ++generation; notify();
+  }
+
+  // Wait for all running threads of the group (return false if aborted).
+  bool barrier(const bool *const is_abort) {
+    lock();
+    const unsigned int _generation = generation;
+    if (++nb_waiting>=nb_threads) _release();
+    else while (_generation==generation && !is_aborted && !*is_abort) wait();
+    const bool res = !is_aborted && !*is_abort;
+    unlock();
+    return res;
+  }
+
+  // Decrement semaphore, waiting for it to be positive (return false if aborted).
+  // Without parallel computing, threads run sequentially and a null semaphore is not waited for.
+  bool semaphore_wait(const unsigned int n, const bool *const is_abort) {
+    lock();
+#ifdef gmic_is_parallel
+    while (!semaphores[n] && !is_aborted && !*is_abort) wait();
+#endif // #ifdef gmic_is_parallel
+    const bool res = !is_aborted && !*is_abort;
+    if (res && semaphores[n]) --semaphores[n];
+    unlock();
+    return res;
+  }
+
+  void semaphore_post(const unsigned int n, const unsigned int value) {
+    lock(); semaphores[n]+=value; notify(); unlock();
+  }
+
+  // Remove a terminated thread from the group (so that barriers do not wait for it anymore).
+  void leave() {
+    lock();
+    if (nb_threads) --nb_threads;
+    if (nb_waiting && nb_waiting>=nb_threads) _release();
+    unlock();
+  }
+
+  void abort() {
+    lock(); is_aborted = true; notify(); unlock();
+  }
+};
+
+// Thread structure and routine for command '-parallel'.
+template<typename T>
+struct st_gmic_parallel {
+  CImgList<char> *images_names, *parent_images_names, commands_line;
+  CImgList<st_gmic_parallel<T> > *threads_data;
+  CImgList<T> *images, *parent_images;
+  CImg<unsigned int> variables_sizes;
+  volatile bool is_thread_running;
+  gmic_exception exception;
+  st_gmic_tiles<T> *tiles;
+  _gmic_parallel_group *group;
+  bool is_group_owner;
+  _gmic_context *const context;
+  gmic &gmic_instance;
+#ifdef gmic_is_parallel
+#if cimg_OS!=2
+  _gmic_job job;
+#else // #if cimg_OS!=2
+  HANDLE thread_id;
+#endif // #if cimg_OS!=2
+#endif // #ifdef gmic_is_parallel
+  st_gmic_parallel():tiles(0),group(0),is_group_owner(false),
+                     context(gmic_acquire_context()),gmic_instance(*context->instance) {
+    variables_sizes.assign(1,1,1,1,0);
+#if defined(gmic_is_parallel) && cimg_OS!=2
+    job.routine = 0;
+#endif // #if defined(gmic_is_parallel) && cimg_OS!=2
+  }
+  ~st_gmic_parallel() {
+#if defined(gmic_is_parallel) && cimg_OS!=2
+    if (job.routine) gmic_thread_pool().wait(job);
+#endif // #if defined(gmic_is_parallel) && cimg_OS!=2
+    gmic_instance.parallel_group = 0;
+    gmic_release_context(context);
+    if (is_group_owner) delete group;
+  }
+};
+
+template<typename T>
+#if cimg_OS!=2
+static void *gmic_parallel(void *arg)
+#else // #if cimg_OS!=2
+static DWORD WINAPI gmic_parallel(void *arg)
+#endif // #if cimg_OS!=2
+{
+  st_gmic_parallel<T> &st = *(st_gmic_parallel<T>*)arg;
+  unsigned int pos = 0;
+  gmic_apply_max_threads();
+  try {
+    st.gmic_instance.is_debug_info = false;
+    st.gmic_instance._run(st.commands_line,pos,*st.images,*st.images_names,
+                          *st.parent_images,*st.parent_images_names,
+                          st.variables_sizes,0,0);
+    if (st.group) st.group->leave();
+  } catch (gmic_exception &e) {
+
+    // Send all remaining running threads the 'abort' signal.
+    if (st.group) st.group->abort();
+#ifdef gmic_is_parallel
+    CImgList<st_gmic_parallel<T> > &threads_data = *st.threads_data;
+    cimglist_for(threads_data,i) cimg_forY(threads_data[i],l)
+      if (&threads_data(i,l)!=&st && threads_data(i,l).is_thread_running) {
+        threads_data(i,l).gmic_instance.is_abort_thread = true;
+#if cimg_OS!=2
+        gmic_thread_pool().wait(threads_data(i,l).job);
+#else // #if cimg_OS!=2
+        WaitForSingleObject(threads_data(i,l).thread_id,INFINITE);
+        CloseHandle(threads_data(i,l).thread_id);
+#endif // #if cimg_OS!=2
+        threads_data(i,l).is_thread_running = false;
+      }
+#endif // #ifdef gmic_is_parallel
+
+    st.exception._command_help.assign(e._command_help);
+    st.exception._message.assign(e._message);
+  }
+  return 0;
+}
+
+template<typename T>
+#if cimg_OS!=2
+static void *gmic_parallel_tiles(void *arg)
+#else // #if cimg_OS!=2
+static DWORD WINAPI gmic_parallel_tiles(void *arg)
+#endif // #if cimg_OS!=2
+{
+  st_gmic_parallel<T> &st = *(st_gmic_parallel<T>*)arg;
+  st_gmic_tiles<T> &tiles = *st.tiles;
+  gmic &gi = st.gmic_instance;
+  CImgList<T> tile_images;
+  CImgList<char> tile_names;
+  gmic_apply_max_threads();
+  try {
+    gi.is_debug_info = false;
+    for (;;) {
+      cimg::mutex(24);
+      const unsigned int ind = tiles.is_failed || tiles.next_tile>=tiles.nb_tiles?~0U:tiles.next_tile++;
+      cimg::mutex(24,0);
+      if (ind==~0U || gi.is_abort_thread || *gi.is_abort) break;
+
+      // Crop tile with its halo.
+      const unsigned int
+        ix = ind%tiles.nx, iy = (ind/tiles.nx)%tiles.ny, iz = ind/(tiles.nx*tiles.ny);
+      const int
+        x0 = (int)(ix*tiles.width/tiles.nx), x1 = (int)((ix + 1)*tiles.width/tiles.nx) - 1,
+        y0 = (int)(iy*tiles.height/tiles.ny), y1 = (int)((iy + 1)*tiles.height/tiles.ny) - 1,
+        z0 = (int)(iz*tiles.depth/tiles.nz), z1 = (int)((iz + 1)*tiles.depth/tiles.nz) - 1,
+        X0 = cimg::max(0,x0 - (int)tiles.hx), X1 = cimg::min((int)tiles.width - 1,x1 + (int)tiles.hx),
+        Y0 = cimg::max(0,y0 - (int)tiles.hy), Y1 = cimg::min((int)tiles.height - 1,y1 + (int)tiles.hy),
+        Z0 = cimg::max(0,z0 - (int)tiles.hz), Z1 = cimg::min((int)tiles.depth - 1,z1 + (int)tiles.hz),
+        C1 = (int)tiles.spectrum - 1;
+      if (tiles.filename_in)
+        tile_images.load_cimg(tiles.filename_in,tiles.n,tiles.n,X0,Y0,Z0,0,X1,Y1,Z1,C1);
+      else {
+        tile_images.assign(1);
+        tiles.img->get_crop(X0,Y0,Z0,0,X1,Y1,Z1,C1).move_to(tile_images[0]);
+      }
+      tile_names.assign(1);
+      cimg_snprintf(tile_names[0].assign(64).data(),64,"[tile%u]",ind);
+
+      // Run command pipeline on tile.
+      unsigned int pos = 0;
+      gi.is_return = false;
+      gi._run(st.commands_line,pos,tile_images,tile_names,*st.parent_images,*st.parent_images_names,
+              st.variables_sizes,0,0);
+      ((_gmic_variables*)gi.local_variables)->pop(0);
+      const CImg<T> &tile = tile_images.size()==1?tile_images[0]:CImg<T>::empty();
+      if (tile._width!=(unsigned int)(X1 - X0 + 1) || tile._height!=(unsigned int)(Y1 - Y0 + 1) ||
+          tile._depth!=(unsigned int)(Z1 - Z0 + 1) || tile._spectrum!=tiles.spectrum)
+        gi.error(tile_images,0,tiles.command,
+                 "Command '-%s': Command pipeline must return a single image "
+                 "with same dimensions as its input tile (%d,%d,%d,%u) (returned %u image%s).",
+                 tiles.command,X1 - X0 + 1,Y1 - Y0 + 1,Z1 - Z0 + 1,tiles.spectrum,
+                 tile_images.size(),tile_images.size()==1?"":"s");
+
+      // Write tile interior back into place.
+      if (tiles.filename_out) {
+        CImg<T> interior = tile.get_crop(x0 - X0,y0 - Y0,z0 - Z0,0,x1 - X0,y1 - Y0,z1 - Z0,C1);
+        cimg::mutex(24); // Tiles are disjoint, but file writes are serialized anyway (header read, seeks).
+        try { interior.save_cimg(tiles.filename_out,tiles.n,x0,y0,z0,0); }
+        catch (...) { cimg::mutex(24,0); throw; }
+        cimg::mutex(24,0);
+      } else {
+        const unsigned int wh = (unsigned int)(x1 - x0 + 1)*sizeof(T);
+        for (int c = 0; c<=C1; ++c)
+          for (int z = z0; z<=z1; ++z)
+            for (int y = y0; y<=y1; ++y)
+              std::memcpy(tiles.res->data(x0,y,z,c),tile.data(x0 - X0,y - Y0,z - Z0,c),wh);
+      }
+    }
+  } catch (gmic_exception &e) {
+    cimg::mutex(24);
+    tiles.is_failed = true;
+    cimg::mutex(24,0);
+    st.exception._command_help.assign(e._command_help);
+    st.exception._message.assign(e._message);
+  } catch (CImgException &e) { // File errors in '-stream_cimg'.
+    cimg::mutex(24);
+    tiles.is_failed = true;
+    cimg::mutex(24,0);
+    CImg<char>::string(tiles.command).move_to(st.exception._command_help);
+    CImg<char>::string(e.what()).move_to(st.exception._message);
+  }
+  return 0;
+}
+
+// Thread structure for command '-async'.
+// The job owns the images transferred to it, until they are inserted back by command '-await'.
+template<typename T>
+struct st_gmic_async {
+  CImgList<T> images, parent_images;
+  CImgList<char> images_names, parent_images_names;
+  CImgList<st_gmic_parallel<T> > threads_data; // Always empty, required by 'gmic_parallel()'.
+  st_gmic_parallel<T> thread;
+};
+
+template<typename T>
+static void gmic_async_wait(st_gmic_async<T> &job) {
+#ifdef gmic_is_parallel
+  if (job.thread.is_thread_running) {
+#if cimg_OS!=2
+    gmic_thread_pool().wait(job.thread.job);
+#else // #if cimg_OS!=2
+    WaitForSingleObject(job.thread.thread_id,INFINITE);
+    CloseHandle(job.thread.thread_id);
+#endif // #if cimg_OS!=2
+  }
+#endif // #ifdef gmic_is_parallel
+  job.thread.is_thread_running = false;
+}
+
+template<typename T>
+static void gmic_async_release(void *const data, const bool is_abort) {
+  st_gmic_async<T> &job = *(st_gmic_async<T>*)data;
+  if (is_abort) job.thread.gmic_instance.is_abort_thread = true;
+  gmic_async_wait(job);
+  delete &job;
+}
+
+#if cimg_OS==1
+// Process-based backend of command '-parallel' (mode 'process').
+// Each command runs in a forked worker process, on a copy-on-write snapshot of the image list and
+// of the interpreter (including its command tables). A worker writes its resulting images, their
+// names, its status and its error (if any) in .cimg format, to an unlinked file of the shared memory
+// filesystem, that the parent reads back.
+inline std::FILE *gmic_shm_file() {
+  char filename[] = "/dev/shm/gmic_parallel_XXXXXX";
+  const int fd = mkstemp(filename);
+  if (fd>=0) {
+    unlink(filename);
+    std::FILE *const file = fdopen(fd,"w+b");
+    if (file) return file;
+    close(fd);
+  }
+  return std::tmpfile();
+}
+
+// Fork a worker process. Locks that other threads may hold are taken around 'fork()', so that the worker
+// does not inherit them locked: output (mutex 29, also taken by the log writer), log writer wake-up
+// and pool of threads.
+inline pid_t gmic_fork() {
+  cimg::mutex(29);
+#ifdef gmic_is_parallel
+  _gmic_thread_pool &pool = gmic_thread_pool();
+  _gmic_log &log = gmic_log();
+  pthread_mutex_lock(&pool.mutex);
+  pthread_mutex_lock(&log.mutex);
+#endif // #ifdef gmic_is_parallel
+  const pid_t pid = fork();
+#ifdef gmic_is_parallel
+  if (pid) { pthread_mutex_unlock(&log.mutex); pthread_mutex_unlock(&pool.mutex); }
+  else { // Threads of the parent do not exist in the worker.
+    pthread_cond_init(&log.cond,0);
+    pthread_mutex_unlock(&log.mutex);
+    pool.reset_after_fork();
+    if (log.is_writer) log.start_writer(); // Writer of the parent is not joined: it does not exist here.
+  }
+#endif // #ifdef gmic_is_parallel
+#ifdef cimg_use_openmp
+  if (!pid) omp_set_num_threads(1); // OpenMP threads of the parent cannot be reused in the worker.
+#endif // #ifdef cimg_use_openmp
+  cimg::mutex(29,0);
+  return pid;
+}
+
+// Tell whether a buffer has been written by a worker process since it was forked, from the page map 'fd'
+// of the worker: pages written (copied on write) or allocated by the worker are exclusively mapped, while
+// those still shared with the parent are not. Swapped pages are considered as written.
+// Return -1 if the page map cannot be read.
+inline int gmic_is_written(const int fd, const void *const ptr, const std::size_t size) {
+  if (fd<0) return -1;
+  if (!size) return 0;
+  const std::size_t
+    page_size = (std::size_t)sysconf(_SC_PAGESIZE),
+    p0 = (std::size_t)ptr/page_size, p1 = ((std::size_t)ptr + size - 1)/page_size;
+  unsigned long long entries[512];
+  for (std::size_t p = p0; p<=p1; ) {
+    const std::size_t n = cimg::min((std::size_t)512,p1 - p + 1), siz = n*sizeof(unsigned long long);
+    if (pread(fd,entries,siz,(off_t)(p*sizeof(unsigned long long)))!=(ssize_t)siz) return -1;
+    for (std::size_t k = 0; k<n; ++k)
+      if ((entries[k]>>56)&1 || (entries[k]>>62)&1) return 1; // Exclusively mapped or swapped.
+    p+=n;
+  }
+  return 0;
+}
+
+// Tell whether the page map of the process reports exclusively mapped pages (Linux>=4.2), so that
+// 'gmic_is_written()' can be used in worker processes.
+inline bool gmic_is_pagemap() {
+  const int fd = open("/proc/self/pagemap",O_RDONLY);
+  if (fd<0) return false;
+  const CImg<unsigned char> written(2*(unsigned int)sysconf(_SC_PAGESIZE),1,1,1,1);
+  const bool res = gmic_is_written(fd,written._data,written.size())==1;
+  close(fd);
+  return res;
+}
+
+// Compute checksum of the pixel values of an image (to detect images modified by a worker process, when
+// the page map cannot be used).
+template<typename T>
+inline unsigned long long gmic_checksum(const CImg<T>& img) {
+  const unsigned char *ptr = (const unsigned char*)img._data, *const ptr_end = ptr + img.size()*sizeof(T);
+  unsigned long long hash = 14695981039346656037ULL, word;
+  for ( ; ptr + sizeof(word)<=ptr_end; ptr+=sizeof(word)) {
+    std::memcpy(&word,ptr,sizeof(word));
+    hash = (hash^word)*1099511628211ULL;
+  }
+  for ( ; ptr<ptr_end; ++ptr) hash = (hash^*ptr)*1099511628211ULL;
+  return hash;
+}
+
+// Run prepared threads as worker processes, and merge their results into the image list, as for threads:
+// each worker sends back only the images it has modified or inserted (with the indices of the images they
+// replace) and the indices of the images it has removed.
+// Return the index of the first worker that failed to run (or -1), or -2 if aborted.
+template<typename T>
+static int gmic_parallel_processes(CImg<st_gmic_parallel<T> >& threads_data,
+                                   CImgList<T>& images, CImgList<char>& images_names,
+                                   CImg<char>& status, gmic_exception& exception,
+                                   const volatile bool *const is_abort, const volatile bool *const is_abort_thread) {
+  const unsigned int nb_workers = threads_data._height, N0 = images._width;
+  std::FILE **const files = new std::FILE*[nb_workers];
+  pid_t *const pids = new pid_t[nb_workers];
+
+  // Describe initial images (buffer and dimensions), to detect which ones a worker modifies.
+  // Modified pixels are detected from the page map of the worker, or else from checksums of the images.
+  const bool is_pagemap = gmic_is_pagemap();
+  CImg<unsigned long> buffers(N0);
+  CImg<unsigned int> dims(4,N0);
+  CImg<unsigned long long> checksums;
+  if (!is_pagemap) checksums.assign(N0);
+  cimglist_for(images,k) {
+    const CImg<T> &img = images[k];
+    buffers[k] = (unsigned long)img._data;
+    dims(0,k) = img._width; dims(1,k) = img._height; dims(2,k) = img._depth; dims(3,k) = img._spectrum;
+    if (!is_pagemap) checksums[k] = gmic_checksum(img);
+  }
+
+  // Workers keep the write end of a pipe open until they terminate, so that the parent can wait for them
+  // without polling their status.
+  int fds[2] = { -1,-1 };
+  if (!pipe(fds)) { fcntl(fds[0],F_SETFD,FD_CLOEXEC); fcntl(fds[1],F_SETFD,FD_CLOEXEC); }
+  else fds[0] = fds[1] = -1;
+
+  gmic_flush_log(); // Avoid duplicating pending messages in workers.
+  std::fflush(0);
+  for (unsigned int l = 0; l<nb_workers; ++l) {
+    pids[l] = -1;
+    if (!(files[l] = gmic_shm_file())) continue;
+    if (!(pids[l] = gmic_fork())) { // Worker process.
+      if (fds[0]>=0) close(fds[0]);
+      const int fd_pagemap = is_pagemap?open("/proc/self/pagemap",O_RDONLY):-1;
+      st_gmic_parallel<T> &st = threads_data[l];
+      CImgList<st_gmic_parallel<T> > no_threads; // Threads of the parent do not exist here.
+      st.threads_data = &no_threads;
+      const CImgList<char> names0(images_names);
+      int res = 0;
+      try {
+        gmic_parallel<T>((void*)&st);
+        const CImgList<T> &res_images = *st.images;
+        const CImgList<char> &res_names = *st.images_names;
+
+        // Match resulting images with initial ones (by buffer first, then by position).
+        CImg<int> origins(res_images._width,1,1,1,-1);
+        CImg<bool> is_kept(N0,1,1,1,false);
+        cimglist_for(res_images,p) if (res_images[p]._data)
+          for (unsigned int k = 0; k<N0; ++k)
+            if (!is_kept[k] && buffers[k]==(unsigned long)res_images[p]._data) {
+              origins[p] = (int)k; is_kept[k] = true; break;
+            }
+        cimglist_for(res_images,p) if (origins[p]<0 && p<(int)N0 && !is_kept[p]) {
+          origins[p] = p; is_kept[p] = true;
+        }
+
+        // Select modified and inserted images.
+        CImgList<T> nimages;
+        CImgList<char> nimages_names;
+        CImgList<int> meta(2);
+        unsigned int nb = 0;
+        cimglist_for(res_images,p) {
+          const CImg<T> &img = res_images[p];
+          const int k = origins[p];
+          if (k>=0 && buffers[k]==(unsigned long)img._data &&
+              img._width==dims(0,k) && img._height==dims(1,k) &&
+              img._depth==dims(2,k) && img._spectrum==dims(3,k) &&
+              (is_pagemap?!gmic_is_written(fd_pagemap,img._data,img.size()*sizeof(T)):
+               gmic_checksum(img)==checksums[k]) &&
+              !std::strcmp(res_names[p],names0[k])) continue;
+          nimages.insert(img,~0U,true);
+          nimages_names.insert(res_names[p],~0U,true);
+          origins[nb++] = k;
+        }
+        if (nb) origins.get_crop(0,nb - 1).move_to(meta[0]);
+        unsigned int nb_removed = 0;
+        cimg_forX(is_kept,k) if (!is_kept[k]) ++nb_removed;
+        if (nb_removed) {
+          meta[1].assign(nb_removed);
+          nb_removed = 0;
+          cimg_forX(is_kept,k) if (!is_kept[k]) meta[1][nb_removed++] = (int)k;
+        }
+
+        CImgList<char> infos(3);
+        st.gmic_instance.status.move_to(infos[0]);
+        st.exception._message.move_to(infos[1]);
+        st.exception._command_help.move_to(infos[2]);
+        nimages.save_cimg(files[l]);
+        nimages_names.save_cimg(files[l]);
+        meta.save_cimg(files[l]);
+        infos.save_cimg(files[l]);
+        if (std::fflush(files[l])) res = 1;
+      } catch (...) { res = 1; }
+      gmic_flush_log();
+      _exit(res);
+    }
+  }
+
+  // Wait for all workers: the pipe reaches its end when the last one terminates. The timeout is only
+  // used to check for abort requests (then workers are killed). Without a pipe, workers are not abortable.
+  if (fds[1]>=0) close(fds[1]);
+  bool is_aborted = false;
+  while (fds[0]>=0) {
+    if ((is_abort && *is_abort) || (is_abort_thread && *is_abort_thread)) {
+      is_aborted = true;
+      for (unsigned int l = 0; l<nb_workers; ++l) if (pids[l]>0) kill(pids[l],SIGKILL);
+      break;
+    }
+    struct pollfd pfd;
+    pfd.fd = fds[0]; pfd.events = POLLIN; pfd.revents = 0;
+    const int res = poll(&pfd,1,100);
+    char c = 0;
+    if (res>0 && read(fds[0],&c,1)<=0) break; // End of pipe.
+    if (res<0 && errno!=EINTR) break;
+  }
+  if (fds[0]>=0) close(fds[0]);
+
+  int failed = -1;
+  CImg<bool> is_done(nb_workers,1,1,1,false);
+  for (unsigned int l = 0; l<nb_workers; ++l) {
+    int wstatus = 0;
+    pid_t pid = 0;
+    if (pids[l]>0) do pid = waitpid(pids[l],&wstatus,0); while (pid<0 && errno==EINTR);
+    is_done[l] = pid==pids[l] && pids[l]>0 && WIFEXITED(wstatus) && !WEXITSTATUS(wstatus);
+    if (!is_done[l] && failed<0) failed = (int)l;
+  }
+  if (is_aborted) failed = -2;
+
+  // Collect results of the workers (the last one to modify an image wins, as for threads).
+  CImgList<T> rimages(N0), nimages;
+  CImgList<char> rimages_names(N0), nimages_names;
+  CImg<bool> is_replaced(N0,1,1,1,false), is_removed(N0,1,1,1,false);
+  for (unsigned int l = 0; l<nb_workers; ++l) {
+    if (is_done[l] && failed==-1 && !exception._message) try {
+        std::rewind(files[l]);
+        CImgList<T> limages;
+        CImgList<char> limages_names, infos;
+        CImgList<int> meta;
+        limages.load_cimg(files[l]);
+        limages_names.load_cimg(files[l]);
+        meta.load_cimg(files[l]);
+        infos.load_cimg(files[l]);
+        if (infos.size()!=3 || meta.size()!=2 || limages_names.size()!=limages.size() ||
+            meta[0].size()!=limages.size()) failed = (int)l;
+        else if (infos[1]) {
+          exception._message.swap(infos[1]);
+          exception._command_help.swap(infos[2]);
+        } else {
+          if (!l) infos[0].move_to(status);
+          cimglist_for(limages,p) {
+            const int k = meta[0][p];
+            if (k>=0 && k<(int)N0) {
+              limages[p].move_to(rimages[k]);
+              limages_names[p].move_to(rimages_names[k]);
+              is_replaced[k] = true;
+            } else {
+              limages[p].move_to(nimages,~0U);
+              limages_names[p].move_to(nimages_names,~0U);
+            }
+          }
+          cimg_foroff(meta[1],i) {
+            const int k = meta[1][i];
+            if (k>=0 && k<(int)N0) is_removed[k] = true;
+          }
+        }
+      } catch (CImgException&) { failed = (int)l; }
+    if (files[l]) std::fclose(files[l]);
+  }
+  delete[] files;
+  delete[] pids;
+  if (failed==-1 && !exception._message) {
+    cimg_forX(is_replaced,k) if (is_replaced[k]) {
+      images[k].swap(rimages[k]);
+      images_names[k].swap(rimages_names[k]);
+    }
+    nimages.move_to(images,~0U);
+    nimages_names.move_to(images_names,~0U);
+    for (int k = (int)N0 - 1; k>=0; --k) if (is_removed[k]) {
+        images.remove(k);
+        images_names.remove(k);
+      }
+  }
+  return failed;
+}
+#endif // #if cimg_OS==1
+
+// Prepare thread structure to run commands on behalf of interpreter 'parent'.
+// Commands of the parent are shared with the thread, unless 'is_copy' is set (for threads that may
+// outlive the current command of the parent, which can then modify its commands, e.g. with '-command').
+template<typename T>
+static void gmic_prepare_thread(st_gmic_parallel<T> &st, const gmic &parent, const char *const thread_name,
+                                const bool is_copy=false) {
+  gmic &gi = st.gmic_instance;
+  _gmic_context &context = *st.context;
+  if (is_copy || context.source!=&parent || context.source_version!=parent.commands_version ||
+      context.instance_version!=gi.commands_version) { // Share commands only if changed.
+    for (unsigned int i = 0; i<512; ++i) {
+      gi.commands[i].assign(parent.commands[i],!is_copy);
+      gi.commands_names[i].assign(parent.commands_names[i],!is_copy);
+      gi.commands_has_arguments[i].assign(parent.commands_has_arguments[i],!is_copy);
+      gi.commands_items[i].assign(parent.commands_items[i],!is_copy);
+      gi.commands_ids[i].assign(parent.commands_ids[i],!is_copy);
+    }
+    gi.commands_version = gmic_new_commands_version();
+    context.source = is_copy?0:&parent; // A copy is not reused as a shared context.
+    context.source_version = parent.commands_version;
+    context.instance_version = gi.commands_version;
+  }
+
+  // Make a copy of single-thread global variables, and share inter-thread global variables.
+  gi._variables[0].assign(parent._variables[0]);
+  gi._variables_names[0].assign(parent._variables_names[0]);
+  gi.variables[0] = &gi._variables[0];
+  gi.variables_names[0] = &gi._variables_names[0];
+  gi.variables[1] = parent.variables[1];
+  gi.variables_names[1] = parent.variables_names[1];
+  gi.atomic_variables = parent.atomic_variables;
+  gi.mapped_files = parent.mapped_files;
+  ((_gmic_compact_pending*)gi.compact_pending)->is_used = ((_gmic_compact_pending*)parent.compact_pending)->is_used;
+
+  gi.callstack.assign(parent.callstack);
+  gi.commands_files.assign(parent.commands_files,!is_copy);
+  CImg<char>::string(thread_name).move_to(gi.callstack);
+  gi.light3d.assign(parent.light3d);
+  gi.status.assign(parent.status);
+  gi.debug_filename = parent.debug_filename;
+  gi.debug_line = parent.debug_line;
+  gi.focale3d = parent.focale3d;
+  gi.light3d_x = parent.light3d_x;
+  gi.light3d_y = parent.light3d_y;
+  gi.light3d_z = parent.light3d_z;
+  gi.specular_lightness3d = parent.specular_lightness3d;
+  gi.specular_shininess3d = parent.specular_shininess3d;
+  gi._progress = 0;
+  gi.progress = &gi._progress;
+  gi.is_released = parent.is_released;
+  gi.is_debug = parent.is_debug;
+  gi.is_start = false;
+  gi.is_quit = false;
+  gi.is_return = false;
+  gi.is_double3d = parent.is_double3d;
+  gi.check_elif = false;
+  gi.verbosity = parent.verbosity;
+  gi.render3d = parent.render3d;
+  gi.renderd3d = parent.renderd3d;
+  gi._is_abort = parent._is_abort;
+  gi.is_abort = parent.is_abort;
+  gi.is_abort_thread = false;
+  gi.nb_carriages = parent.nb_carriages;
+  gi.reference_time = parent.reference_time;
+}
+
+// Substitute special characters codes appearing outside strings.
+inline char *gmic_strreplace_unquoted(char *const str) {
+  bool is_dquoted = false;
+  for (char *s = str; *s; ++s) {
+    const char c = *s;
+    if (c=='\"') is_dquoted = !is_dquoted;
+    if (!is_dquoted) *s = c<' '?(c==_dollar?'$':c==_lbrace?'{':c==_rbrace?'}':
+                                 c==_comma?',':c==_dquote?'\"':c):c;
+  }
+  return str;
+}
+
+// Return Levenshtein distance between two strings.
+// (adapted from http://rosettacode.org/wiki/Levenshtein_distance#C)
+int gmic::_levenshtein(const char *const s, const char *const t,
+                       CImg<int>& d, const int i, const int j) {
+  const int ls = d.width() - 1, lt = d.height() - 1;
+  if (d(i,j)>=0) return d(i,j);
+  int x;
+  if (i==ls) x = lt - j;
+  else if (j==lt) x = ls - i;
+  else if (s[i]==t[j]) x = _levenshtein(s,t,d,i + 1,j + 1);
+  else {
+    x = _levenshtein(s,t,d,i + 1,j + 1);
+    int y;
+    if ((y=_levenshtein(s,t,d,i,j + 1))<x) x = y;
+    if ((y=_levenshtein(s,t,d,i + 1,j))<x) x = y;
+    ++x;
+  }
+  return d(i,j) = x;
+}
+
+int gmic::levenshtein(const char *const s, const char *const t) {
+  const char *const ns = s?s:"", *const nt = t?t:"";
+  const int ls = (int)std::strlen(ns), lt = (int)std::strlen(nt);
+  if (!ls) return lt; else if (!lt) return ls;
+  CImg<int> d(1 + ls,1 + lt,1,1,-1);
+  return _levenshtein(ns,nt,d,0,0);
+}
+
+// Return true if specified filename corresponds to an existing file or directory.
+bool gmic::check_filename(const char *const filename) {
+  bool res = false;
+#if cimg_OS==2
+  const unsigned int attr = (unsigned int)GetFileAttributesA(filename);
+  res = (attr!=~0U);
+#else // #if cimg_OS==2
+  try {
+    std::FILE *file = cimg::fopen(filename,"r");
+    if (file) { res = true; cimg::fclose(file); }
+  } catch (CImgException&) {}
+#endif // #if cimg_OS==2
+  return res;
+}
+
+// Return a 8-bits hashcode from a string.
+unsigned int gmic::hashcode(const char *const str, const bool is_variable) {
+  if (!str) return 0U;
+  unsigned int hash = 0U;
+  if (is_variable) {
+    if (*str=='_') return str[1]=='_'?511U:510U;
+    for (const char *s = str; *s; ++s) (hash*=31)+=*s;
+    return hash%510;
+  }
+  for (const char *s = str; *s; ++s) (hash*=31)+=*s;
+  return hash&511;
+}
+
+// Return identifier of a native command (or 0 if not a native command).
+unsigned int gmic::native_command_id(const char *const command) {
+  static const struct _gmic_native_commands_table {
+    unsigned int ids[512];
+    _gmic_native_commands_table() {
+      std::memset(ids,0,sizeof(ids));
+      for (unsigned int id = 1; id<gmic_cmd_end; ++id) {
+        unsigned int hash = hashcode(gmic_native_commands_names[id],false);
+        while (ids[hash]) hash = (hash + 1)&511;
+        ids[hash] = id;
+      }
+    }
+  } table;
+  if (!command || *command!='-') return 0;
+  for (unsigned int hash = hashcode(command,false), id; (id=table.ids[hash])!=0; hash = (hash + 1)&511)
+    if (!std::strcmp(gmic_native_commands_names[id],command)) return id;
+  return 0;
+}
+
+// Tells if the the implementation of a G'MIC command contains arguments.
+bool gmic::command_has_arguments(const char *const command) {
+  if (!command || !*command) return false;
+  for (const char *s = std::strchr(command,'$'); s; s = std::strchr(s,'$')) {
+    const char c = *(++s);
+    if (c=='#' ||
+        c=='*' ||
+        c=='=' ||
+        (c>'0' && c<='9') ||
+        (c=='-' && *(s + 1)>'0' && *(s + 1)<='9') ||
+        (c=='\"' && *(s + 1)=='*' && *(s + 2)=='\"') ||
+        (c=='{' && (*(s + 1)=='^' ||
+                    (*(s + 1)>'0' && *(s + 1)<='9') ||
+                    (*(s + 1)=='-' && *(s + 2)>'0' && *(s + 2)<='9')))) return true;
+  }
+  return false;
+}
+
+// Compute the basename of a filename.
+const char* gmic::basename(const char *const str)  {
+  if (!str) return str;
+  const unsigned int l = (unsigned int)std::strlen(str);
+  if (*str=='[' && (str[l - 1]==']' || str[l - 1]=='.')) return str;
+  const char *p = 0, *np = str;
+  while (np>=str && (p=np)) np = std::strchr(np,'/') + 1;
+  np = p;
+  while (np>=str && (p=np)) np = std::strchr(np,'\\') + 1;
+  return p;
+}
+
+// Replace special characters in a string.
+char *gmic::strreplace_fw(char *const str) {
+  if (str) for (char *s = str ; *s; ++s) {
+      const char c = *s;
+      if (c<' ')
+        *s = c==_dollar?'$':c==_lbrace?'{':c==_rbrace?'}':c==_comma?',':
+          c==_dquote?'\"':c;
+    }
+  return str;
+}
 
 char *gmic::strreplace_bw(char *const str) {
   if (str) for (char *s = str ; *s; ++s) {
@@ -2438,10 +5255,18 @@ char *gmic::ellipsize(const char *const s, char *const res, const unsigned int l
 // Constructors / destructors.
 //----------------------------
 #define gmic_new_attr commands(new CImgList<char>[512]), commands_names(new CImgList<char>[512]), \
-    commands_has_arguments(new CImgList<char>[512]), \
-    _variables(new CImgList<char>[512]), _variables_names(new CImgList<char>[512]), \
-    variables(new CImgList<char>*[512]), variables_names(new CImgList<char>*[512]), \
-    display_window(new CImgDisplay[10]), is_running(false)
+    commands_has_arguments(new CImgList<char>[512]), commands_items(new CImgList<char>[512]), \
+    _variables(new CImgList<char>[2]), _variables_names(new CImgList<char>[2]), \
+    variables(new CImgList<char>*[2]), variables_names(new CImgList<char>*[2]), \
+    commands_ids(new CImgList<unsigned int>[512]), \
+    display_window(new CImgDisplay[10]), math_cache(new _gmic_math_cache), \
+    local_variables(new _gmic_variables), substitution_frames(new _gmic_substitution_frames), \
+    run_frames(new _gmic_run_frames), deferred_images(new _gmic_deferred_images), \
+    log_ring(new _gmic_log_ring), parallel_group(0), _atomic_variables(new _gmic_atomic_variables), \
+    atomic_variables(0), async_jobs(new _gmic_async_jobs), _mapped_files(new _gmic_mapped_files), \
+    mapped_files(0), compact_pending(new _gmic_compact_pending), \
+    memory_profile(new _gmic_memory_profile), \
+    buffer_pool(new _gmic_buffer_pool), is_running(false)
 
 CImg<char> gmic::stdlib = CImg<char>::empty();
 
@@ -2464,16 +5289,31 @@ gmic::gmic(const char *const commands_line, const char *const custom_commands,
 }
 
 gmic::~gmic() {
+  delete (_gmic_async_jobs*)async_jobs; // Jobs share commands with this interpreter: join them first.
   CImgDisplay *const _display_window = (CImgDisplay*)display_window;
   cimg::exception_mode(cimg_exception_mode);
   delete[] commands;
   delete[] commands_names;
   delete[] commands_has_arguments;
+  delete[] commands_items;
+  delete[] commands_ids;
   delete[] _variables;
   delete[] _variables_names;
   delete[] variables;
   delete[] variables_names;
   delete[] _display_window;
+  delete (_gmic_math_cache*)math_cache;
+  delete (_gmic_variables*)local_variables;
+  delete (_gmic_substitution_frames*)substitution_frames;
+  delete (_gmic_run_frames*)run_frames;
+  delete (_gmic_deferred_images*)deferred_images;
+  delete (_gmic_log_ring*)log_ring;
+  delete (_gmic_atomic_variables*)_atomic_variables;
+  delete (_gmic_mapped_files*)_mapped_files;
+  delete (_gmic_compact_pending*)compact_pending;
+  delete (_gmic_memory_profile*)memory_profile;
+  delete (_gmic_buffer_pool*)buffer_pool;
+  gmic_remove_instance();
 }
 
 // Uncompress G'MIC standard library commands.
@@ -2483,7 +5323,7 @@ const CImg<char>& gmic::uncompress_stdlib() {
       CImgList<char>::get_unserialize(CImg<unsigned char>(data_gmic_stdlib,1,size_data_gmic_stdlib,1,1,true))[0].
         move_to(stdlib);
     } catch (...) {
-      cimg::mutex(29);
+      gmic_lock_output();
       std::fprintf(cimg::output(),
                    "[gmic] %s*** Warning *** Could not uncompress G'MIC standard library, ignoring it.%s\n",
                    cimg::t_red,cimg::t_normal);
@@ -2693,6 +5533,130 @@ CImgList<char> gmic::commands_line_to_CImgList(const char *const commands_line)
   return items;
 }
 
+// Pre-parse items of a custom command code.
+//------------------------------------------
+// Same splitting rules as in 'commands_line_to_CImgList()', but items are parsed one by one.
+const char *gmic::command_item_end(const char *ptrs, bool &is_dquoted) {
+  for (is_dquoted = false; *ptrs; ++ptrs) {
+    const char c = *ptrs;
+    if (c=='\\') { if (ptrs[1]) ++ptrs; }
+    else if (c=='\"') is_dquoted = !is_dquoted;
+    else if (c==' ' && !is_dquoted) break;
+  }
+  return ptrs;
+}
+
+CImg<char> gmic::command_item(const char *ptrs, const char *const ptre) {
+  CImg<char> item((unsigned int)(ptre - ptrs) + 1);
+  bool is_dquoted = false;
+  char *ptrd = item.data(), c = 0;
+  for ( ; ptrs<ptre; ++ptrs) {
+    c = *ptrs;
+    if (c=='\\') { // If escaped character.
+      c = *(++ptrs);
+      if (!c) { c = '\\'; --ptrs; }
+      else if (c=='$') c = _dollar;
+      else if (c=='{') c = _lbrace;
+      else if (c=='}') c = _rbrace;
+      else if (c==',') c = _comma;
+      else if (c=='\"') c = _dquote;
+      else if (c==' ') c = ' ';
+      else *(ptrd++) = '\\';
+      *(ptrd++) = c;
+    } else if (is_dquoted) { // If non-escaped character inside string.
+      if (c=='\"') is_dquoted = false;
+      else if (c==1) while (c && c!=' ') c = *(++ptrs); // Discard debug info inside string.
+      else *(ptrd++) = c=='$'?_dollar:c=='{'?_lbrace:c=='}'?_rbrace:
+             c==','?_comma:c;
+    } else if (c=='\"') is_dquoted = true; // Non-escaped character outside string.
+    else *(ptrd++) = c;
+  }
+  *ptrd = 0;
+  return CImg<char>(item.data(),(unsigned int)(ptrd - item.data() + 1));
+}
+
+// Split a custom command code into a sequence of null-terminated items, each one preceded by
+// its type: 'l' (literal, followed by its raw and parsed versions) or 't' (raw string
+// containing '$', to be parsed after argument substitution).
+CImg<char> gmic::command_to_items(const char *const command_code) {
+  CImgList<char> items;
+  bool is_dquoted = false;
+  const char *ptrs = command_code;
+  while (*ptrs==' ') ++ptrs;
+  while (*ptrs) {
+    const char *const ptre = command_item_end(ptrs,is_dquoted);
+    if (is_dquoted) return CImg<char>(); // Double quotes are not closed.
+    const unsigned int l_item = (unsigned int)(ptre - ptrs);
+    const bool is_template = std::memchr(ptrs,'$',l_item)!=0;
+    CImg<char>::vector(is_template?'t':'l').move_to(items);
+    CImg<char> raw(ptrs,l_item + 1);
+    raw.back() = 0;
+    raw.move_to(items);
+    if (!is_template) command_item(ptrs,ptre).move_to(items);
+    ptrs = ptre; while (*ptrs==' ') ++ptrs;
+  }
+  return items>'x';
+}
+
+// Append parsed items of a substituted string. Return 'false' if double quotes are not closed.
+bool gmic::append_command_items(const char *const str, CImgList<char>& items) {
+  bool is_dquoted = false;
+  const char *ptrs = str;
+  while (*ptrs==' ') ++ptrs;
+  while (*ptrs) {
+    const char *const ptre = command_item_end(ptrs,is_dquoted);
+    if (is_dquoted) return false;
+    command_item(ptrs,ptre).move_to(items);
+    ptrs = ptre; while (*ptrs==' ') ++ptrs;
+  }
+  return true;
+}
+
+// Find matching terminators of blocks in a commands line.
+//--------------------------------------------------------
+// For each position p, return the position of the first unmatched item found when scanning
+// the commands line forward from p (or ~0U if not found), i.e.:
+// row 0: '-done', row 1: '-while', row 2: '-endlocal', row 3: '-onfail' or '-endlocal',
+// row 4: '-endif', row 5: '-else', '-elif' or '-endif'.
+// Row 6 gives the position of the last debug info item found before p (included).
+CImg<unsigned int> gmic::commands_line_blocks(const CImgList<char>& commands_line) {
+  const unsigned int siz = commands_line.size();
+  CImg<unsigned int> res(siz,7), stacks(siz + 1,6,1,1,~0U);
+  unsigned int repeat = 0, _do = 0, local = 0, _if = 0, last_debug = ~0U;
+  for (unsigned int p = siz; p--; ) {
+    const char *const it = commands_line[p].data();
+    if (*it=='-') switch (native_command_id(it)) {
+      case gmic_cmd_done : stacks(++repeat,0) = p; break;
+      case gmic_cmd_repeat : if (repeat) --repeat; break;
+      case gmic_cmd_while : stacks(++_do,1) = p; break;
+      case gmic_cmd_do : if (_do) --_do; break;
+      case gmic_cmd_endlocal : case gmic_cmd_endl : stacks(++local,2) = p; stacks(local,3) = ~0U; break;
+      case gmic_cmd_onfail : stacks(local,3) = p; break;
+      case gmic_cmd_endif : stacks(++_if,4) = p; stacks(_if,5) = ~0U; break;
+      case gmic_cmd_else : case gmic_cmd_elif : stacks(_if,5) = p; break;
+      case gmic_cmd_if : if (_if) --_if; else stacks(0,5) = ~0U; break;
+      default :
+        if (!std::strcmp("-local",it) || !std::strcmp("-l",it) ||
+            !std::strcmp("--local",it) || !std::strcmp("--l",it) ||
+            !std::strncmp("-local[",it,7) || !std::strncmp("-l[",it,3) ||
+            !std::strncmp("--local[",it,8) || !std::strncmp("--l[",it,4)) {
+          if (local) --local; else stacks(0,3) = ~0U;
+        }
+      }
+    res(p,0) = stacks(repeat,0);
+    res(p,1) = stacks(_do,1);
+    res(p,2) = stacks(local,2);
+    res(p,3) = stacks(local,3)!=~0U?stacks(local,3):stacks(local,2);
+    res(p,4) = stacks(_if,4);
+    res(p,5) = stacks(_if,5)!=~0U?stacks(_if,5):stacks(_if,4);
+  }
+  for (unsigned int p = 0; p<siz; ++p) {
+    if (*commands_line[p]==1) last_debug = p;
+    res(p,6) = last_debug;
+  }
+  return res;
+}
+
 // Print log message.
 //-------------------
 gmic& gmic::print(const char *format, ...) {
@@ -2707,15 +5671,13 @@ gmic& gmic::print(const char *format, ...) {
   va_end(ap);
 
   // Display message.
-  cimg::mutex(29);
+  _gmic_log_ring &ring = *(_gmic_log_ring*)log_ring;
   if (*message!='\r')
-    for (unsigned int i = 0; i<nb_carriages; ++i) std::fputc('\n',cimg::output());
+    for (unsigned int i = 0; i<nb_carriages; ++i) ring.putc('\n');
   nb_carriages = 1;
-  std::fprintf(cimg::output(),
-               "[gmic]%s %s",
-               callstack2string().data(),message.data());
-  std::fflush(cimg::output());
-  cimg::mutex(29,0);
+  ring.printf("[gmic]%s %s",
+              callstack2string().data(),message.data());
+  ring.commit();
   return *this;
 }
 
@@ -2734,22 +5696,21 @@ gmic& gmic::error(const char *const format, ...) {
   // Display message.
   const CImg<char> s_callstack = callstack2string();
   if (verbosity>=0 || is_debug) {
-    cimg::mutex(29);
+    _gmic_log_ring &ring = *(_gmic_log_ring*)log_ring;
     if (*message!='\r')
-      for (unsigned int i = 0; i<nb_carriages; ++i) std::fputc('\n',cimg::output());
+      for (unsigned int i = 0; i<nb_carriages; ++i) ring.putc('\n');
     nb_carriages = 1;
     if (debug_filename<commands_files.size() && debug_line!=~0U)
-      std::fprintf(cimg::output(),"[gmic]%s %s%s*** Error (file '%s', %sline #%u) *** %s%s",
-                   s_callstack.data(),cimg::t_red,cimg::t_bold,
-                   commands_files[debug_filename].data(),
-                   is_debug_info?"":"call from ",debug_line,message.data(),
-                   cimg::t_normal);
+      ring.printf("[gmic]%s %s%s*** Error (file '%s', %sline #%u) *** %s%s",
+                  s_callstack.data(),cimg::t_red,cimg::t_bold,
+                  commands_files[debug_filename].data(),
+                  is_debug_info?"":"call from ",debug_line,message.data(),
+                  cimg::t_normal);
     else
-      std::fprintf(cimg::output(),"[gmic]%s %s%s*** Error *** %s%s",
-                   s_callstack.data(),cimg::t_red,cimg::t_bold,
-                   message.data(),cimg::t_normal);
-    std::fflush(cimg::output());
-    cimg::mutex(29,0);
+      ring.printf("[gmic]%s %s%s*** Error *** %s%s",
+                  s_callstack.data(),cimg::t_red,cimg::t_bold,
+                  message.data(),cimg::t_normal);
+    ring.commit(true);
   }
 
   // Store detailled error message for interpreter.
@@ -2781,40 +5742,98 @@ gmic& gmic::debug(const char *format, ...) {
   va_end(ap);
 
   // Display message.
-  cimg::mutex(29);
+  _gmic_log_ring &ring = *(_gmic_log_ring*)log_ring;
   if (*message!='\r')
-    for (unsigned int i = 0; i<nb_carriages; ++i) std::fputc('\n',cimg::output());
+    for (unsigned int i = 0; i<nb_carriages; ++i) ring.putc('\n');
   nb_carriages = 1;
 
   if (debug_filename<commands_files.size() && debug_line!=~0U)
-    std::fprintf(cimg::output(),
-                 "%s<gmic>%s#%u ",
-                 cimg::t_green,callstack2string(true).data(),debug_line);
+    ring.printf("%s<gmic>%s#%u ",
+                cimg::t_green,callstack2string(true).data(),debug_line);
   else
-    std::fprintf(cimg::output(),
-                 "%s<gmic>%s ",
-                 cimg::t_green,callstack2string(true).data());
+    ring.printf("%s<gmic>%s ",
+                cimg::t_green,callstack2string(true).data());
 
   for (char *s = message; *s; ++s) {
     char c = *s;
     if (c<' ') switch (c) {
-      case _dollar : std::fprintf(cimg::output(),"\\$"); break;
-      case _lbrace : std::fprintf(cimg::output(),"\\{"); break;
-      case _rbrace : std::fprintf(cimg::output(),"\\}"); break;
-      case _comma : std::fprintf(cimg::output(),"\\,"); break;
-      case _dquote : std::fprintf(cimg::output(),"\\\""); break;
-      default : std::fputc(c,cimg::output());
+      case _dollar : ring.printf("\\$"); break;
+      case _lbrace : ring.printf("\\{"); break;
+      case _rbrace : ring.printf("\\}"); break;
+      case _comma : ring.printf("\\,"); break;
+      case _dquote : ring.printf("\\\""); break;
+      default : ring.putc(c);
       }
-    else std::fputc(c,cimg::output());
+    else ring.putc(c);
   }
-  std::fprintf(cimg::output(),
-               "%s",
-               cimg::t_normal);
-  std::fflush(cimg::output());
-  cimg::mutex(29,0);
+  ring.printf("%s",cimg::t_normal);
+  ring.commit();
   return *this;
 }
 
+// Manage numeric variables.
+//---------------------------
+// A numeric variable is stored as a '\0' followed by the binary value of a double,
+// and optionally followed by its string representation, computed only when needed.
+inline bool gmic_is_numeric_variable(const CImg<char>& value) {
+  return value._width>sizeof(double) && !*value._data;
+}
+
+inline void gmic_set_numeric_variable(CImg<char>& value, const double number) {
+  value.assign(1 + sizeof(double));
+  *value._data = 0;
+  std::memcpy(value._data + 1,&number,sizeof(double));
+}
+
+inline double gmic_numeric_variable(const CImg<char>& value) {
+  double number = 0;
+  std::memcpy(&number,value._data + 1,sizeof(double));
+  return number;
+}
+
+inline const char *gmic_variable_string(CImg<char>& value) {
+  if (!gmic_is_numeric_variable(value)) return value._data;
+  if (value._width==1 + sizeof(double)) {
+    char s[32] = { 0 };
+    cimg_snprintf(s,sizeof(s),"%.16g",gmic_numeric_variable(value));
+    const unsigned int l = (unsigned int)std::strlen(s) + 1;
+    CImg<char> nvalue(1 + sizeof(double) + l);
+    std::memcpy(nvalue._data,value._data,1 + sizeof(double));
+    std::memcpy(nvalue._data + 1 + sizeof(double),s,l);
+    nvalue.move_to(value);
+  }
+  return value._data + 1 + sizeof(double);
+}
+
+// Get value of a numeric variable, if argument is exactly '$name' or '${name}'.
+//------------------------------------------------------------------------------
+bool gmic::get_numeric_variable(const char *const argument, double &value,
+                                const unsigned int *const variables_sizes) const {
+  if (!argument || *argument!='$') return false;
+  const bool is_braces = argument[1]=='{';
+  const char *const name = argument + (is_braces?2:1), *ptr = name;
+  if ((*name>='0' && *name<='9') || (*name=='_' && name[1]=='_')) return false; // Skip thread-global variables.
+  while ((*ptr>='a' && *ptr<='z') || (*ptr>='A' && *ptr<='Z') || (*ptr>='0' && *ptr<='9') || *ptr=='_') ++ptr;
+  const unsigned int l_name = (unsigned int)(ptr - name);
+  if (!l_name || l_name>255 || (is_braces && (*ptr!='}' || ptr[1])) || (!is_braces && *ptr)) return false;
+  char _name[256];
+  std::memcpy(_name,name,l_name);
+  _name[l_name] = 0;
+  const CImg<char> *p_value = 0;
+  if (*_name=='_') {
+    const CImgList<char> &__variables = *variables[0], &__variables_names = *variables_names[0];
+    for (int l = __variables.width() - 1; l>=0 && !p_value; --l)
+      if (!std::strcmp(__variables_names[l],_name)) p_value = &__variables[l];
+  } else {
+    _gmic_variables &locals = *(_gmic_variables*)local_variables;
+    const int e = locals.find(_name,variables_sizes?*variables_sizes:0);
+    if (e>=0) p_value = &locals.values[e];
+  }
+  if (!p_value || !gmic_is_numeric_variable(*p_value)) return false;
+  value = gmic_numeric_variable(*p_value);
+  return true;
+}
+
 // Set variable in the interpreter environment.
 //---------------------------------------------
 inline gmic& gmic::set_variable(const char *const name, const char *const value,
@@ -2825,14 +5844,32 @@ inline gmic& gmic::set_variable(const char *const name, const char *const value,
   const bool
     is_global = *name=='_',
     is_thread_global = is_global && name[1]=='_';
-  if (is_thread_global) cimg::mutex(30);
-  const unsigned int hashcode = gmic::hashcode(name,true);
-  const int lind = is_global || !variables_sizes?0:(int)variables_sizes[hashcode];
+  if (is_global && (!std::strcmp(name,"_mem") || !std::strcmp(name,"_mem_peak")))
+    error("Cannot assign read-only variable '%s'.",name);
+  if (!is_global) {
+    _gmic_variables &locals = *(_gmic_variables*)local_variables;
+    ind = add_new_variable?-1:locals.find(name,variables_sizes?*variables_sizes:0);
+    if (ind>=0) CImg<char>::string(value).move_to(locals.values[ind]);
+    else { CImg<char> _value; CImg<char>::string(value).move_to(_value); locals.push(name,_value); }
+    return *this;
+  }
+  if (is_thread_global) {
+    cimg::mutex(30);
+    _gmic_atomic_variable *const atomic_variable = ((_gmic_atomic_variables*)atomic_variables)->find(name);
+    if (atomic_variable) { // Variable managed by '-atomic' (non-numeric values are set to nan).
+      double number = cimg::type<double>::nan();
+      char end;
+      if (cimg_sscanf(value,"%lf%c",&number,&end)!=1) number = cimg::type<double>::nan();
+      atomic_variable->fetch('=',number);
+      cimg::mutex(30,0);
+      return *this;
+    }
+  }
   CImgList<char>
-    &__variables = *variables[hashcode],
-    &__variables_names = *variables_names[hashcode];
+    &__variables = *variables[is_thread_global?1:0],
+    &__variables_names = *variables_names[is_thread_global?1:0];
   if (!add_new_variable)
-    for (int l = __variables.width() - 1; l>=lind; --l) if (!std::strcmp(__variables_names[l],name)) {
+    for (int l = __variables.width() - 1; l>=0; --l) if (!std::strcmp(__variables_names[l],name)) {
         is_name_found = true; ind = l; break;
       }
   if (is_name_found) CImg<char>::string(value).move_to(__variables[ind]);
@@ -2925,6 +5962,23 @@ gmic& gmic::add_commands(const char *const data_commands,
     }
   }
 
+  // Pre-parse items of the new commands, with unresolved identifiers of native commands.
+  for (unsigned int i = 0; i<512; ++i) if (pos[i]) {
+      if (commands_items[i].size()!=commands[i].size() - pos[i]) commands_items[i].assign(commands[i].size() - pos[i]);
+      if (commands_ids[i].size()!=commands[i].size() - pos[i]) commands_ids[i].assign(commands[i].size() - pos[i]);
+      for (unsigned int p = 0; p<pos[i]; ++p) {
+        command_to_items(commands[i][p]).move_to(commands_items[i],p);
+        unsigned int nb_items = 0;
+        for (const char *ptrs = commands_items[i][p], *const ptre = commands_items[i][p].end(); ptrs<ptre;
+             ++nb_items) {
+          const char kind = *(ptrs++);
+          ptrs+=std::strlen(ptrs) + 1;
+          if (kind!='t') ptrs+=std::strlen(ptrs) + 1;
+        }
+        CImg<unsigned int>(nb_items,2,1,1,~0U).move_to(commands_ids[i],p);
+      }
+    }
+
   if (is_debug) {
     CImg<unsigned int> hdist(512);
     unsigned int nb_commands = 0;
@@ -2937,6 +5991,7 @@ gmic& gmic::add_commands(const char *const data_commands,
     gmic::ellipsize(com,512,false);
     debug("%s",com.data());
   }
+  commands_version = gmic_new_commands_version();
   return *this;
 }
 
@@ -3169,17 +6224,15 @@ gmic& gmic::print(const CImgList<T>& list, const CImg<unsigned int> *const calls
   va_end(ap);
 
   // Display message.
-  cimg::mutex(29);
+  _gmic_log_ring &ring = *(_gmic_log_ring*)log_ring;
   if (*message!='\r')
-    for (unsigned int i = 0; i<nb_carriages; ++i) std::fputc('\n',cimg::output());
+    for (unsigned int i = 0; i<nb_carriages; ++i) ring.putc('\n');
   nb_carriages = 1;
   if (!callstack_selection || *callstack_selection)
-    std::fprintf(cimg::output(),
-                 "[gmic]-%u%s %s",
-                 list.size(),callstack2string(callstack_selection).data(),message.data());
-  else std::fprintf(cimg::output(),"%s",message.data());
-  std::fflush(cimg::output());
-  cimg::mutex(29,0);
+    ring.printf("[gmic]-%u%s %s",
+                list.size(),callstack2string(callstack_selection).data(),message.data());
+  else ring.printf("%s",message.data());
+  ring.commit();
   return *this;
 }
 
@@ -3200,27 +6253,24 @@ gmic& gmic::warn(const CImgList<T>& list, const CImg<unsigned int> *const callst
 
   // Display message.
   const CImg<char> s_callstack = callstack2string(callstack_selection);
-  cimg::mutex(29);
+  _gmic_log_ring &ring = *(_gmic_log_ring*)log_ring;
   if (*message!='\r')
-    for (unsigned int i = 0; i<nb_carriages; ++i) std::fputc('\n',cimg::output());
+    for (unsigned int i = 0; i<nb_carriages; ++i) ring.putc('\n');
   nb_carriages = 1;
   if (!callstack_selection || *callstack_selection) {
     if (debug_filename<commands_files.size() && debug_line!=~0U)
-      std::fprintf(cimg::output(),
-                   "[gmic]-%u%s %s%s*** Warning (file '%s', %sline #%u) *** %s%s",
-                   list.size(),s_callstack.data(),cimg::t_magenta,cimg::t_bold,
-                   commands_files[debug_filename].data(),
-                   is_debug_info?"":"call from ",debug_line,message.data(),
-                   cimg::t_normal);
+      ring.printf("[gmic]-%u%s %s%s*** Warning (file '%s', %sline #%u) *** %s%s",
+                  list.size(),s_callstack.data(),cimg::t_magenta,cimg::t_bold,
+                  commands_files[debug_filename].data(),
+                  is_debug_info?"":"call from ",debug_line,message.data(),
+                  cimg::t_normal);
     else
-      std::fprintf(cimg::output(),
-                   "[gmic]-%u%s %s%s*** Warning *** %s%s",
-                   list.size(),s_callstack.data(),cimg::t_magenta,cimg::t_bold,
-                   message.data(),cimg::t_normal);
-  } else std::fprintf(cimg::output(),"%s%s%s%s",
-                      cimg::t_magenta,cimg::t_bold,message.data(),cimg::t_normal);
-  std::fflush(cimg::output());
-  cimg::mutex(29,0);
+      ring.printf("[gmic]-%u%s %s%s*** Warning *** %s%s",
+                  list.size(),s_callstack.data(),cimg::t_magenta,cimg::t_bold,
+                  message.data(),cimg::t_normal);
+  } else ring.printf("%s%s%s%s",
+                     cimg::t_magenta,cimg::t_bold,message.data(),cimg::t_normal);
+  ring.commit();
   return *this;
 }
 
@@ -3242,26 +6292,23 @@ gmic& gmic::error(const CImgList<T>& list, const CImg<unsigned int> *const calls
   // Display message.
   const CImg<char> s_callstack = callstack2string(callstack_selection);
   if (verbosity>=0 || is_debug) {
-    cimg::mutex(29);
+    _gmic_log_ring &ring = *(_gmic_log_ring*)log_ring;
     if (*message!='\r')
-      for (unsigned int i = 0; i<nb_carriages; ++i) std::fputc('\n',cimg::output());
+      for (unsigned int i = 0; i<nb_carriages; ++i) ring.putc('\n');
     nb_carriages = 1;
     if (!callstack_selection || *callstack_selection) {
       if (debug_filename<commands_files.size() && debug_line!=~0U)
-        std::fprintf(cimg::output(),
-                     "[gmic]-%u%s %s%s*** Error (file '%s', %sline #%u) *** %s%s",
-                     list.size(),s_callstack.data(),cimg::t_red,cimg::t_bold,
-                     commands_files[debug_filename].data(),
-                     is_debug_info?"":"call from ",debug_line,message.data(),
-                     cimg::t_normal);
+        ring.printf("[gmic]-%u%s %s%s*** Error (file '%s', %sline #%u) *** %s%s",
+                    list.size(),s_callstack.data(),cimg::t_red,cimg::t_bold,
+                    commands_files[debug_filename].data(),
+                    is_debug_info?"":"call from ",debug_line,message.data(),
+                    cimg::t_normal);
       else
-        std::fprintf(cimg::output(),
-                     "[gmic]-%u%s %s%s*** Error *** %s%s",
-                     list.size(),s_callstack.data(),cimg::t_red,cimg::t_bold,
-                     message.data(),cimg::t_normal);
-    } else std::fprintf(cimg::output(),"%s",message.data());
-    std::fflush(cimg::output());
-    cimg::mutex(29,0);
+        ring.printf("[gmic]-%u%s %s%s*** Error *** %s%s",
+                    list.size(),s_callstack.data(),cimg::t_red,cimg::t_bold,
+                    message.data(),cimg::t_normal);
+    } else ring.printf("%s",message.data());
+    ring.commit(true);
   }
 
   // Store detailled error message for interpreter.
@@ -3297,36 +6344,31 @@ gmic& gmic::debug(const CImgList<T>& list, const char *format, ...) {
   va_end(ap);
 
   // Display message.
-  cimg::mutex(29);
+  _gmic_log_ring &ring = *(_gmic_log_ring*)log_ring;
   if (*message!='\r')
-    for (unsigned int i = 0; i<nb_carriages; ++i) std::fputc('\n',cimg::output());
+    for (unsigned int i = 0; i<nb_carriages; ++i) ring.putc('\n');
   nb_carriages = 1;
   if (is_debug_info && debug_filename!=~0U && debug_line!=~0U)
-    std::fprintf(cimg::output(),
-                 "%s<gmic>-%u%s#%u ",
-                 cimg::t_green,list.size(),callstack2string(true).data(),debug_line);
+    ring.printf("%s<gmic>-%u%s#%u ",
+                cimg::t_green,list.size(),callstack2string(true).data(),debug_line);
   else
-    std::fprintf(cimg::output(),
-                 "%s<gmic>-%u%s ",
-                 cimg::t_green,list.size(),callstack2string(true).data());
+    ring.printf("%s<gmic>-%u%s ",
+                cimg::t_green,list.size(),callstack2string(true).data());
   for (char *s = message; *s; ++s) {
     char c = *s;
     if (c<' ') {
       switch (c) {
-      case _dollar : std::fprintf(cimg::output(),"\\$"); break;
-      case _lbrace : std::fprintf(cimg::output(),"\\{"); break;
-      case _rbrace : std::fprintf(cimg::output(),"\\}"); break;
-      case _comma : std::fprintf(cimg::output(),"\\,"); break;
-      case _dquote : std::fprintf(cimg::output(),"\\\""); break;
-      default : std::fputc(c,cimg::output());
+      case _dollar : ring.printf("\\$"); break;
+      case _lbrace : ring.printf("\\{"); break;
+      case _rbrace : ring.printf("\\}"); break;
+      case _comma : ring.printf("\\,"); break;
+      case _dquote : ring.printf("\\\""); break;
+      default : ring.putc(c);
       }
-    } else std::fputc(c,cimg::output());
+    } else ring.putc(c);
   }
-  std::fprintf(cimg::output(),
-               "%s",
-               cimg::t_normal);
-  std::fflush(cimg::output());
-  cimg::mutex(29,0);
+  ring.printf("%s",cimg::t_normal);
+  ring.commit();
   return *this;
 }
 
@@ -3373,12 +6415,15 @@ template<typename T>
 gmic& gmic::remove_images(CImgList<T> &images, CImgList<char> &images_names,
                           const CImg<unsigned int>& selection,
                           const unsigned int start, const unsigned int end) {
+  _gmic_buffer_pool &pool = *(_gmic_buffer_pool*)buffer_pool;
   if (start==0 && end==(unsigned int)selection.height() - 1 && selection.height()==images.width()) {
+    cimglist_for(images,l) pool.give(images[l]);
     images.assign();
     images_names.assign();
   } else for (int l = (int)end; l>=(int)start; ) {
       unsigned int eind = selection[l--], ind = eind;
       while (l>=(int)start && selection[l]==ind - 1) ind = selection[l--];
+      for (unsigned int i = ind; i<=eind; ++i) pool.give(images[i]);
       images.remove(ind,eind); images_names.remove(ind,eind);
     }
   return *this;
@@ -3426,11 +6471,19 @@ void gmic::_gmic(const char *const commands_line,
     commands_names[l].assign();
     commands[l].assign();
     commands_has_arguments[l].assign();
+    commands_items[l].assign();
+    commands_ids[l].assign();
+  }
+  commands_version = gmic_new_commands_version();
+  for (unsigned int l = 0; l<2; ++l) {
     _variables[l].assign();
     variables[l] = &_variables[l];
     _variables_names[l].assign();
     variables_names[l] = &_variables_names[l];
   }
+  atomic_variables = _atomic_variables;
+  mapped_files = _mapped_files;
+  ((_gmic_variables*)local_variables)->pop(0);
   if (include_stdlib) add_commands(gmic::uncompress_stdlib().data());
   add_commands(custom_commands);
 
@@ -3457,6 +6510,8 @@ void gmic::_gmic(const char *const commands_line,
 
   set_variable("_path_rc",gmic::path_rc(),true);
   set_variable("_path_user",gmic::path_user(),true);
+  gmic_init_parallel_thresholds();
+  gmic_add_instance();
 
 #ifdef cimg_use_vt100
   set_variable("_vt100","1",true);
@@ -3492,6 +6547,7 @@ gmic& gmic::print_images(const CImgList<T>& images, const CImgList<char>& images
     print(images,0,"Print image%s = '%s'.\n",
           gmic_selection.data(),gmic_names.data());
   }
+  if (is_verbose) gmic_flush_log(); // Image properties are printed directly by 'CImg<T>::gmic_print()'.
   if (is_verbose) cimg_forY(selection,l) {
       const unsigned int uind = selection[l];
       const CImg<T>& img = images[uind];
@@ -3510,6 +6566,33 @@ gmic& gmic::print_images(const CImgList<T>& images, const CImgList<char>& images
   return *this;
 }
 
+// Print memory profile of commands (sorted by decreasing peaks).
+//----------------------------------------------------------------
+template<typename T>
+gmic& gmic::print_memory_profile(const CImgList<T>& images) {
+  const _gmic_memory_profile &profile = *(_gmic_memory_profile*)memory_profile;
+  unsigned long long current, peak;
+  gmic_memory_stats(gmic_list_size(images),current,peak);
+  char s_current[16], s_peak[16], s_increase[16], s_list[16];
+  print(images,0,"Memory profile: %s currently allocated, peak %s (image lists only).",
+        gmic_memory_size(current,s_current),gmic_memory_size(peak,s_peak));
+  if (!profile.siz) return *this;
+  CImg<unsigned int> permutations;
+  CImg<double>(profile.stats.get_crop(1,0,1,profile.siz - 1)).sort(permutations,false);
+  const unsigned int nb_printed = cimg::min(profile.siz,32U);
+  for (unsigned int l = 0; l<nb_printed; ++l) {
+    const unsigned int i = permutations[l];
+    const unsigned long long *const ptr = profile.stats.data(0,i);
+    print(images,0,"  %s: %u call%s, peak %s, max. increase %s, max. image list %s.",
+          profile.names[i].data(),(unsigned int)ptr[0],ptr[0]>1?"s":"",
+          gmic_memory_size(ptr[1],s_peak),gmic_memory_size(ptr[2],s_increase),
+          gmic_memory_size(ptr[3],s_list));
+  }
+  if (profile.siz>nb_printed) print(images,0,"  (%u more command%s).",
+                                    profile.siz - nb_printed,profile.siz - nb_printed>1?"s":"");
+  return *this;
+}
+
 // Display selected images.
 //-------------------------
 template<typename T>
@@ -3527,7 +6610,7 @@ gmic& gmic::display_images(const CImgList<T>& images, const CImgList<char>& imag
 #if cimg_display==0
   print(images,0,"Display image%s",gmic_selection.data());
   if (is_verbose) {
-    cimg::mutex(29);
+    gmic_lock_output();
     if (XYZ) std::fprintf(cimg::output(),", from point (%u,%u,%u)",XYZ[0],XYZ[1],XYZ[2]);
     std::fprintf(cimg::output()," (console output only, no display support).\n");
     std::fflush(cimg::output());
@@ -3541,7 +6624,7 @@ gmic& gmic::display_images(const CImgList<T>& images, const CImgList<char>& imag
   } catch (CImgDisplayException&) {
     print(images,0,"Display image%s",gmic_selection.data());
     if (is_verbose) {
-      cimg::mutex(29);
+      gmic_lock_output();
       if (XYZ) std::fprintf(cimg::output(),", from point (%u,%u,%u)",XYZ[0],XYZ[1],XYZ[2]);
       std::fprintf(cimg::output()," (console output only, no display available).\n");
       std::fflush(cimg::output());
@@ -3575,7 +6658,7 @@ gmic& gmic::display_images(const CImgList<T>& images, const CImgList<char>& imag
 
   print(images,0,"Display image%s = '%s'",gmic_selection.data(),gmic_names.data());
   if (is_verbose) {
-    cimg::mutex(29);
+    gmic_lock_output();
     if (XYZ) std::fprintf(cimg::output(),", from point (%u,%u,%u).\n",XYZ[0],XYZ[1],XYZ[2]);
     else std::fprintf(cimg::output(),".\n");
     std::fflush(cimg::output());
@@ -3660,7 +6743,7 @@ gmic& gmic::display_plots(const CImgList<T>& images, const CImgList<char>& image
     const CImg<T>& img = images[uind];
     if (img) {
       if (is_verbose && !is_first_line) {
-        cimg::mutex(29);
+        gmic_lock_output();
         std::fputc('\n',cimg::output());
         std::fflush(cimg::output());
         cimg::mutex(29,0);
@@ -3769,15 +6852,20 @@ CImg<char> gmic::substitute_item(const char *const source,
   CImgDisplay *const _display_window = (CImgDisplay*)display_window;
 #endif
   if (!source) return CImg<char>();
-  CImg<char> substituted_items, inbraces, substr(40);
+  if (!std::strchr(source,'{') && !std::strchr(source,'$'))
+    return CImg<char>(source,(unsigned int)std::strlen(source) + 1);
+  _gmic_frame<_gmic_substitution_frame> frame(*(_gmic_substitution_frames*)substitution_frames);
+  _gmic_substitution_frame &substituted_items = frame.frame;
+  CImg<char> &inbraces = substituted_items.inbraces, &substr = substituted_items.substr;
   CImg<unsigned int> _ind;
+  substituted_items.siz = 0;
 
   for (const char *nsource = source; *nsource; )
     if (*nsource!='{' && *nsource!='$') {
       // If not starting with '{', or '$'.
       const char *const nsource0 = nsource;
       do { ++nsource; } while (*nsource && *nsource!='{' && *nsource!='$');
-      CImg<char>(nsource0,(unsigned int)(nsource - nsource0),1,1,1,true).append_string_to(substituted_items);
+      substituted_items.append(nsource0,(unsigned int)(nsource - nsource0));
     } else { // '{...}' or '${...}' expression found.
       bool is_braces = false, is_substituted = false;
       int ind = 0, l_inbraces = 0;
@@ -3791,7 +6879,7 @@ CImg<char> gmic::substitute_item(const char *const source,
         const char *const ptr_beg = nsource + 1, *ptr_end = ptr_beg;
         unsigned int p = 0;
         for (p = 1; p>0 && *ptr_end; ++ptr_end) { if (*ptr_end=='{') ++p; if (*ptr_end=='}') --p; }
-        if (p) { CImg<char>(nsource++,1).append_string_to(substituted_items); continue; }
+        if (p) { substituted_items.append(nsource++,1); continue; }
         l_inbraces = (int)(ptr_end - ptr_beg - 1);
 
         if (l_inbraces>0) {
@@ -3946,9 +7034,9 @@ CImg<char> gmic::substitute_item(const char *const source,
             inbraces[inbraces.width() - 2] = 0;
             for (*substr = 0, cimg::strunescape(inbraces); *s; ++s) {
               cimg_snprintf(substr,substr.width(),"%d,",(int)(unsigned char)*s);
-              CImg<char>(substr.data(),(unsigned int)std::strlen(substr)).append_string_to(substituted_items);
+              substituted_items.append(substr.data());
             }
-            if (*substr) --(substituted_items._width);
+            if (*substr) --substituted_items.siz;
           }
           *substr = 0; is_substituted = true;
         }
@@ -3961,7 +7049,8 @@ CImg<char> gmic::substitute_item(const char *const source,
             cimg_for(inbraces,p,char) if (*p==',') ++nb_values;
             inbraces[inbraces.width() - 2] = 0;
             try {
-              CImg<char>(nb_values,1,1,1).fill(inbraces.data() + 1,false,false).append_string_to(substituted_items);
+              const CImg<char> values = CImg<char>(nb_values,1,1,1).fill(inbraces.data() + 1,false,false);
+              substituted_items.append(values.data(),values._width);
               is_substituted = true;
             } catch (CImgException &e) {
               const char *const e_ptr = std::strstr(e.what(),": ");
@@ -4023,6 +7112,8 @@ CImg<char> gmic::substitute_item(const char *const source,
             while (*feature!=',') ++feature; ++feature;
           } else ind = images.width() - 1;
 
+          _gmic_compact_pending &compacts = *(_gmic_compact_pending*)compact_pending;
+          if (ind>=0 && compacts.is_used) compacts.uncompact(images,ind,~0U);
           CImg<T> &img = ind>=0?gmic_check(images[ind]):CImg<T>::empty();
           *substr = 0;
           if (!*feature)
@@ -4093,7 +7184,7 @@ CImg<char> gmic::substitute_item(const char *const source,
                   _text = CImg<T>(img.data(),strsiz,1,1,1,true);
                   text.back() = 0;
                   strreplace_bw(text);
-                  _text.append_string_to(substituted_items);
+                  substituted_items.append(_text.data(),_text._width);
                 }
               }
               *substr = 0; is_substituted = true;
@@ -4113,7 +7204,7 @@ CImg<char> gmic::substitute_item(const char *const source,
               break;
             case '^' : { // Sequence of all pixel values.
               CImg<char> vs = img.value_string(',');
-              if (vs && *vs) vs.resize(vs.width() - 1,1,1,1,0).append_string_to(substituted_items);
+              if (vs && *vs) substituted_items.append(vs.data(),vs._width - 1);
               *substr = 0; is_substituted = true;
             } break;
             }
@@ -4146,9 +7237,10 @@ CImg<char> gmic::substitute_item(const char *const source,
               verbosity = _verbosity; is_debug = _is_debug;
               cimg_foroff(values,p) {
                 cimg_snprintf(substr,substr.width(),"%.16g",(double)values[p]);
-                CImg<char>::string(substr).append_string_to(substituted_items).back() = ',';
+                substituted_items.append(substr.data());
+                substituted_items.append(",",1);
               }
-              if (values) --(substituted_items._width);
+              if (values) --substituted_items.siz;
             }
             *substr = 0; is_substituted = true;
           }
@@ -4157,7 +7249,7 @@ CImg<char> gmic::substitute_item(const char *const source,
             const bool is_rounded = *feature=='_';
             if (is_rounded) ++feature;
             try {
-              const double res = img.eval(feature);
+              const double res = ((_gmic_math_cache*)math_cache)->eval(img,feature);
               if (is_rounded) cimg_snprintf(substr,substr.width(),"%g",res);
               else cimg_snprintf(substr,substr.width(),"%.16g",res);
               is_substituted = true;
@@ -4170,14 +7262,14 @@ CImg<char> gmic::substitute_item(const char *const source,
           }
         }
         if (is_substituted && *substr)
-          CImg<char>(substr.data(),(unsigned int)std::strlen(substr)).append_string_to(substituted_items);
+          substituted_items.append(substr.data());
         continue;
 
         //  '${..}' expressions.
       } else if (nsource[1]=='{') {
         const char *const ptr_beg = nsource + 2, *ptr_end = ptr_beg; unsigned int p = 0;
         for (p = 1; p>0 && *ptr_end; ++ptr_end) { if (*ptr_end=='{') ++p; if (*ptr_end=='}') --p; }
-        if (p) { CImg<char>(nsource++,1).append_string_to(substituted_items); continue; }
+        if (p) { substituted_items.append(nsource++,1); continue; }
         l_inbraces = (int)(ptr_end - ptr_beg - 1);
         if (l_inbraces>0) {
           inbraces.assign(ptr_beg,l_inbraces + 1).back() = 0;
@@ -4190,24 +7282,27 @@ CImg<char> gmic::substitute_item(const char *const source,
       // Substitute '$!' -> Number of images in the list.
       if (nsource[1]=='!') {
         cimg_snprintf(substr,substr.width(),"%u",images.size());
-        CImg<char>(substr.data(),(unsigned int)std::strlen(substr)).append_string_to(substituted_items);
+        substituted_items.append(substr.data());
         nsource+=2;
 
         // Substitute '$^' -> Verbosity level.
       } else if (nsource[1]=='^') {
         cimg_snprintf(substr,substr.width(),"%d",verbosity);
-        CImg<char>(substr.data(),(unsigned int)std::strlen(substr)).append_string_to(substituted_items);
+        substituted_items.append(substr.data());
         nsource+=2;
 
         // Substitute '$|' -> Timer value.
       } else if (nsource[1]=='|') {
         cimg_snprintf(substr,substr.width(),"%g",(cimg::time() - reference_time)/1000.);
-        CImg<char>(substr.data(),(unsigned int)std::strlen(substr)).append_string_to(substituted_items);
+        substituted_items.append(substr.data());
         nsource+=2;
 
         // Substitute '$/' -> Current call stack.
       } else if (nsource[1]=='/') {
-        cimglist_for(callstack,i) callstack[i].append_string_to(substituted_items).back() = '/';
+        cimglist_for(callstack,i) {
+          substituted_items.append(callstack[i].data(),callstack[i]._width - 1);
+          substituted_items.append("/",1);
+        }
         nsource+=2;
 
         // Substitute '$>' and '$<' -> Forward/backward indice of current loop.
@@ -4218,7 +7313,7 @@ CImg<char> gmic::substitute_item(const char *const source,
                 nsource[1]);
         const CImg<unsigned int> &rd = repeatdones.back();
         cimg_snprintf(substr,substr.width(),"%u",nsource[1]=='>'?rd[2]:rd[1] - 1);
-        CImg<char>(substr.data(),(unsigned int)std::strlen(substr)).append_string_to(substituted_items);
+        substituted_items.append(substr.data());
         nsource+=2;
 
         // Substitute '$name' and '${name}' -> Variable, image indice or environment variable.
@@ -4228,26 +7323,41 @@ CImg<char> gmic::substitute_item(const char *const source,
                   (cimg_sscanf(nsource + 1,"%255[a-zA-Z0-9_]",substr.assign(256).data())==1)) &&
                  (*substr<'0' || *substr>'9')) {
         const CImg<char>& name = is_braces?inbraces:substr;
-        const unsigned int
-          hashcode = gmic::hashcode(name,true),
-          l_name = is_braces?l_inbraces + 3:std::strlen(name) + 1;
+        const unsigned int l_name = is_braces?l_inbraces + 3:std::strlen(name) + 1;
         const bool
           is_global = *name=='_',
-          is_thread_global = is_global && name[1]=='_';
-        const int lind = is_global?0:(int)variables_sizes[hashcode];
-        if (is_thread_global) cimg::mutex(30);
-        const CImgList<char>
-          &__variables = *variables[hashcode],
-          &__variables_names = *variables_names[hashcode];
-        bool is_name_found = false;
-        for (int l = __variables.width() - 1; l>=lind; --l)
-          if (!std::strcmp(__variables_names[l],name)) {
-            is_name_found = true; ind = l; break;
-          }
-        if (is_name_found) {
-          if (__variables[ind].size()>1)
-            CImg<char>(__variables[ind].data(),__variables[ind].size() - 1).
-              append_string_to(substituted_items);
+          is_thread_global = is_global && name[1]=='_',
+          is_memory = is_global && (!std::strcmp(name,"_mem") || !std::strcmp(name,"_mem_peak"));
+        _gmic_atomic_variable *const atomic_variable =
+          is_thread_global?((_gmic_atomic_variables*)atomic_variables)->find(name):0;
+        if (is_thread_global && !atomic_variable) cimg::mutex(30);
+        CImg<char> *p_value = 0;
+        if (atomic_variable || is_memory) {} // Values of atomic and memory variables are read without lock.
+        else if (is_global) {
+          CImgList<char>
+            &__variables = *variables[is_thread_global?1:0],
+            &__variables_names = *variables_names[is_thread_global?1:0];
+          for (int l = __variables.width() - 1; l>=0 && !p_value; --l)
+            if (!std::strcmp(__variables_names[l],name)) p_value = &__variables[l];
+        } else {
+          _gmic_variables &locals = *(_gmic_variables*)local_variables;
+          const int e = locals.find(name,*variables_sizes);
+          if (e>=0) p_value = &locals.values[e];
+        }
+        bool is_name_found = p_value!=0 || atomic_variable || is_memory;
+        if (is_memory) { // Read-only variables '_mem' and '_mem_peak' (image list sizes, see '-memory_profile').
+          unsigned long long current, peak;
+          gmic_memory_stats(gmic_list_size(images),current,peak);
+          char s_value[32];
+          cimg_snprintf(s_value,sizeof(s_value),"%.16g",(double)(name[4]?peak:current));
+          substituted_items.append(s_value);
+        } else if (atomic_variable) {
+          char s_value[32];
+          cimg_snprintf(s_value,sizeof(s_value),"%.16g",atomic_variable->get());
+          substituted_items.append(s_value);
+        } else if (is_name_found) {
+          const char *const value = gmic_variable_string(*p_value);
+          substituted_items.append(value);
         } else {
           for (int l = images.width() - 1; l>=0; --l)
             if (images_names[l] && !std::strcmp(images_names[l],name)) {
@@ -4255,13 +7365,13 @@ CImg<char> gmic::substitute_item(const char *const source,
             }
           if (is_name_found) {
             cimg_snprintf(substr,substr.width(),"%d",ind);
-            CImg<char>(substr.data(),(unsigned int)std::strlen(substr)).append_string_to(substituted_items);
+            substituted_items.append(substr.data());
           } else {
             const char *const s_env = std::getenv(name);
-            if (s_env) CImg<char>(s_env,(unsigned int)std::strlen(s_env)).append_string_to(substituted_items);
+            if (s_env) substituted_items.append(s_env);
           }
         }
-        if (is_thread_global) cimg::mutex(30,0);
+        if (is_thread_global && !atomic_variable) cimg::mutex(30,0);
         nsource+=l_name;
 
         // Substitute '${"-command"}' -> Status value after command execution.
@@ -4272,25 +7382,237 @@ CImg<char> gmic::substitute_item(const char *const source,
             ncommands_line = commands_line_to_CImgList(strreplace_fw(inbraces));
           unsigned int nposition = 0;
           CImg<char>::string("*substitute").move_to(callstack);
-          CImg<unsigned int> nvariables_sizes(512);
-          cimg_forX(nvariables_sizes,l) nvariables_sizes[l] = variables[l]->size();
+          _gmic_variables &locals = *(_gmic_variables*)local_variables;
+          const unsigned int nvariables_sizes = locals.siz;
           _run(ncommands_line,nposition,images,images_names,parent_images,parent_images_names,
-               nvariables_sizes,0,inbraces);
-          for (unsigned int l = 0; l<nvariables_sizes._width - 2; ++l) if (variables[l]->size()>nvariables_sizes[l]) {
-              variables_names[l]->remove(nvariables_sizes[l],variables[l]->size() - 1);
-              variables[l]->remove(nvariables_sizes[l],variables[l]->size() - 1);
-            }
+               &nvariables_sizes,0,inbraces);
+          locals.pop(nvariables_sizes);
           callstack.remove();
           is_return = false;
         }
         if (status.width()>1)
-          CImg<char>(status.data(),(unsigned int)std::strlen(status)).append_string_to(substituted_items);
+          substituted_items.append(status.data());
 
         // Replace '$' by itself.
-      } else CImg<char>(nsource++,1).append_string_to(substituted_items);
+      } else substituted_items.append(nsource++,1);
+    }
+  CImg<char> res(substituted_items.siz + 1);
+  if (substituted_items.siz) std::memcpy(res._data,substituted_items.items._data,substituted_items.siz);
+  res.back() = 0;
+  return res;
+}
+
+// Substitute arguments of a custom command in a string.
+//-------------------------------------------------------
+template<typename T>
+CImg<char> gmic::substitute_arguments(const char *const source, const char *const custom_command,
+                                      const char *const argument, CImgList<char>& arguments,
+                                      unsigned int& nb_arguments, bool& has_arguments,
+                                      const CImg<unsigned int>& selection,
+                                      const CImgList<T>& images, const CImgList<char>& images_names) {
+  const char *const source_back = source + std::strlen(source);
+  CImgList<char> substituted_items;
+  CImg<char> inbraces, title(256), gmic_selection;
+  char sep = 0;
+
+  for (const char *nsource = source; *nsource;)
+    if (*nsource!='$') {
+
+      // If not starting with '$'.
+      const char *const nsource0 = nsource;
+      nsource = std::strchr(nsource0,'$');
+      if (!nsource) nsource = source_back;
+      CImg<char>(nsource0,(unsigned int)(nsource - nsource0)).move_to(substituted_items);
+    } else { // '$' expression found.
+      CImg<char> substr(324);
+      inbraces.assign(1,1,1,1,0);
+      int ind = 0, ind1 = 0, l_inbraces = 0;
+      bool is_braces = false;
+      sep = 0;
+
+      if (nsource[1]=='{') {
+        const char *const ptr_beg = nsource + 2, *ptr_end = ptr_beg;
+        unsigned int p = 0;
+        for (p = 1; p>0 && *ptr_end; ++ptr_end) {
+          if (*ptr_end=='{') ++p;
+          if (*ptr_end=='}') --p;
+        }
+        if (p) { CImg<char>(nsource++,1).move_to(substituted_items); continue; }
+        l_inbraces = (int)(ptr_end - ptr_beg - 1);
+        if (l_inbraces>0) inbraces.assign(ptr_beg,l_inbraces + 1).back() = 0;
+        is_braces = true;
+      }
+
+      // Substitute $? -> string describing image indices.
+      if (nsource[1]=='?') {
+        nsource+=2;
+        selection2string(selection,images_names,1,true,gmic_selection);
+        cimg_snprintf(substr,substr.width(),"%s",gmic_selection.data());
+        CImg<char>(substr.data(),(unsigned int)std::strlen(substr)).move_to(substituted_items);
+
+        // Substitute $# -> maximum indice of known arguments.
+      } else if (nsource[1]=='#') {
+        nsource+=2;
+        cimg_snprintf(substr,substr.width(),"%u",nb_arguments);
+        CImg<char>(substr.data(),(unsigned int)std::strlen(substr)).move_to(substituted_items);
+        has_arguments = true;
+
+        // Substitute $* -> copy of the specified arguments string.
+      } else if (nsource[1]=='*') {
+        nsource+=2;
+        CImg<char>(argument,(unsigned int)std::strlen(argument)).move_to(substituted_items);
+        has_arguments = true;
+
+        // Substitute $"*" -> copy of the specified "quoted" arguments string.
+      } else if (nsource[1]=='\"' && nsource[2]=='*' && nsource[3]=='\"') {
+        nsource+=4;
+        for (unsigned int i = 1; i<=nb_arguments; ++i) {
+          CImg<char>(1,1,1,1,'\"').move_to(substituted_items);
+          CImg<char>(arguments[i].data(),arguments[i].width() - 1).
+            move_to(substituted_items);
+          if (i==nb_arguments) CImg<char>(1,1,1,1,'\"').move_to(substituted_items);
+          else CImg<char>(2,1,1,1,'\"',',').move_to(substituted_items);
+        }
+        has_arguments = true;
+
+        // Substitute $= -> transfer (quoted) arguments to named variables.
+      } else if (nsource[1]=='=' &&
+                 cimg_sscanf(nsource + 2,"%255[a-zA-Z0-9_]",title)==1 &&
+                 (*title<'0' || *title>'9')) {
+        nsource+=2 + std::strlen(title);
+        for (unsigned int i = 0; i<=nb_arguments; ++i) {
+          cimg_snprintf(substr,substr.width()," %s%u=\"",title,i);
+          CImg<char>(substr.data(),(unsigned int)std::strlen(substr)).move_to(substituted_items);
+          CImg<char>(arguments[i].data(),arguments[i].width() - 1).
+            move_to(substituted_items);
+          CImg<char>(2,1,1,1,'\"',' ').move_to(substituted_items);
+        }
+        has_arguments = true;
+
+        // Substitute $i and ${i} -> value of the i^th argument.
+      } else if ((cimg_sscanf(nsource,"$%d",&ind)==1 ||
+                  (cimg_sscanf(nsource,"${%d%c",&ind,&sep)==2 && sep=='}'))) {
+        const int nind = ind + (ind<0?(int)nb_arguments + 1:0);
+        if ((nind<=0 && ind) || nind>=arguments.width() || !arguments[nind]) {
+          error(images,0,custom_command,
+                "Command '-%s': Undefined argument '$%d', in expression '$%s%d%s' "
+                "(for %u argument%s specified).",
+                custom_command,ind,sep=='}'?"{":"",ind,sep=='}'?"}":"",
+                nb_arguments,nb_arguments!=1?"s":"");
+        }
+        nsource+=cimg_snprintf(substr,substr.width(),"$%d",ind) + (sep=='}'?2:0);
+        if (arguments[nind].width()>1)
+          CImg<char>(arguments[nind].data(),arguments[nind].width() - 1).
+            move_to(substituted_items);
+        if (nind!=0) has_arguments = true;
+
+        // Substitute ${i=$j} -> value of the i^th argument, or the default value,
+        // i.e. the value of another argument.
+      } else if (cimg_sscanf(nsource,"${%d=$%d%c",&ind,&ind1,&sep)==3 && sep=='}' &&
+                 ind>0) {
+        const int nind1 = ind1 + (ind1<0?(int)nb_arguments + 1:0);
+        if (nind1<=0 || nind1>=arguments.width() || !arguments[nind1])
+          error(images,0,custom_command,
+                "Command '-%s': Undefined argument '$%d', in expression '${%d=$%d}' "
+                "(for %u argument%s specified).",
+                custom_command,ind1,ind,ind1,
+                nb_arguments,nb_arguments!=1?"s":"");
+        nsource+=cimg_snprintf(substr,substr.width(),"${%d=$%d}",ind,ind1);
+        if (ind>=arguments.width()) arguments.insert(2 + 2*ind - arguments.size());
+        if (!arguments[ind]) {
+          arguments[ind] = arguments[nind1];
+          if (ind>(int)nb_arguments) nb_arguments = (unsigned int)ind;
+        }
+        if (arguments[ind].width()>1)
+          CImg<char>(arguments[ind].data(),arguments[ind].width() - 1).
+            move_to(substituted_items);
+        has_arguments = true;
+
+        // Substitute ${i=$#} -> value of the i^th argument, or the default value,
+        // i.e. the maximum indice of known arguments.
+      } else if (cimg_sscanf(nsource,"${%d=$#%c",&ind,&sep)==2 && sep=='}' &&
+                 ind>0) {
+        if (ind>=arguments.width()) arguments.insert(2 + 2*ind - arguments.size());
+        if (!arguments[ind]) {
+          cimg_snprintf(substr,substr.width(),"%u",nb_arguments);
+          CImg<char>::string(substr).move_to(arguments[ind]);
+          if (ind>(int)nb_arguments) nb_arguments = (unsigned int)ind;
+        }
+        nsource+=cimg_snprintf(substr,substr.width(),"${%d=$#}",ind);
+        if (arguments[ind].width()>1)
+          CImg<char>(arguments[ind].data(),arguments[ind].width() - 1).
+            move_to(substituted_items);
+        has_arguments = true;
+
+        // Substitute ${i=default} -> value of the i^th argument,
+        // or the specified default value.
+      } else if (cimg_sscanf(inbraces,"%d%c",&ind,&sep)==2 && sep=='=' &&
+                 ind>0) {
+        nsource+=l_inbraces + 3;
+        if (ind>=arguments.width()) arguments.insert(2 + 2*ind - arguments.size());
+        if (!arguments[ind]) {
+          CImg<char>::string(inbraces.data() +
+                             cimg_snprintf(substr,substr.width(),"%d=",ind)).
+            move_to(arguments[ind]);
+          if (ind>(int)nb_arguments) nb_arguments = (unsigned int)ind;
+        }
+        if (arguments[ind].width()>1)
+          CImg<char>(arguments[ind].data(),arguments[ind].width() - 1).
+            move_to(substituted_items);
+        has_arguments = true;
+
+        // Substitute any other expression starting by '$'.
+      } else {
+
+        // Substitute ${subset} -> values of the selected subset of arguments,
+        // separated by ','.
+        if (is_braces) {
+          if ((*inbraces>='a' && *inbraces<='z') ||
+              (*inbraces>='A' && *inbraces<='Z') ||
+              *inbraces=='_' || !*inbraces ||
+              std::strchr(inbraces,' ')) {
+            CImg<char>(nsource++,1).move_to(substituted_items);
+          } else {
+            CImg<unsigned int> inds;
+            const int _verbosity = verbosity;
+            const bool _is_debug = is_debug;
+            bool is_valid_subset = true;
+            verbosity = -16384; is_debug = false;
+            CImg<char> _status;
+            status.move_to(_status); // Save status because 'selection2cimg' can change it.
+            try {
+              inds = selection2cimg(inbraces,nb_arguments + 1,
+                                    CImgList<char>::empty(),"",false,
+                                    false,CImg<char>::empty());
+            } catch (...) { inds.assign(); is_valid_subset = false; }
+            _status.move_to(status);
+            verbosity = _verbosity; is_debug = _is_debug;
+            if (is_valid_subset) {
+              nsource+=l_inbraces + 3;
+              if (inds) {
+                cimg_forY(inds,j) {
+                  const unsigned int uind = inds[j];
+                  if (uind) has_arguments = true;
+                  if (!arguments[uind])
+                    error(images,0,custom_command,
+                          "Command '-%s': Undefined argument '$%d', "
+                          "in expression '${%s}'.",
+                          custom_command,uind,inbraces.data());
+                  substituted_items.insert(arguments[uind]);
+                  substituted_items.back().back() = ',';
+                }
+                if (substituted_items.back().width()>1)
+                  --(substituted_items.back()._width);
+                else substituted_items.remove();
+                has_arguments = true;
+              }
+            } else CImg<char>(nsource++,1).move_to(substituted_items);
+          }
+        } else CImg<char>(nsource++,1).move_to(substituted_items);
+      }
     }
-  substituted_items.resize(substituted_items.width() + 1,1,1,1,0);
-  return substituted_items;
+  CImg<char>::vector(0).move_to(substituted_items);
+  return substituted_items>'x';
 }
 
 // Main parsing procedures.
@@ -4326,7 +7648,7 @@ template<typename T>
 gmic& gmic::_run(const gmic_list<char>& commands_line,
                  gmic_list<T> &images, gmic_list<char> &images_names,
                  float *const p_progress, bool *const p_is_abort) {
-  CImg<unsigned int> variables_sizes(512,1,1,1,0);
+  const unsigned int variables_sizes = 0;
   unsigned int position = 0;
   setlocale(LC_NUMERIC,"C");
   callstack.assign(1U);
@@ -4351,7 +7673,25 @@ gmic& gmic::_run(const gmic_list<char>& commands_line,
   is_abort_thread = false;
   *progress = -1;
   cimglist_for(commands_line,l) if (!std::strcmp("-debug",commands_line[l].data())) { is_debug = true; break; }
-  return _run(commands_line,position,images,images_names,images,images_names,variables_sizes,0,0);
+  if (is_debug) ((_gmic_memory_profile*)memory_profile)->start();
+#ifdef gmic_main
+  // The command-line tool discards its images after running: mappings are released with the interpreter.
+  return _run(commands_line,position,images,images_names,images,images_names,&variables_sizes,0,0);
+#else // #ifdef gmic_main
+  // The caller keeps the image list: make actual copies of the images of mapped files before releasing them.
+  // Pending log records are written before returning, as the caller may close the output stream.
+  _gmic_mapped_files &mapped = *(_gmic_mapped_files*)mapped_files;
+  try {
+    _run(commands_line,position,images,images_names,images,images_names,&variables_sizes,0,0);
+  } catch (...) {
+    mapped.release(images);
+    gmic_flush_log();
+    throw;
+  }
+  mapped.release(images);
+  gmic_flush_log();
+  return *this;
+#endif // #ifdef gmic_main
 }
 
 template<typename T>
@@ -4359,7 +7699,8 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                  CImgList<T>& images, CImgList<char>& images_names,
                  CImgList<T>& parent_images, CImgList<char>& parent_images_names,
                  const unsigned int *const variables_sizes,
-                 bool *const is_noarg, const char *const parent_arguments) {
+                 bool *const is_noarg, const char *const parent_arguments,
+                 CImg<unsigned int> *const p_commands_info) {
 
 #if cimg_display!=0
   CImgDisplay *const _display_window = (CImgDisplay*)display_window;
@@ -4369,9 +7710,17 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                         callstack.back().data());
     return *this;
   }
+
+  // Info cached for each item of the commands line (shared with nested local environments).
+  CImg<unsigned int> _commands_info;
+  CImg<unsigned int>& commands_info = p_commands_info?*p_commands_info:
+    _commands_info.assign(commands_line._width,2,1,1,~0U);
   typedef typename cimg::superset<T,float>::type Tfloat;
   typedef typename cimg::superset<T,long>::type Tlong;
   const unsigned int initial_callstack_size = callstack.size(), initial_debug_line = debug_line;
+  _gmic_compact_pending &compacts = *(_gmic_compact_pending*)compact_pending;
+  const _gmic_compact_scope compact_scope(compacts,&images,initial_callstack_size);
+  _gmic_memory_window memory_window;
 
   CImgList<st_gmic_parallel<T> > threads_data;
   CImgList<unsigned int> primitives;
@@ -4391,11 +7740,15 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
   bool is_endlocal = false;
   float opacity = 0;
 
-  // Allocate string variables, widely used afterwards
-  // (prevents stack overflow on recursive calls while remaining thread-safe).
-  CImg<char> _formula(4096), _color(4096), message(1024), _title(256), _indices(256),
-    _argx(256), _argy(256), _argz(256), _argc(256), _current_command(256), argument_text(81),
-    _command(256), _restriction(256);
+  // Get string variables, widely used afterwards, from the scratch frame of the current recursion depth
+  // (prevents stack overflow on recursive calls while remaining thread-safe, and avoids re-allocations).
+  _gmic_frame<_gmic_run_frame> run_frame(*(_gmic_run_frames*)run_frames);
+  _gmic_run_frame &frame = run_frame.frame;
+  CImg<char>
+    &_formula = frame.formula, &_color = frame.color, &message = frame.message, &_title = frame.title,
+    &_indices = frame.indices, &_argx = frame.argx, &_argy = frame.argy, &_argz = frame.argz,
+    &_argc = frame.argc, &_current_command = frame.current_command, &argument_text = frame.argument_text,
+    &_command = frame.command, &_restriction = frame.restriction;
 
   char
     *const formula = _formula.data(),
@@ -4451,6 +7804,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         ++position;
       }
       if (position>=commands_line.size()) break;
+      if (memory_window.ind!=~0U) memory_window.close(gmic_list_size(images));
 
       // Check consistency of the interpreter environment.
       if (images_names.size()!=images.size())
@@ -4464,6 +7818,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         error("Call stack overflow (infinite recursion ?).");
 
       // Substitute expressions in current item.
+      const unsigned int position_item = position;
       const char
         *const initial_item = commands_line[position].data(),
         *const empty_argument = "",
@@ -4593,6 +7948,11 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         is_start = false;
       }
 
+      // Unmap files that are not used anymore (only from the top-level list, which holds all the images).
+      if (((_gmic_mapped_files*)mapped_files)->siz && mapped_files==_mapped_files && &images==&parent_images &&
+          !threads_data && !((_gmic_async_jobs*)async_jobs)->first)
+        ((_gmic_mapped_files*)mapped_files)->collect(images);
+
       // Cancellation point.
       if (*is_abort || is_abort_thread) {
         if (is_very_verbose) print(images,0,"Abort G'MIC interpreter.\n");
@@ -4688,8 +8048,51 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         item = _item;
         command1 = *command?command[1]:item[1];
 
+        // Get identifiers of native commands (cached for items that are not substituted, see also 'commands_ids').
+        const bool is_cached_id = !std::strchr(initial_item,'$') && !std::strchr(initial_item,'{');
+        unsigned int
+          command_id = is_cached_id?commands_info(position_item,0):~0U,
+          item_id = is_cached_id?commands_info(position_item,1):~0U;
+        if (command_id==~0U) {
+          command_id = native_command_id(command);
+          item_id = native_command_id(item);
+          if (is_cached_id) { commands_info(position_item,0) = command_id; commands_info(position_item,1) = item_id; }
+        }
+        if (((_gmic_memory_profile*)memory_profile)->is_enabled) {
+          const char *const name = (*command?command:item) + 1;
+          if (!memory_window.open(*(_gmic_memory_profile*)memory_profile,command_id,name,gmic_list_size(images)))
+            memory_window.create(callstack2string(),name);
+        }
+
+        // Turn deferred copies into actual copies before they get modified.
+        if (_gmic_nb_shared_buffers) {
+          const _gmic_deferred_images &deferred = *(_gmic_deferred_images*)deferred_images;
+          const _gmic_mapped_files &mapped = *(_gmic_mapped_files*)mapped_files;
+          if (command_id==gmic_cmd_parallel) cimglist_for(images,l) deferred.materialize(images[l],mapped);
+          else if (!is_get_version && command_id!=gmic_cmd_none && !gmic_is_readonly_command(command_id))
+            cimg_forY(selection,l) if (selection[l]<images._width)
+              deferred.materialize(images[selection[l]],mapped);
+        }
+
+        // Uncompact compact images accessed by the command (its selection, and images referenced in its
+        // arguments). They stay regular images until the environment ends (see '_gmic_compact_pending').
+        if (compacts.is_used) {
+          if (compacts.siz) compacts.track(images,initial_callstack_size);
+          if ((is_get_version && command_id!=gmic_cmd_compact) ||
+              (command_id!=gmic_cmd_none && !gmic_is_compact_transparent_command(command_id))) {
+            const bool is_kept = command_id!=gmic_cmd_parallel && command_id!=gmic_cmd_shared &&
+              command_id!=gmic_cmd_async;
+            if (command_id==gmic_cmd_parallel || (command_id==gmic_cmd_move && is_get_version) ||
+                (*argument!='-' && !compacts.uncompact_references(images,argument,initial_callstack_size,is_kept)))
+              cimglist_for(images,l) compacts.uncompact(images,l,initial_callstack_size,is_kept);
+            else if (command_id!=gmic_cmd_pass)
+              cimg_forY(selection,l) if (selection[l]<images._width)
+                compacts.uncompact(images,selection[l],initial_callstack_size,is_kept);
+          }
+        }
+
         // Check if a new name has been requested for a command that does not allow that.
-        if (new_name && std::strcmp("-input",command) && !is_get_version)
+        if (new_name && command_id!=gmic_cmd_input && !is_get_version)
           error(images,0,0,
                 "Item '%s %s': Unknow name '%s'.",
                 initial_item,initial_argument,new_name.data());
@@ -4700,7 +8103,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         if (command1=='_') {
 
           // Status with escaped backslash.
-          if (!std::strcmp("-_status",item)) {
+          if (item_id==gmic_cmd__status) {
             gmic_substitute_args();
             name.assign(2*std::strlen(argument) + 1);
             char *ptrd = name;
@@ -4723,7 +8126,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         else if (command1=='a') {
 
           // Append.
-          if (!std::strcmp("-append",command)) {
+          if (command_id==gmic_cmd_append) {
             gmic_substitute_args();
             float align = 0;
             axis = sep = 0;
@@ -4767,7 +8170,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Autocrop.
-          if (!std::strcmp("-autocrop",command)) {
+          if (command_id==gmic_cmd_autocrop) {
             gmic_substitute_args();
             col.assign();
             if (*argument && cimg_sscanf(argument,"%4095[0-9.,eEinfa+-]%c",formula,&end)==1)
@@ -4791,7 +8194,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Add.
-          gmic_arithmetic_command("-add",
+          gmic_arithmetic_command(add,
                                   operator+=,
                                   "Add %g%s to image%s",
                                   value,ssep,gmic_selection.data(),Tfloat,
@@ -4803,7 +8206,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   "Add image%s");
 
           // Add 3d objects together, or shift a 3d object.
-          if (!std::strcmp("-add3d",command)) {
+          if (command_id==gmic_cmd_add3d) {
             gmic_substitute_args();
             float tx = 0, ty = 0, tz = 0;
             sep = 0;
@@ -4895,10 +8298,10 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Absolute value.
-          gmic_simple_command("-abs",abs,"Compute pointwise absolute value of image%s.");
+          gmic_simple_command(abs,abs,"Compute pointwise absolute value of image%s.");
 
           // Bitwise and.
-          gmic_arithmetic_command("-and",
+          gmic_arithmetic_command(and,
                                   operator&=,
                                   "Compute bitwise AND of image%s by %g%s",
                                   gmic_selection.data(),value,ssep,Tlong,
@@ -4909,8 +8312,167 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   gmic_selection.data(),gmic_argument_text_printed(),
                                   "Compute sequential bitwise AND of image%s");
 
+          // Apply atomic operation on a thread-global variable.
+          if (item_id==gmic_cmd_atomic) {
+            gmic_substitute_args();
+            double value0 = 0, value1 = 0;
+            *argx = *argy = 0;
+            const int nb_values = cimg_sscanf(argument,"%255[a-zA-Z0-9_],%255[a-z],%lf,%lf%c",
+                                              argx,argy,&value0,&value1,&end);
+            const char operation =
+              !std::strcmp(argy,"get")?'g':!std::strcmp(argy,"set")?'=':!std::strcmp(argy,"add")?'+':
+              !std::strcmp(argy,"sub")?'-':!std::strcmp(argy,"min")?'<':!std::strcmp(argy,"max")?'>':
+              !std::strcmp(argy,"cas")?'c':0;
+            if (*argx && operation &&
+                nb_values==(operation=='g'?2:operation=='c'?4:3)) {
+              if (argx[0]!='_' || argx[1]!='_')
+                error(images,0,"atomic",
+                      "Command '-atomic': Variable '%s' is not thread-global (name must start with '__').",
+                      argx);
+              print(images,0,"Apply atomic operation '%s' on thread-global variable '%s'.",
+                    argy,argx);
+              _gmic_atomic_variables &atomics = *(_gmic_atomic_variables*)atomic_variables;
+              _gmic_atomic_variable *atomic_variable = atomics.find(argx);
+              if (!atomic_variable) { // Create cell from current value of the variable.
+                double number = 0;
+                cimg::mutex(30);
+                CImgList<char> &__variables = *variables[1], &__variables_names = *variables_names[1];
+                for (int l = __variables.width() - 1; l>=0; --l)
+                  if (!std::strcmp(__variables_names[l],argx)) {
+                    if (cimg_sscanf(gmic_variable_string(__variables[l]),"%lf%c",&number,&end)!=1)
+                      number = 0;
+                    break;
+                  }
+                atomic_variable = atomics.insert(argx,number);
+                cimg::mutex(30,0);
+              }
+              const double res =
+                operation=='g'?atomic_variable->get():
+                operation=='c'?atomic_variable->compare_exchange(value0,value1):
+                operation=='-'?atomic_variable->fetch('+',-value0):
+                atomic_variable->fetch(operation,value0);
+              cimg_snprintf(title,_title.width(),"%.16g",res);
+              CImg<char>::string(title).move_to(status);
+            } else arg_error("atomic");
+            ++position; continue;
+          }
+
+          // Launch asynchronous job on selected images.
+          if (command_id==gmic_cmd_async) {
+            gmic_substitute_args();
+            _gmic_async_jobs &jobs = *(_gmic_async_jobs*)async_jobs;
+            print(images,0,"Launch asynchronous job #%u with command '%s' on image%s.",
+                  jobs.next_id,gmic_argument_text_printed(),gmic_selection.data());
+            st_gmic_async<T> *const job = new st_gmic_async<T>;
+            st_gmic_parallel<T> &thread = job->thread;
+            cimg_snprintf(title,_title.width(),"*async%u",jobs.next_id);
+            gmic_prepare_thread(thread,*this,title,true); // The parent keeps running (and may change commands).
+
+            // Transfer selected images to the job (or copy them, for '+async').
+            job->images.assign(selection.height());
+            job->images_names.assign(selection.height());
+            cimg::mutex(27);
+            cimg_forY(selection,l) {
+              const unsigned int uind = selection[l];
+              if ((images[uind]._width || images[uind]._height) && !images[uind]._spectrum) {
+                cimg::mutex(27,0);
+                delete job;
+                selection2string(selection,images_names,1,true,name);
+                error(images,0,0,
+                      "Command '-async': Invalid selection%s "
+                      "(image [%u] is already used in another thread).",
+                      name.data() + (*name=='s'?1:0),uind);
+              }
+            }
+            cimg_forY(selection,l) {
+              const unsigned int uind = selection[l];
+              CImg<T> &img = images[uind];
+              if (is_get_version || img.is_shared()) job->images[l].assign(img,false);
+              else img.move_to(job->images[l]);
+              job->images_names[l].assign(images_names[uind]);
+            }
+            if (!is_get_version) remove_images(images,images_names,selection,0,selection.height() - 1);
+            cimg::mutex(27,0);
+
+            thread.images = &job->images;
+            thread.images_names = &job->images_names;
+            thread.parent_images = &job->parent_images;
+            thread.parent_images_names = &job->parent_images_names;
+            thread.threads_data = &job->threads_data;
+            thread.is_thread_running = true;
+            CImg<char> arg_async = CImg<char>::string(argument);
+            thread.gmic_instance.commands_line_to_CImgList(gmic_strreplace_unquoted(arg_async.data())).
+              move_to(thread.commands_line);
+
+            // Run job.
+#ifdef gmic_is_parallel
+#if cimg_OS!=2
+            thread.job.routine = gmic_parallel<T>;
+            thread.job.arg = (void*)&thread;
+            if (!gmic_thread_pool().submit(thread.job)) { // Give back transferred images before failing.
+              thread.job.routine = 0;
+              if (!is_get_version) cimg_forY(selection,l) {
+                  job->images[l].move_to(images,selection[l]);
+                  job->images_names[l].move_to(images_names,selection[l]);
+                }
+              delete job;
+              error(images,0,0,
+                    "Command '-async': Cannot create a new thread for job '%s'.",
+                    gmic_argument_text());
+            }
+#else // #if cimg_OS!=2
+            thread.thread_id = CreateThread(0,0,gmic_parallel<T>,(void*)&thread,0,0);
+#endif // #if cimg_OS!=2
+#else // #ifdef gmic_is_parallel
+            gmic_parallel<T>((void*)&thread);
+#endif // #ifdef gmic_is_parallel
+
+            const unsigned int job_id = jobs.insert(job,CImg<T>::pixel_type(),gmic_async_release<T>);
+            cimg_snprintf(title,_title.width(),"%u",job_id);
+            CImg<char>::string(title).move_to(status);
+            is_released = false; ++position; continue;
+          }
+
+          // Wait for asynchronous job and insert its images.
+          if (item_id==gmic_cmd_await) {
+            gmic_substitute_args();
+            unsigned int job_id = 0;
+            int _iind0 = (int)images.size();
+            if (cimg_sscanf(argument,"%u%c",&job_id,&end)==1 ||
+                cimg_sscanf(argument,"%u,%d%c",&job_id,&_iind0,&end)==2) {
+              const int iind0 = _iind0<0?_iind0 + (int)images.size():_iind0;
+              if (iind0<0 || iind0>(int)images.size())
+                error(images,0,"await",
+                      "Command '-await': Invalid position '%d' (not in range -%u...%u).",
+                      _iind0,images.size(),images.size());
+              st_gmic_async<T> *const job =
+                (st_gmic_async<T>*)((_gmic_async_jobs*)async_jobs)->remove(job_id,CImg<T>::pixel_type());
+              if (!job)
+                error(images,0,"await",
+                      "Command '-await': Unknown asynchronous job #%u.",
+                      job_id);
+              print(images,0,"Wait for asynchronous job #%u and insert its images at position %d.",
+                    job_id,iind0);
+              gmic_async_wait(*job);
+              if (job->thread.exception._message) {
+                gmic_exception exception;
+                exception._command_help.swap(job->thread.exception._command_help);
+                exception._message.swap(job->thread.exception._message);
+                delete job;
+                throw exception;
+              }
+              job->thread.gmic_instance.status.move_to(status);
+              cimg::mutex(27);
+              job->images.move_to(images,iind0);
+              job->images_names.move_to(images_names,iind0);
+              cimg::mutex(27,0);
+              delete job;
+            } else arg_error("await");
+            is_released = false; ++position; continue;
+          }
+
           // Arc-tangent (two arguments).
-          if (!std::strcmp("-atan2",command)) {
+          if (command_id==gmic_cmd_atan2) {
             gmic_substitute_args();
             sep = 0;
             if (cimg_sscanf(argument,"[%255[a-zA-Z0-9_.%+-]%c%c",
@@ -4928,13 +8490,13 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Arc-cosine.
-          gmic_simple_command("-acos",acos,"Compute pointwise arc-cosine of image%s.");
+          gmic_simple_command(acos,acos,"Compute pointwise arc-cosine of image%s.");
 
           // Arc-sine.
-          gmic_simple_command("-asin",asin,"Compute pointwise arc-sine of image%s.");
+          gmic_simple_command(asin,asin,"Compute pointwise arc-sine of image%s.");
 
           // Arc-tangent.
-          gmic_simple_command("-atan",atan,"Compute pointwise arc-tangent of image%s.");
+          gmic_simple_command(atan,atan,"Compute pointwise arc-tangent of image%s.");
 
         } // command1=='a'.
 
@@ -4943,8 +8505,43 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         //----------------------------
         else if (command1=='b') {
 
+          // Wait for all threads of the current '-parallel' call.
+          if (item_id==gmic_cmd_barrier) {
+            _gmic_parallel_group *const group = (_gmic_parallel_group*)parallel_group;
+            print(images,0,"Wait for all threads at barrier%s.",group?"":" (no parallel threads)");
+            if (group && !group->barrier(is_abort)) throw CImgAbortException("");
+            ++position; continue;
+          }
+
+          // Manage pool of large image buffers of the interpreter.
+          // Buffers of removed images are reused by new images of the same size (when G'MIC is built with
+          // 'gmic_use_buffer_pool'). 'trim' releases them and gives free heap memory back to the system.
+          if (item_id==gmic_cmd_buffer_pool) {
+            gmic_substitute_args();
+            _gmic_buffer_pool &pool = *(_gmic_buffer_pool*)buffer_pool;
+            value = 0;
+            if (!std::strcmp(argument,"stats"))
+              print(images,0,"Get statistics of buffer pool.");
+            else if (!std::strcmp(argument,"trim")) {
+              print(images,0,"Release all cached buffers of buffer pool.");
+              pool.trim(0);
+#ifdef __GLIBC__
+              malloc_trim(0);
+#endif // #ifdef __GLIBC__
+            } else if (cimg_sscanf(argument,"%lf%c",&value,&end)==1 && value>=0) {
+              print(images,0,"Set maximal size of buffer pool to %g bytes.",
+                    value);
+              pool.max_retained_size = (std::size_t)value;
+              pool.trim(pool.max_retained_size);
+            } else arg_error("buffer_pool");
+            cimg_snprintf(title,_title.width(),"%lu,%lu,%g,%g",
+                          pool.nb_hits,pool.nb_misses,(double)pool.retained_size,(double)pool.max_retained_size);
+            CImg<char>::string(title).move_to(status);
+            ++position; continue;
+          }
+
           // Blur.
-          if (!std::strcmp("-blur",command)) {
+          if (command_id==gmic_cmd_blur) {
             gmic_substitute_args();
             unsigned int is_gaussian = 0;
             float sigma = -1;
@@ -4982,15 +8579,15 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
               if (*argx) {
                 float sigmas[4] = { 0 };
                 for (const char *s = argx; *s; ++s) sigmas[*s>='x'?*s - 'x':3]+=sigma;
-                cimg_forY(selection,l) gmic_apply(gmic_blur(sigmas[0],sigmas[1],sigmas[2],sigmas[3],
-                                                            (bool)boundary,(bool)is_gaussian));
-              } else cimg_forY(selection,l) gmic_apply(blur(sigma,(bool)boundary,(bool)is_gaussian));
+                gmic_apply_parallel(gmic_blur(sigmas[0],sigmas[1],sigmas[2],sigmas[3],
+                                              (bool)boundary,(bool)is_gaussian));
+              } else gmic_apply_parallel(blur(sigma,(bool)boundary,(bool)is_gaussian));
             } else arg_error("blur");
             is_released = false; ++position; continue;
           }
 
           // Box filter.
-          if (!std::strcmp("-boxfilter",command)) {
+          if (command_id==gmic_cmd_boxfilter) {
             unsigned int order = 0;
             gmic_substitute_args();
             float sigma = -1;
@@ -5026,15 +8623,15 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
               if (*argx) {
                 float sigmas[4] = { 0 };
                 for (const char *s = argx; *s; ++s) sigmas[*s>='x'?*s - 'x':3]+=sigma;
-                cimg_forY(selection,l) gmic_apply(gmic_blur_box(sigmas[0],sigmas[1],sigmas[2],sigmas[3],
-                                                                order,(bool)boundary));
-              } else cimg_forY(selection,l) gmic_apply(gmic_blur_box(sigma,order,(bool)boundary));
+                gmic_apply_parallel(gmic_blur_box(sigmas[0],sigmas[1],sigmas[2],sigmas[3],
+                                                  order,(bool)boundary));
+              } else gmic_apply_parallel(gmic_blur_box(sigma,order,(bool)boundary));
             } else arg_error("boxfilter");
             is_released = false; ++position; continue;
           }
 
           // Bitwise right shift.
-          gmic_arithmetic_command("-bsr",
+          gmic_arithmetic_command(bsr,
                                   operator>>=,
                                   "Compute bitwise right shift of image%s by %g%s",
                                   gmic_selection.data(),value,ssep,Tlong,
@@ -5046,7 +8643,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   "Compute sequential bitwise right shift of image%s");
 
           // Bitwise left shift.
-          gmic_arithmetic_command("-bsl",
+          gmic_arithmetic_command(bsl,
                                   operator<<=,
                                   "Compute bitwise left shift of image%s by %g%s",
                                   gmic_selection.data(),value,ssep,Tlong,
@@ -5058,7 +8655,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   "Compute sequential bitwise left shift of image%s");
 
           // Bilateral filter.
-          if (!std::strcmp("-bilateral",command)) {
+          if (command_id==gmic_cmd_bilateral) {
             gmic_substitute_args();
             float sigma_s = 0, sigma_r = 0, sampling_s = 0, sampling_r = 0;
             sep0 = sep1 = *argz = *argc = 0;
@@ -5115,13 +8712,13 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         else if (command1=='c') {
 
           // Check expression or filename.
-          if (!std::strcmp("-check",item)) {
+          if (item_id==gmic_cmd_check) {
             gmic_substitute_args();
             name.assign(argument,(unsigned int)std::strlen(argument) + 1);
             strreplace_fw(name);
             bool is_cond = false, is_filename = false;
             const CImg<T> &img = images.size()?images.back():CImg<T>::empty();
-            try { if (img.eval(name)) is_cond = true; }
+            try { if (((_gmic_math_cache*)math_cache)->eval(img,name)) is_cond = true; }
             catch (CImgException&) {
               is_filename = true;
               is_cond = check_filename(name);
@@ -5143,7 +8740,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Crop.
-          if (!std::strcmp("-crop",command)) {
+          if (command_id==gmic_cmd_crop) {
             gmic_substitute_args();
             name.assign(64,8);
             char
@@ -5345,7 +8942,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Cut.
-          if (!std::strcmp("-cut",command)) {
+          if (command_id==gmic_cmd_cut) {
             gmic_substitute_args();
             ind0.assign(); ind1.assign();
             sep0 = sep1 = *argx = *argy = 0;
@@ -5482,7 +9079,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Keep channels.
-          if (!std::strcmp("-channels",command)) {
+          if (command_id==gmic_cmd_channels) {
             gmic_substitute_args();
             ind0.assign(); ind1.assign();
             value0 = value1 = 0;
@@ -5535,7 +9132,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Keep columns.
-          if (!std::strcmp("-columns",command)) {
+          if (command_id==gmic_cmd_columns) {
             gmic_substitute_args();
             ind0.assign(); ind1.assign();
             value0 = value1 = 0;
@@ -5588,7 +9185,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Import custom commands.
-          if (!std::strcmp("-command",item)) {
+          if (item_id==gmic_cmd_command) {
             gmic_substitute_args();
             name.assign(argument,(unsigned int)std::strlen(argument) + 1);
             const char *arg_command_text = gmic_argument_text_printed();
@@ -5653,7 +9250,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
               unsigned int nb_added = 0;
               for (unsigned int l = 0; l<512; ++l) nb_added+=commands[l].size();
               nb_added-=siz;
-              cimg::mutex(29);
+              gmic_lock_output();
               std::fprintf(cimg::output()," (added %u command%s, total %u).",
                            nb_added,nb_added>1?"s":"",siz + nb_added);
               std::fflush(cimg::output());
@@ -5663,7 +9260,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Check validity of 3d object.
-          if (!std::strcmp("-check3d",command) && !is_get_version) {
+          if (command_id==gmic_cmd_check3d && !is_get_version) {
             gmic_substitute_args();
             bool is_full_check = true;
             if (!argument[1] && (*argument=='0' || *argument=='1')) {
@@ -5679,7 +9276,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
               CImg<T>& img = gmic_check(images[uind]);
               if (!img.is_CImg3d(is_full_check,&(*message=0))) {
                 if (is_very_verbose) {
-                  cimg::mutex(29);
+                  gmic_lock_output();
                   std::fprintf(cimg::output()," -> invalid.");
                   std::fflush(cimg::output());
                   cimg::mutex(29,0);
@@ -5690,7 +9287,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
               }
             }
             if (is_very_verbose) {
-              cimg::mutex(29);
+              gmic_lock_output();
               std::fprintf(cimg::output()," -> valid.");
               std::fflush(cimg::output());
               cimg::mutex(29,0);
@@ -5699,10 +9296,10 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Cosine.
-          gmic_simple_command("-cos",cos,"Compute pointwise cosine of image%s.");
+          gmic_simple_command(cos,cos,"Compute pointwise cosine of image%s.");
 
           // Convolve.
-          if (!std::strcmp("-convolve",command)) {
+          if (command_id==gmic_cmd_convolve) {
             gmic_substitute_args();
             unsigned int is_normalized = 0;
             boundary = 1;
@@ -5730,7 +9327,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Correlate.
-          if (!std::strcmp("-correlate",command)) {
+          if (command_id==gmic_cmd_correlate) {
             gmic_substitute_args();
             unsigned int is_normalized = 0;
             boundary = 1;
@@ -5758,7 +9355,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Set 3d object color.
-          if (!std::strcmp("-color3d",command) || !std::strcmp("-col3d",command)) {
+          if (command_id==gmic_cmd_color3d || command_id==gmic_cmd_col3d) {
             gmic_substitute_args();
             float R = 200, G = 200, B = 200;
             opacity = -1;
@@ -5798,7 +9395,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Cumulate.
-          if (!std::strcmp("-cumulate",command)) {
+          if (command_id==gmic_cmd_cumulate) {
             gmic_substitute_args();
             bool is_axes_argument = true;
             for (const char *s = argument; *s; ++s) {
@@ -5820,27 +9417,48 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
             is_released = false; continue;
           }
 
+          // Store images compactly.
+          if (command_id==gmic_cmd_compact) {
+            gmic_substitute_args();
+            const unsigned int type = !std::strcmp(argument,"uchar")?1:!std::strcmp(argument,"ushort")?2:
+              !std::strcmp(argument,"half")?3:!std::strcmp(argument,"float")?0:~0U;
+            if (type==~0U) arg_error("compact");
+            print(images,0,"Store image%s with %s values.",
+                  gmic_selection.data(),gmic_compact_type(type));
+            cimg_forY(selection,l) {
+              const unsigned int uind = selection[l];
+              if (is_get_version) {
+                images.insert(gmic_check(images[uind]));
+                images_names.insert(images_names[uind].get_copymark());
+              }
+              CImg<T> &img = is_get_version?images.back():gmic_check(images[uind]);
+              if (!is_get_version && compacts.siz) compacts.forget(&images,img._data);
+              if (img._is_shared || gmic_compact_info(img)==type) continue;
+              gmic_uncompact(img);
+              if (type && gmic_compact(img,type)) compacts.is_used = true;
+            }
+            is_released = false; ++position; continue;
+          }
+
           // Hyperbolic cosine.
-          gmic_simple_command("-cosh",cosh,"Compute pointwise hyperbolic cosine of image%s.");
+          gmic_simple_command(cosh,cosh,"Compute pointwise hyperbolic cosine of image%s.");
 
           // Camera input.
-          if (!std::strcmp("-camera",item)) {
+          if (item_id==gmic_cmd_camera) {
             gmic_substitute_args();
             float
               cam_index = 0, nb_frames = 1, skip_frames = 0,
               capture_width = 0, capture_height = 0;
-            if ((cimg_sscanf(argument,"%f%c",
-                             &cam_index,&end)==1 ||
-                 cimg_sscanf(argument,"%f,%f%c",
-                             &cam_index,&nb_frames,&end)==2 ||
-                 cimg_sscanf(argument,"%f,%f,%f%c",
-                             &cam_index,&nb_frames,&skip_frames,&end)==3 ||
-                 cimg_sscanf(argument,"%f,%f,%f,%f,%f%c",
-                             &cam_index,&nb_frames,&skip_frames,
-                             &capture_width,&capture_height,&end)==5) &&
-                cam_index>=0 && nb_frames>=0 && skip_frames>=0 &&
-                ((!capture_width && !capture_height) || (capture_width>0 && capture_height>0)))
-              ++position;
+            const _gmic_fields fields(argument);
+            if (fields.is("n") || fields.is("nn") || fields.is("nnn") || fields.is("nnnnn")) {
+              cam_index = fields[0];
+              if (fields.nb_fields>1) nb_frames = fields[1];
+              if (fields.nb_fields>2) skip_frames = fields[2];
+              if (fields.nb_fields>4) { capture_width = fields[3]; capture_height = fields[4]; }
+              if (cam_index>=0 && nb_frames>=0 && skip_frames>=0 &&
+                  ((!capture_width && !capture_height) || (capture_width>0 && capture_height>0)))
+                ++position;
+            }
             cam_index = cimg::round(cam_index);
             nb_frames = cimg::round(nb_frames);
             skip_frames = cimg::round(skip_frames);
@@ -5860,14 +9478,14 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
               cimg_snprintf(title,_title.width(),"[Camera #%g]",cam_index);
               CImg<char>::string(title).move_to(name);
               if (nb_frames>1) {
-                cimg::mutex(29);
+                gmic_lock_output();
                 std::fputc('\n',cimg::output());
                 std::fflush(cimg::output());
                 cimg::mutex(29,0);
               }
               for (unsigned int k = 0; k<(unsigned int)nb_frames; ++k) {
                 if (nb_frames>1 && is_verbose) {
-                  cimg::mutex(29);
+                  gmic_lock_output();
                   std::fprintf(cimg::output(),"\r  > Image %u/%u        ",
                                k + 1,(unsigned int)nb_frames);
                   std::fflush(cimg::output());
@@ -5883,7 +9501,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Show/hide mouse cursor.
-          if (!std::strcmp("-cursor",command) && !is_get_version) {
+          if (command_id==gmic_cmd_cursor && !is_get_version) {
             gmic_substitute_args();
             if (!is_restriction)
               CImg<unsigned int>::vector(0,1,2,3,4,5,6,7,8,9).move_to(selection);
@@ -5924,7 +9542,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         else if (command1=='d') {
 
           // Done.
-          if (!std::strcmp("-done",item)) {
+          if (item_id==gmic_cmd_done) {
             const CImg<char> &s = callstack.back();
             if (s[0]!='*' || s[1]!='r')
               error(images,0,0,
@@ -5933,20 +9551,20 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
             *title = 0;
             CImg<unsigned int> &rd = repeatdones.back();
             const unsigned int counter = ++rd[2];
-            unsigned int hashcode = ~0U, pos = ~0U;
-            if (rd.height()>3) { hashcode = (unsigned int)rd[3]; pos = (unsigned int)rd[4]; }
+            unsigned int kind = ~0U, pos = ~0U;
+            if (rd.height()>3) { kind = (unsigned int)rd[3]; pos = (unsigned int)rd[4]; }
+            _gmic_variables &locals = *(_gmic_variables*)local_variables;
             if (--rd[1]) {
               position = rd[0];
-              if (hashcode!=~0U) {
-                cimg_snprintf(argx,_argx.width(),"%u",counter);
-                CImg<char>::string(argx).move_to((*variables[hashcode])[pos]);
-              }
+              if (kind!=~0U)
+                gmic_set_numeric_variable(kind?(*variables[kind - 1])[pos]:locals.values[pos],(double)counter);
               next_debug_line = debug_line; next_debug_filename = debug_filename;
             } else {
               if (is_very_verbose) print(images,0,"End 'repeat..done' block.");
-              if (hashcode!=~0U) {
-                variables[hashcode]->remove(pos);
-                variables_names[hashcode]->remove(pos);
+              if (kind==0) locals.remove(pos);
+              else if (kind!=~0U) {
+                variables[kind - 1]->remove(pos);
+                variables_names[kind - 1]->remove(pos);
               }
               repeatdones.remove();
               callstack.remove();
@@ -5955,7 +9573,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Do..while.
-          if (!std::strcmp("-do",item)) {
+          if (item_id==gmic_cmd_do) {
             if (debug_line!=~0U) {
               cimg_snprintf(argx,_argx.width(),"*do#%u",debug_line);
               CImg<char>::string(argx).move_to(callstack);
@@ -5966,7 +9584,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Discard value.
-          if (!std::strcmp("-discard",command)) {
+          if (command_id==gmic_cmd_discard) {
             gmic_substitute_args();
             CImg<T> values;
             *argx = 0;
@@ -6018,13 +9636,13 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Enable debug mode (useful when '-debug' is invoked from a custom command).
-          if (!std::strcmp("-debug",item)) {
+          if (item_id==gmic_cmd_debug) {
             is_debug = true;
             continue;
           }
 
           // Divide.
-          gmic_arithmetic_command("-div",
+          gmic_arithmetic_command(div,
                                   operator/=,
                                   "Divide image%s by %g%s",
                                   gmic_selection.data(),value,ssep,Tfloat,
@@ -6036,7 +9654,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   "Divide image%s");
 
           // Distance function.
-          if (!std::strcmp("-distance",command)) {
+          if (command_id==gmic_cmd_distance) {
             gmic_substitute_args();
             unsigned int algorithm = 0, off = 0;
             int metric = 2;
@@ -6126,7 +9744,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Dilate.
-          if (!std::strcmp("-dilate",command)) {
+          if (command_id==gmic_cmd_dilate) {
             gmic_substitute_args();
             float sx = 3, sy = 3, sz = 1;
             unsigned int is_normalized = 0;
@@ -6156,7 +9774,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
               print(images,0,"Dilate image%s with mask of size %g and neumann boundary conditions.",
                     gmic_selection.data(),
                     sx);
-              cimg_forY(selection,l) gmic_apply(dilate((unsigned int)sx));
+              gmic_apply_parallel(dilate((unsigned int)sx));
             } else if ((cimg_sscanf(argument,"%f,%f%c",
                                     &sx,&sy,&end)==2 ||
                         cimg_sscanf(argument,"%f,%f,%f%c",
@@ -6168,13 +9786,13 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
               print(images,0,"Dilate image%s with %gx%gx%g mask and neumann boundary conditions.",
                     gmic_selection.data(),
                     sx,sy,sz);
-              cimg_forY(selection,l) gmic_apply(dilate((unsigned int)sx,(unsigned int)sy,(unsigned int)sz));
+              gmic_apply_parallel(dilate((unsigned int)sx,(unsigned int)sy,(unsigned int)sz));
             } else arg_error("dilate");
             is_released = false; ++position; continue;
           }
 
           // Set double-sided mode for 3d rendering.
-          if (!std::strcmp("-double3d",item)) {
+          if (item_id==gmic_cmd_double3d) {
             gmic_substitute_args();
             bool state = true;
             if (!argument[1] && (*argument=='0' || *argument=='1')) {
@@ -6188,7 +9806,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Patch-based smoothing.
-          if (!std::strcmp("-denoise",command)) {
+          if (command_id==gmic_cmd_denoise) {
             gmic_substitute_args();
             float sigma_s = 10, sigma_r = 10, smoothness = 1;
             unsigned int is_fast_approximation = 0;
@@ -6226,7 +9844,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Deriche filter.
-          if (!std::strcmp("-deriche",command)) {
+          if (command_id==gmic_cmd_deriche) {
             gmic_substitute_args();
             unsigned int order = 0;
             float sigma = 0;
@@ -6246,13 +9864,13 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                     sigma,sep=='%'?"%":"",
                     boundary?"neumann":"dirichlet");
               if (sep=='%') sigma = -sigma;
-              cimg_forY(selection,l) gmic_apply(deriche(sigma,order,axis,(bool)boundary));
+              gmic_apply_parallel(deriche(sigma,order,axis,(bool)boundary));
             } else arg_error("deriche");
             is_released = false; ++position; continue;
           }
 
           // Dijkstra algorithm.
-          if (!std::strcmp("-dijkstra",command)) {
+          if (command_id==gmic_cmd_dijkstra) {
             gmic_substitute_args();
             float snode = 0, enode = 0;
             if (cimg_sscanf(argument,"%f,%f%c",&snode,&enode,&end)==2 &&
@@ -6288,7 +9906,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Estimate displacement field.
-          if (!std::strcmp("-displacement",command)) {
+          if (command_id==gmic_cmd_displacement) {
             gmic_substitute_args();
             float nb_scales = 0, nb_iterations = 10000, smoothness = 0.1f, precision = 7.0f;
             unsigned int is_backward = 1;
@@ -6340,7 +9958,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Display.
-          if (!std::strcmp("-display",command) && !is_get_version) {
+          if (command_id==gmic_cmd_display && !is_get_version) {
             gmic_substitute_args();
             unsigned int X,Y,Z, XYZ[3];
             bool is_xyz = false;
@@ -6352,7 +9970,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Display 3d object.
-          if (!std::strcmp("-display3d",command) && !is_get_version) {
+          if (command_id==gmic_cmd_display3d && !is_get_version) {
             gmic_substitute_args();
             sep = 0;
             if ((cimg_sscanf(argument,"[%255[a-zA-Z0-9_.%+-]%c%c",
@@ -6373,7 +9991,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         else if (command1=='e') {
 
           // Endif.
-          if (!std::strcmp("-endif",item)) {
+          if (item_id==gmic_cmd_endif) {
             const CImg<char> &s = callstack.back();
             if (s[0]!='*' || s[1]!='i')
               error(images,0,0,
@@ -6385,7 +10003,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Else and elif.
-          if (!std::strcmp("-else",item) || (!std::strcmp("-elif",item) && !check_elif)) {
+          if (item_id==gmic_cmd_else || (item_id==gmic_cmd_elif && !check_elif)) {
             const CImg<char> &s = callstack.back();
             if (s[0]!='*' || s[1]!='i')
               error(images,0,0,
@@ -6393,19 +10011,15 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                     item);
             check_elif = false;
             if (is_very_verbose) print(images,0,"Reach '-else' block.");
-            for (int nb_ifs = 1; nb_ifs && position<commands_line.size(); ++position) {
-              const char *const it = commands_line[position].data();
-              if (*it==1 &&
-                  cimg_sscanf(commands_line[position].data() + 1,"%x,%x",&_debug_line,&(_debug_filename=0))>0) {
-                is_debug_info = true; next_debug_line = _debug_line; next_debug_filename = _debug_filename;
-              } else if (!std::strcmp("-if",it)) ++nb_ifs;
-              else if (!std::strcmp("-endif",it)) { if (!--nb_ifs) --position; }
-            }
+            const unsigned int position_endif = gmic_block_end(position,6);
+            const unsigned int nposition = position_endif!=~0U?position_endif:commands_line.size();
+            gmic_skip_debug_info(position,nposition);
+            position = nposition;
             continue;
           }
 
           // End local environment.
-          if (!std::strcmp("-endlocal",item) || !std::strcmp("-endl",item)) {
+          if (item_id==gmic_cmd_endlocal || item_id==gmic_cmd_endl) {
             const CImg<char> &s = callstack.back();
             if (s[0]!='*' || s[1]!='l')
               error(images,0,0,
@@ -6417,7 +10031,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Echo.
-          if (!std::strcmp("-echo",command) && !is_get_version) {
+          if (command_id==gmic_cmd_echo && !is_get_version) {
             if (is_verbose) {
               gmic_substitute_args();
               name.assign(argument,(unsigned int)std::strlen(argument) + 1);
@@ -6429,7 +10043,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Exec.
-          if (!std::strcmp("-exec",item)) {
+          if (item_id==gmic_cmd_exec) {
             gmic_substitute_args();
 #ifdef gmic_noexec
             print(images,0,"Execute external command '%s' (skipped, no exec allowed).",
@@ -6452,7 +10066,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Error.
-          if (!std::strcmp("-error",command) && !is_get_version) {
+          if (command_id==gmic_cmd_error && !is_get_version) {
             gmic_substitute_args();
             name.assign(argument,(unsigned int)std::strlen(argument) + 1);
             cimg::strunescape(name);
@@ -6461,7 +10075,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Invert endianness.
-          if (!std::strcmp("-endian",item)) {
+          if (item_id==gmic_cmd_endian) {
             gmic_substitute_args();
             if (!std::strcmp(argument,"uchar") ||
                 !std::strcmp(argument,"unsigned char") || !std::strcmp(argument,"char") ||
@@ -6481,10 +10095,10 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Exponential.
-          gmic_simple_command("-exp",exp,"Compute pointwise exponential of image%s.");
+          gmic_simple_command(exp,exp,"Compute pointwise exponential of image%s.");
 
           // Test equality.
-          gmic_arithmetic_command("-eq",
+          gmic_arithmetic_command(eq,
                                   operator_eq,
                                   "Compute boolean equality between image%s and %g%s",
                                   gmic_selection.data(),value,ssep,T,
@@ -6496,7 +10110,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   "Compute boolean equality between image%s");
 
           // Draw ellipse.
-          if (!std::strcmp("-ellipse",command)) {
+          if (command_id==gmic_cmd_ellipse) {
             gmic_substitute_args();
             float x = 0, y = 0, R = 0, r = 0, angle = 0;
             sep0 = sep1 = sepx = sepy = *argx = *argy = *argz = *argc = *color = 0;
@@ -6571,7 +10185,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Equalize.
-          if (!std::strcmp("-equalize",command)) {
+          if (command_id==gmic_cmd_equalize) {
             gmic_substitute_args();
             float nb_levels = 256;
             bool no_min_max = false;
@@ -6629,7 +10243,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Erode.
-          if (!std::strcmp("-erode",command)) {
+          if (command_id==gmic_cmd_erode) {
             gmic_substitute_args();
             unsigned int is_normalized = 0;
             float sx = 3, sy = 3, sz = 1;
@@ -6659,7 +10273,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
               print(images,0,"Erode image%s with mask of size %g and neumann boundary conditions.",
                     gmic_selection.data(),
                     sx);
-              cimg_forY(selection,l) gmic_apply(erode((unsigned int)sx));
+              gmic_apply_parallel(erode((unsigned int)sx));
             } else if ((cimg_sscanf(argument,"%f,%f%c",
                                     &sx,&sy,&end)==2 ||
                         cimg_sscanf(argument,"%f,%f,%f%c",
@@ -6671,13 +10285,13 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
               print(images,0,"Erode image%s with %gx%gx%g mask and neumann boundary conditions.",
                     gmic_selection.data(),
                     sx,sy,sz);
-              cimg_forY(selection,l) gmic_apply(erode((unsigned int)sx,(unsigned int)sy,(unsigned int)sz));
+              gmic_apply_parallel(erode((unsigned int)sx,(unsigned int)sy,(unsigned int)sz));
             } else arg_error("erode");
             is_released = false; ++position; continue;
           }
 
           // Build 3d elevation.
-          if (!std::strcmp("-elevation3d",command)) {
+          if (command_id==gmic_cmd_elevation3d) {
             gmic_substitute_args();
             float fact = 1;
             sep = *formula = 0;
@@ -6741,7 +10355,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Eigenvalues/eigenvectors.
-          if (!std::strcmp("-eigen",command)) {
+          if (command_id==gmic_cmd_eigen) {
             print(images,0,"Compute eigen-values/vectors of symmetric matri%s or matrix field%s.",
                   selection.height()>1?"ce":"x",gmic_selection.data());
             unsigned int off = 0;
@@ -6772,7 +10386,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         else if (command1=='f') {
 
           // Fill.
-          if (!std::strcmp("-fill",command)) {
+          if (command_id==gmic_cmd_fill) {
             gmic_substitute_args();
             value = 0;
             sep = 0;
@@ -6806,7 +10420,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Flood fill.
-          if (!std::strcmp("-flood",command)) {
+          if (command_id==gmic_cmd_flood) {
             gmic_substitute_args();
             float x = 0, y = 0, z = 0, tolerance = 0;
             unsigned int is_high_connectivity = 0;
@@ -6862,7 +10476,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // List of directory files.
-          if (!std::strcmp("-files",item)) {
+          if (item_id==gmic_cmd_files) {
             gmic_substitute_args();
             unsigned int mode = 5;
             if ((*argument>='0' && *argument<='5') &&
@@ -6887,7 +10501,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Set 3d focale.
-          if (!std::strcmp("-focale3d",item)) {
+          if (item_id==gmic_cmd_focale3d) {
             gmic_substitute_args();
             value = 700;
             if (cimg_sscanf(argument,"%lf%c",&value,&end)==1) ++position;
@@ -6906,7 +10520,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         else if (command1=='g') {
 
           // Greater or equal.
-          gmic_arithmetic_command("-ge",
+          gmic_arithmetic_command(ge,
                                   operator_ge,
                                   "Compute boolean 'greater or equal than' between image%s and %g%s",
                                   gmic_selection.data(),value,ssep,T,
@@ -6920,7 +10534,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   "Compute boolean 'greater or equal than' between image%s");
 
           // Greater than.
-          gmic_arithmetic_command("-gt",
+          gmic_arithmetic_command(gt,
                                   operator_gt,
                                   "Compute boolean 'greater than' between image%s and %g%s",
                                   gmic_selection.data(),value,ssep,T,
@@ -6932,7 +10546,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   "Compute boolean 'greater than' between image%s");
 
           // Compute gradient.
-          if (!std::strcmp("-gradient",command)) {
+          if (command_id==gmic_cmd_gradient) {
             gmic_substitute_args();
             int scheme = 3;
             *argx = 0;
@@ -6972,7 +10586,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Guided filter.
-          if (!std::strcmp("-guided",command)) {
+          if (command_id==gmic_cmd_guided) {
             gmic_substitute_args();
             float radius = 0, regularization = 0;
             *argz = *argc = 0;
@@ -7011,7 +10625,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Draw graph.
-          if (!std::strcmp("-graph",command)) {
+          if (command_id==gmic_cmd_graph) {
             gmic_substitute_args();
             double ymin = 0, ymax = 0, xmin = 0, xmax = 0;
             unsigned int plot_type = 1, vertex_type = 1;
@@ -7134,7 +10748,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         else if (command1=='h') {
 
           // Histogram.
-          if (!std::strcmp("-histogram",command)) {
+          if (command_id==gmic_cmd_histogram) {
             gmic_substitute_args();
             float nb_levels = 256;
             bool no_min_max = false;
@@ -7193,16 +10807,16 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // HSI to RGB.
-          gmic_simple_command("-hsi2rgb",HSItoRGB,"Convert image%s from HSI to RGB color bases.");
+          gmic_simple_command(hsi2rgb,HSItoRGB,"Convert image%s from HSI to RGB color bases.");
 
           // HSL to RGB.
-          gmic_simple_command("-hsl2rgb",HSLtoRGB,"Convert image%s from HSL to RGB color bases.");
+          gmic_simple_command(hsl2rgb,HSLtoRGB,"Convert image%s from HSL to RGB color bases.");
 
           // HSV to RGB.
-          gmic_simple_command("-hsv2rgb",HSVtoRGB,"Convert image%s from HSV to RGB color bases.");
+          gmic_simple_command(hsv2rgb,HSVtoRGB,"Convert image%s from HSV to RGB color bases.");
 
           // Compute Hessian.
-          if (!std::strcmp("-hessian",command)) {
+          if (command_id==gmic_cmd_hessian) {
             gmic_substitute_args();
             *argx = 0;
             if (cimg_sscanf(argument,"%255[xyz]%c",
@@ -7242,7 +10856,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         else if (command1=='i' && !(command[2]=='f' && !command[3])) {   // (Skip for '-if').
 
           // Draw image.
-          if (!std::strcmp("-image",command)) {
+          if (command_id==gmic_cmd_image) {
             gmic_substitute_args();
             name.assign(256);
             float x = 0, y = 0, z = 0, c = 0, max_opacity_mask = 1;
@@ -7328,7 +10942,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Index image with a LUT.
-          if (!std::strcmp("-index",command)) {
+          if (command_id==gmic_cmd_index) {
             gmic_substitute_args();
             unsigned int lut_type = 0, map_indexes = 0;
             float dithering = 0;
@@ -7371,10 +10985,10 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Matrix inverse.
-          gmic_simple_command("-invert",invert,"Invert matrix image%s.");
+          gmic_simple_command(invert,invert,"Invert matrix image%s.");
 
           // Extract 3d isoline.
-          if (!std::strcmp("-isoline3d",command)) {
+          if (command_id==gmic_cmd_isoline3d) {
             gmic_substitute_args();
             float x0 = -3, y0 = -3, x1 = 3, y1 = 3, dx = 256, dy = 256;
             sep = sepx = sepy = *formula = 0;
@@ -7466,7 +11080,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Extract 3d isosurface.
-          if (!std::strcmp("-isosurface3d",command)) {
+          if (command_id==gmic_cmd_isosurface3d) {
             gmic_substitute_args();
             float x0 = -3, y0 = -3, z0 = -3, x1 = 3, y1 = 3, z1 = 3,
               dx = 32, dy = 32, dz = 32;
@@ -7588,7 +11202,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Inpaint.
-          if (!std::strcmp("-inpaint",command)) {
+          if (command_id==gmic_cmd_inpaint) {
             gmic_substitute_args();
             float patch_size = 11, lookup_size = 22, lookup_factor = 0.5, lookup_increment = 1,
               blend_size = 0, blend_threshold = 0, blend_decay = 0.05f, blend_scales = 10;
@@ -7675,7 +11289,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         else if (command1=='k') {
 
           // Keep images.
-          if (!std::strcmp("-keep",command)) {
+          if (command_id==gmic_cmd_keep) {
             print(images,0,"Keep image%s",
                   gmic_selection.data());
             CImgList<T> nimages(selection.height());
@@ -7698,7 +11312,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
               nimages_names.swap(images_names);
             }
             if (is_verbose) {
-              cimg::mutex(29);
+              gmic_lock_output();
               std::fprintf(cimg::output()," (%u image%s left).",
                            images.size(),images.size()==1?"":"s");
               std::fflush(cimg::output());
@@ -7715,7 +11329,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         else if (command1=='l') {
 
           // Start local environnement.
-          if (!std::strcmp("-local",command)) {
+          if (command_id==gmic_cmd_local) {
             if (debug_line!=~0U) {
               cimg_snprintf(argx,_argx.width(),"*local#%u",debug_line);
               CImg<char>::string(argx).move_to(callstack);
@@ -7758,27 +11372,21 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
             try {
               if (next_debug_line!=~0U) { debug_line = next_debug_line; next_debug_line = ~0U; }
               if (next_debug_filename!=~0U) { debug_filename = next_debug_filename; next_debug_filename = ~0U; }
-              _run(commands_line,position,nimages,nimages_names,images,images_names,variables_sizes,is_noarg,0);
+              _run(commands_line,position,nimages,nimages_names,images,images_names,variables_sizes,is_noarg,0,
+                   &commands_info);
             } catch (gmic_exception &e) {
-              int nb_locals = 0;
-              for (nb_locals = 1; nb_locals && position<commands_line.size(); ++position) {
-                const char *const it = commands_line[position].data();
-                if (*it==1 &&
-                    cimg_sscanf(commands_line[position].data() + 1,"%x,%x",&_debug_line,&(_debug_filename=0))>0) {
-                  is_debug_info = true; next_debug_line = _debug_line; next_debug_filename = _debug_filename;
-                } else if (!std::strcmp("-local",it) || !std::strcmp("-l",it) ||
-                           !std::strcmp("--local",it) || !std::strcmp("--l",it) ||
-                           !std::strncmp("-local[",it,7) || !std::strncmp("-l[",it,3) ||
-                           !std::strncmp("--local[",it,8) || !std::strncmp("--l[",it,4)) ++nb_locals;
-                else if (!std::strcmp("-endlocal",it) || !std::strcmp("-endl",it)) --nb_locals;
-                else if (nb_locals==1 && !std::strcmp("-onfail",it)) break;
-              }
+              const unsigned int position_onfail = gmic_block_end(position,5);
+              const bool is_onfail = position_onfail!=~0U && !std::strcmp("-onfail",commands_line[position_onfail]);
+              const unsigned int nposition = position_onfail==~0U?commands_line.size():
+                is_onfail?position_onfail:position_onfail + 1;
+              gmic_skip_debug_info(position,nposition);
+              position = nposition;
               if (callstack.size()>local_callstack_size) callstack.remove(local_callstack_size,callstack.size() - 1);
-              if (nb_locals==1 && position<commands_line.size()) { // Onfail block found.
+              if (is_onfail) { // Onfail block found.
                 if (is_very_verbose) print(images,0,"Reach '-onfail' block.");
                 try {
                   _run(commands_line,++position,nimages,nimages_names,
-                       parent_images,parent_images_names,variables_sizes,is_noarg,0);
+                       parent_images,parent_images_names,variables_sizes,is_noarg,0,&commands_info);
                 } catch (gmic_exception &e) {
                   cimg::swap(exception._command_help,e._command_help);
                   cimg::swap(exception._message,e._message);
@@ -7819,7 +11427,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Less or equal.
-          gmic_arithmetic_command("-le",
+          gmic_arithmetic_command(le,
                                   operator_le,"Compute boolean 'less or equal than' between image%s "
                                   "and %g%s",
                                   gmic_selection.data(),value,ssep,T,
@@ -7832,7 +11440,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   "Compute boolean 'less or equal than' between image%s");
 
           // Less than.
-          gmic_arithmetic_command("-lt",
+          gmic_arithmetic_command(lt,
                                   operator_lt,
                                   "Compute boolean 'less than' between image%s and %g%s",
                                   gmic_selection.data(),value,ssep,T,
@@ -7844,16 +11452,16 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   "Compute boolean 'less than' between image%s");
 
           // Logarithm, base-e.
-          gmic_simple_command("-log",log,"Compute pointwise base-e logarithm of image%s.");
+          gmic_simple_command(log,log,"Compute pointwise base-e logarithm of image%s.");
 
           // Logarithm, base-2.
-          gmic_simple_command("-log2",log2,"Compute pointwise base-2 logarithm of image%s.");
+          gmic_simple_command(log2,log2,"Compute pointwise base-2 logarithm of image%s.");
 
           // Logarithm, base-10.
-          gmic_simple_command("-log10",log10,"Compute pointwise base-10 logarithm of image%s.");
+          gmic_simple_command(log10,log10,"Compute pointwise base-10 logarithm of image%s.");
 
           // Draw line.
-          if (!std::strcmp("-line",command)) {
+          if (command_id==gmic_cmd_line) {
             gmic_substitute_args();
             *argx = *argy = *argz = *argc = *color = 0;
             float x0 = 0, y0 = 0, x1 = 0, y1 = 0;
@@ -7908,10 +11516,10 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Lab to RGB
-          gmic_simple_command("-lab2rgb",LabtoRGB,"Convert image%s from Lab to RGB color bases.");
+          gmic_simple_command(lab2rgb,LabtoRGB,"Convert image%s from Lab to RGB color bases.");
 
           // Label connected components.
-          if (!std::strcmp("-label",command)) {
+          if (command_id==gmic_cmd_label) {
             gmic_substitute_args();
             unsigned int is_high_connectivity = 0;
             float tolerance = 0;
@@ -7928,7 +11536,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Set 3d light position.
-          if (!std::strcmp("-light3d",item)) {
+          if (item_id==gmic_cmd_light3d) {
             gmic_substitute_args();
             float lx = 0, ly = 0, lz = -5e8f;
             sep = 0;
@@ -7963,7 +11571,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         else if (command1=='m') {
 
           // Move images.
-          if (!std::strcmp("-move",command)) {
+          if (command_id==gmic_cmd_move) {
             gmic_substitute_args();
             float pos = 0;
             sep = 0;
@@ -8016,7 +11624,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Mirror.
-          if (!std::strcmp("-mirror",command)) {
+          if (command_id==gmic_cmd_mirror) {
             gmic_substitute_args();
             bool is_valid_argument = *argument!=0;
             if (is_valid_argument) for (const char *s = argument; *s; ++s) {
@@ -8034,7 +11642,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Manage mutexes.
-          if (!std::strcmp("-mutex",item)) {
+          if (item_id==gmic_cmd_mutex) {
             gmic_substitute_args();
             unsigned int number, is_lock = 1;
             if ((cimg_sscanf(argument,"%u%c",
@@ -8050,8 +11658,32 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
             ++position; continue;
           }
 
+          // Manage memory profile ('on', 'off' or 'print').
+          // Memory is measured as the size of image lists, at command boundaries only (buffers allocated and
+          // freed during a command are not seen). So are the values of variables '_mem' and '_mem_peak'.
+          if (item_id==gmic_cmd_memory_profile) {
+            gmic_substitute_args();
+            _gmic_memory_profile &profile = *(_gmic_memory_profile*)memory_profile;
+            unsigned long long current, peak;
+            if (!std::strcmp(argument,"on")) {
+              print(images,0,"Start memory profile.");
+              profile.start();
+            } else if (!std::strcmp(argument,"off")) {
+              print(images,0,"Stop memory profile.");
+              if (profile.is_enabled) print_memory_profile(images);
+              profile.stop();
+            } else if (!std::strcmp(argument,"print")) {
+              if (profile.is_enabled) print_memory_profile(images);
+              else print(images,0,"Print memory profile (not started).");
+            } else arg_error("memory_profile");
+            gmic_memory_stats(gmic_list_size(images),current,peak);
+            cimg_snprintf(title,_title.width(),"%g,%g",(double)current,(double)peak);
+            CImg<char>::string(title).move_to(status);
+            ++position; continue;
+          }
+
           // Multiplication.
-          gmic_arithmetic_command("-mul",
+          gmic_arithmetic_command(mul,
                                   operator*=,
                                   "Multiply image%s by %g%s",
                                   gmic_selection.data(),value,ssep,Tfloat,
@@ -8062,7 +11694,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   gmic_selection.data(),gmic_argument_text_printed(),
                                   "Multiply image%s");
           // Modulo.
-          gmic_arithmetic_command("-mod",
+          gmic_arithmetic_command(mod,
                                   operator%=,
                                   "Compute pointwise modulo of image%s by %g%s",
                                   gmic_selection.data(),value,ssep,T,
@@ -8074,7 +11706,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   "Compute sequential pointwise modulo of image%s");
 
           // Max.
-          gmic_arithmetic_command("-max",
+          gmic_arithmetic_command(max,
                                   max,
                                   "Compute pointwise maximum between image%s and %g%s",
                                   gmic_selection.data(),value,ssep,T,
@@ -8085,7 +11717,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   gmic_selection.data(),gmic_argument_text_printed(),
                                   "Compute pointwise maximum of all image%s together");
           // Min.
-          gmic_arithmetic_command("-min",
+          gmic_arithmetic_command(min,
                                   min,
                                   "Compute pointwise minimum between image%s and %g%s",
                                   gmic_selection.data(),value,ssep,T,
@@ -8097,7 +11729,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   "Compute pointwise minimum of image%s");
 
           // Matrix multiplication.
-          gmic_arithmetic_command("-mmul",
+          gmic_arithmetic_command(mmul,
                                   operator*=,
                                   "Multiply matrix/vector%s by %g%s",
                                   gmic_selection.data(),value,ssep,Tfloat,
@@ -8109,7 +11741,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   "Multiply matrix/vector%s");
 
           // Set 3d rendering modes.
-          if (!std::strcmp("-mode3d",item)) {
+          if (item_id==gmic_cmd_mode3d) {
             gmic_substitute_args();
             int mode = 4;
             if (cimg_sscanf(argument,"%d%c",
@@ -8125,7 +11757,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
             continue;
           }
 
-          if (!std::strcmp("-moded3d",item)) {
+          if (item_id==gmic_cmd_moded3d) {
             gmic_substitute_args();
             int mode = -1;
             if (cimg_sscanf(argument,"%d%c",
@@ -8142,7 +11774,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Map LUT.
-          if (!std::strcmp("-map",command)) {
+          if (command_id==gmic_cmd_map) {
             gmic_substitute_args();
             unsigned int lut_type = 0;
             boundary = 0;
@@ -8177,7 +11809,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Median filter.
-          if (!std::strcmp("-median",command)) {
+          if (command_id==gmic_cmd_median) {
             gmic_substitute_args();
             float siz = 3, threshold = 0;
             if ((cimg_sscanf(argument,"%f%c",
@@ -8194,13 +11826,13 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                 print(images,0,"Apply median filter of size %g, on image%s.",
                       siz,
                       gmic_selection.data());
-              cimg_forY(selection,l) gmic_apply(blur_median((unsigned int)siz,threshold));
+              gmic_apply_parallel(blur_median((unsigned int)siz,threshold));
             } else arg_error("median");
             is_released = false; ++position; continue;
           }
 
           // Matrix division.
-          gmic_arithmetic_command("-mdiv",
+          gmic_arithmetic_command(mdiv,
                                   operator/=,
                                   "Divide matrix/vector%s by %g%s",
                                   gmic_selection.data(),value,ssep,Tfloat,
@@ -8212,7 +11844,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   "Divide matrix/vector%s");
 
           // MSE.
-          if (!std::strcmp("-mse",command)) {
+          if (command_id==gmic_cmd_mse) {
             print(images,0,"Compute the %dx%d matrix of MSE values, from image%s.",
                   selection.height(),selection.height(),
                   gmic_selection.data());
@@ -8235,7 +11867,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Draw mandelbrot/julia fractal.
-          if (!std::strcmp("-mandelbrot",command)) {
+          if (command_id==gmic_cmd_mandelbrot) {
             gmic_substitute_args();
             double z0r = -2, z0i = -2, z1r = 2, z1i = 2, paramr = 0, parami = 0;
             unsigned int is_julia = 0;
@@ -8277,7 +11909,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         else if (command1=='n') {
 
           // Set image name.
-          if (!std::strcmp("-name",command) && !is_get_version) {
+          if (command_id==gmic_cmd_name && !is_get_version) {
             gmic_substitute_args();
             print(images,0,"Set name of image%s to '%s'.",
                   gmic_selection.data(),gmic_argument_text_printed());
@@ -8288,7 +11920,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Normalize.
-          if (!std::strcmp("-normalize",command)) {
+          if (command_id==gmic_cmd_normalize) {
             gmic_substitute_args();
             ind0.assign(); ind1.assign();
             sep0 = sep1 = *argx = *argy = 0;
@@ -8339,7 +11971,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Test difference.
-          gmic_arithmetic_command("-neq",
+          gmic_arithmetic_command(neq,
                                   operator_neq,
                                   "Compute boolean inequality between image%s and %g%s",
                                   gmic_selection.data(),value,ssep,T,
@@ -8351,14 +11983,14 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   "Compute boolean inequality between image%s");
 
           // Discard custom command arguments.
-          if (!std::strcmp("-noarg",item)) {
+          if (item_id==gmic_cmd_noarg) {
             print(images,0,"Discard command arguments.");
             if (is_noarg) *is_noarg = true;
             continue;
           }
 
           // Add noise.
-          if (!std::strcmp("-noise",command)) {
+          if (command_id==gmic_cmd_noise) {
             gmic_substitute_args();
             int noise_type = 0;
             float sigma = 0;
@@ -8394,30 +12026,21 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         else if (command1=='o') {
 
           // Exception handling in local environments.
-          if (!std::strcmp("-onfail",item)) {
+          if (item_id==gmic_cmd_onfail) {
             const CImg<char> &s = callstack.back();
             if (s[0]!='*' || s[1]!='l')
               error(images,0,0,
                     "Command '-onfail': Not associated to a '-local' command within "
                     "the same scope.");
-            for (int nb_locals = 1; nb_locals && position<commands_line.size(); ++position) {
-              const char *const it = commands_line[position].data();
-              if (*it==1 &&
-                  cimg_sscanf(commands_line[position].data() + 1,"%x,%x",&_debug_line,&(_debug_filename=0))>0) {
-                is_debug_info = true; next_debug_line = _debug_line; next_debug_filename = _debug_filename;
-              } else if (!std::strcmp("-local",it) || !std::strcmp("-l",it) ||
-                         !std::strcmp("--local",it) || !std::strcmp("--l",it) ||
-                         !std::strncmp("-local[",it,7) || !std::strncmp("-l[",it,3) ||
-                         !std::strncmp("--local[",it,8) || !std::strncmp("--l[",it,4)) ++nb_locals;
-              else if (!std::strcmp("-endlocal",it) || !std::strcmp("-endl",it)) {
-                --nb_locals; if (!nb_locals) --position;
-              }
-            }
+            const unsigned int position_endlocal = gmic_block_end(position,4);
+            const unsigned int nposition = position_endlocal!=~0U?position_endlocal:commands_line.size();
+            gmic_skip_debug_info(position,nposition);
+            position = nposition;
             continue;
           }
 
           // Draw 3d object.
-          if (!std::strcmp("-object3d",command)) {
+          if (command_id==gmic_cmd_object3d) {
             gmic_substitute_args();
             float x = 0, y = 0, z = 0;
             unsigned int
@@ -8540,7 +12163,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Bitwise or.
-          gmic_arithmetic_command("-or",
+          gmic_arithmetic_command(or,
                                   operator|=,
                                   "Compute bitwise OR of image%s by %g%s",
                                   gmic_selection.data(),value,ssep,Tlong,
@@ -8552,7 +12175,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   "Compute sequential bitwise OR of image%s");
 
           // Set 3d object opacity.
-          if (!std::strcmp("-opacity3d",command)) {
+          if (command_id==gmic_cmd_opacity3d) {
             gmic_substitute_args();
             value = 1;
             if (cimg_sscanf(argument,"%lf%c",
@@ -8578,7 +12201,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Output.
-          if (!std::strcmp("-output",command) && !is_get_version) {
+          if (command_id==gmic_cmd_output && !is_get_version) {
             gmic_substitute_args();
 
             // Set good alias for shared variables.
@@ -8622,6 +12245,15 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
             CImg<char> uext = CImg<char>::string(ext);
             cimg::uncase(uext);
 
+            // Replace output files that are mapped (instead of overwriting them).
+            if (mapped.siz) {
+              mapped.detach(_filename);
+              if (selection.height()>1) cimg_forY(selection,l) {
+                  cimg::number_filename(filename,l,6,formula);
+                  mapped.detach(formula);
+                }
+            }
+
             if (!cimg::strcasecmp(ext,"off")) {
               *formula = 0;
               std::strncpy(formula,filename,_formula.width() - 1);
@@ -9166,7 +12798,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         else if (command1=='p') {
 
           // Pass image from parent context.
-          if (!std::strcmp("-pass",command)) {
+          if (command_id==gmic_cmd_pass) {
             gmic_substitute_args();
             unsigned int shared_state = 2;
             if (cimg_sscanf(argument,"%u%c",&shared_state,&end)==1 && shared_state<=2) ++position;
@@ -9177,6 +12809,8 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                   shared_state==1?"in shared state":"using adaptive state",
                   selection.height()>1?"s":"");
 
+            // Compact images of the parent environment are passed as (compact) copies, so that they stay compact
+            // in the parent. Only images passed in shared state are uncompacted, to share their pixels.
             cimg_forY(selection,l) {
               CImg<T> &img = parent_images[selection[l]];
               const T *p = 0;
@@ -9198,7 +12832,9 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                         "(has been re-allocated in current context or reserved by another thread).",
                                         selection[l]);
               } else { // Easy case, parent image not in the current selection.
-                images.insert(img,~0U,(bool)shared_state);
+                const bool is_compact = gmic_compact_info(img)!=0;
+                if (is_compact && shared_state==1) gmic_uncompact(img);
+                images.insert(img,~0U,shared_state==1 || (shared_state==2 && !is_compact));
                 images_names.insert(parent_images_names[selection[l]].get_copymark());
               }
             }
@@ -9206,114 +12842,102 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Run multiple commands in parallel.
-          if (!std::strcmp("-parallel",item)) {
+          // In mode 'process', each command runs in a worker process: only its images, their names and
+          // its status (for the first command) are sent back. Variables it sets (including global
+          // variables '_*'), commands it defines and other changes of its interpreter are lost.
+          if (item_id==gmic_cmd_parallel) {
             gmic_substitute_args();
             const char *_arg = argument, *_arg_text = gmic_argument_text_printed();
-            bool wait_mode = true;
+            bool wait_mode = true, is_process_mode = false;
             if ((*_arg=='0' || *_arg=='1') && (_arg[1]==',' || !_arg[1])) {
               wait_mode = (bool)(*_arg - '0'); _arg+=2; _arg_text+=2;
+            } else if (!std::strncmp(_arg,"process,",8)) {
+              is_process_mode = true; _arg+=8; _arg_text+=8;
             }
+#if cimg_OS!=1
+            if (is_process_mode)
+              error(images,0,"parallel",
+                    "Command '-parallel': Mode 'process' is not supported on this platform.");
+#endif // #if cimg_OS!=1
+#if defined(gmic_is_parallel) && cimg_OS==1
+            if (is_process_mode && gmic_thread_pool().running())
+              error(images,0,"parallel",
+                    "Command '-parallel': Mode 'process' cannot be used while other threads of the "
+                    "interpreter are running (e.g. from '-async' or '-parallel').");
+#endif // #if defined(gmic_is_parallel) && cimg_OS==1
             CImgList<char> arguments = CImg<char>::string(_arg).get_split(CImg<char>::vector(','),0,false);
             CImg<st_gmic_parallel<T> >(1,arguments.width()).move_to(threads_data);
             CImg<st_gmic_parallel<T> > &_threads_data = threads_data.back();
+            _gmic_parallel_group *const group = new _gmic_parallel_group(arguments.width());
+            _threads_data[0].is_group_owner = true;
 
+            if (is_process_mode)
+              print(images,0,"Execute %d command%s '%s' in parallel worker processes.",
+                    arguments.width(),arguments.width()>1?"s":"",_arg_text);
 #ifdef gmic_is_parallel
-            print(images,0,"Execute %d command%s '%s' in parallel%s.",
-                  arguments.width(),arguments.width()>1?"s":"",_arg_text,
-                  wait_mode?" and wait thread termination immediately":
-                  " and wait thread termination when current environment ends");
+            else print(images,0,"Execute %d command%s '%s' in parallel%s.",
+                       arguments.width(),arguments.width()>1?"s":"",_arg_text,
+                       wait_mode?" and wait thread termination immediately":
+                       " and wait thread termination when current environment ends");
 #else // #ifdef gmic_is_parallel
-            print(images,0,"Execute %d commands '%s' (run sequentially, "
-                  "parallel computing disabled).",
-                  arguments.width(),_arg_text);
+            else print(images,0,"Execute %d commands '%s' (run sequentially, "
+                       "parallel computing disabled).",
+                       arguments.width(),_arg_text);
 #endif // #ifdef gmic_is_parallel
 
             // Prepare thread structures.
             cimg_forY(_threads_data,l) {
-              gmic &gi = _threads_data[l].gmic_instance;
-              for (unsigned int i = 0; i<512; ++i) {
-                gi.commands[i].assign(commands[i],true);
-                gi.commands_names[i].assign(commands_names[i],true);
-                gi.commands_has_arguments[i].assign(commands_has_arguments[i],true);
-
-                if (i==511) { // Share inter-thread global variables.
-                  gi.variables[i] = variables[i];
-                  gi.variables_names[i] = variables_names[i];
-                } else {
-                  if (i==510) { // Make a copy of single-thread global variables.
-                    gi._variables[i].assign(_variables[i]);
-                    gi._variables_names[i].assign(_variables_names[i]);
-                    _threads_data[l].variables_sizes[i] = variables_sizes[i];
-                  } else _threads_data[l].variables_sizes[i] = 0;
-                  gi.variables[i] = &gi._variables[i];
-                  gi.variables_names[i] = &gi._variables_names[i];
-                }
-              }
-
-              gi.callstack.assign(callstack);
-              gi.commands_files.assign(commands_files,true);
               cimg_snprintf(title,_title.width(),"*thread%d",l);
-              CImg<char>::string(title).move_to(gi.callstack);
-              gi.light3d.assign(light3d);
-              gi.status.assign(status);
-              gi.debug_filename = debug_filename;
-              gi.debug_line = debug_line;
-              gi.focale3d = focale3d;
-              gi.light3d_x = light3d_x;
-              gi.light3d_y = light3d_y;
-              gi.light3d_z = light3d_z;
-              gi.specular_lightness3d = specular_lightness3d;
-              gi.specular_shininess3d = specular_shininess3d;
-              gi._progress = 0;
-              gi.progress = &gi._progress;
-              gi.is_released = is_released;
-              gi.is_debug = is_debug;
-              gi.is_start = false;
-              gi.is_quit = false;
-              gi.is_return = false;
-              gi.is_double3d = is_double3d;
-              gi.check_elif = false;
-              gi.verbosity = verbosity;
-              gi.render3d = render3d;
-              gi.renderd3d = renderd3d;
-              gi._is_abort = _is_abort;
-              gi.is_abort = is_abort;
-              gi.is_abort_thread = false;
-              gi.nb_carriages = nb_carriages;
-              gi.reference_time = reference_time;
+              gmic_prepare_thread(_threads_data[l],*this,title,!wait_mode); // Not waited: parent keeps running.
               _threads_data[l].images = &images;
               _threads_data[l].images_names = &images_names;
               _threads_data[l].parent_images = &parent_images;
               _threads_data[l].parent_images_names = &parent_images_names;
               _threads_data[l].threads_data = &threads_data;
               _threads_data[l].is_thread_running = true;
+              _threads_data[l].group = group;
+              // Barriers and semaphores are not shared between worker processes.
+              _threads_data[l].gmic_instance.parallel_group = is_process_mode?0:group;
 
-              // Substitute special characters codes appearing outside strings.
               arguments[l].resize(1,arguments[l].height() + 1,1,1,0);
-              bool is_dquoted = false;
-              for (char *s = arguments[l].data(); *s; ++s) {
-                const char c = *s;
-                if (c=='\"') is_dquoted = !is_dquoted;
-                if (!is_dquoted) *s = c<' '?(c==_dollar?'$':c==_lbrace?'{':c==_rbrace?'}':
-                                             c==_comma?',':c==_dquote?'\"':c):c;
-              }
-              gi.commands_line_to_CImgList(arguments[l].data()).
+              _threads_data[l].gmic_instance.
+                commands_line_to_CImgList(gmic_strreplace_unquoted(arguments[l].data())).
                 move_to(_threads_data[l].commands_line);
             }
 
+#if cimg_OS==1
+            // Run worker processes, and wait for them.
+            if (is_process_mode) {
+              gmic_exception exception;
+              const int failed = gmic_parallel_processes(_threads_data,images,images_names,status,exception,
+                                                         is_abort,&is_abort_thread);
+              threads_data.remove();
+              if (failed==-2) throw CImgAbortException("");
+              if (failed>=0)
+                error(images,0,"parallel",
+                      "Command '-parallel': Worker process #%d could not be created or terminated abnormally.",
+                      failed);
+              if (exception._message) throw exception;
+              is_released = false; ++position; continue;
+            }
+#endif // #if cimg_OS==1
+
             // Run threads.
             cimg_forY(_threads_data,l) {
 #ifdef gmic_is_parallel
 #if cimg_OS!=2
-              pthread_attr_t thread_attr;
-              if( (pthread_attr_init(&thread_attr) == 0) &&
-                  // Reserve 8MB of stack size for the new thread
-                  (pthread_attr_setstacksize(&thread_attr, 8*1024*1024)) == 0)
-                pthread_create(&_threads_data[l].thread_id,&thread_attr,gmic_parallel<T>,
-                               (void*)&_threads_data[l]);
-              else
-                pthread_create(&_threads_data[l].thread_id,0,gmic_parallel<T>,
-                               (void*)&_threads_data[l]);
+              _threads_data[l].job.routine = gmic_parallel<T>;
+              _threads_data[l].job.arg = (void*)&_threads_data[l];
+              if (!gmic_thread_pool().submit(_threads_data[l].job)) {
+                // Release threads already waiting for this one (barriers, semaphores), then fail.
+                _threads_data[l].job.routine = 0;
+                group->abort();
+                for (int k = 0; k<l; ++k) gmic_thread_pool().wait(_threads_data[k].job);
+                threads_data.remove();
+                error(images,0,"parallel",
+                      "Command '-parallel': Cannot create thread #%d (of %d).",
+                      l,arguments.width());
+              }
 #else // #if cimg_OS!=2
               _threads_data[l].thread_id = CreateThread(0,0,gmic_parallel<T>,
                                                         (void*)&_threads_data[l],0,0);
@@ -9329,7 +12953,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
               cimg_forY(_threads_data,l) if (_threads_data[l].is_thread_running) {
 #ifdef gmic_is_parallel
 #if cimg_OS!=2
-                pthread_join(_threads_data[l].thread_id,0);
+                gmic_thread_pool().wait(_threads_data[l].job);
 #else // #if cimg_OS!=2
                 WaitForSingleObject(_threads_data[l].thread_id,INFINITE);
                 CloseHandle(_threads_data[l].thread_id);
@@ -9354,8 +12978,147 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
             ++position; continue;
           }
 
+          // Run a command pipeline on overlapping tiles of images, in parallel.
+          // Threads whose job cannot be queued on the pool run it inline, so no tile is left unprocessed.
+          if (command_id==gmic_cmd_parallel_tiles) {
+            gmic_substitute_args();
+            const char *_argument = argument;
+            unsigned int nb_tiles = 0;
+            float halo = -1;
+            int nb_read = 0;
+            sep = 0;
+            if ((cimg_sscanf(argument,"%f,%n",&halo,&nb_read)==1 ||
+                 (cimg_sscanf(argument,"%f%c,%n",&halo,&sep,&nb_read)==2 && sep=='%')) &&
+                nb_read && halo>=0) {
+              _argument+=nb_read; nb_read = 0;
+              if (cimg_sscanf(_argument,"%u,%n",&nb_tiles,&nb_read)==1 && nb_read) _argument+=nb_read;
+            } else _argument = 0;
+            if (!_argument || !*_argument) arg_error("parallel_tiles");
+            if (!nb_tiles) nb_tiles = 4*gmic_nb_threads(); // Several tiles per thread, for load balancing.
+            const unsigned int nb_threads = cimg::min(nb_tiles,gmic_nb_threads());
+            print(images,0,"Apply command '%s' on %u tiles of image%s, with halo %g%s (%u thread%s).",
+                  is_verbose?gmic::ellipsize(_argument,argument_text,80,false):"",
+                  nb_tiles,gmic_selection.data(),halo,sep=='%'?"%":"",
+                  nb_threads,nb_threads>1?"s":"");
+
+            // Prepare thread structures.
+            CImg<char> arg_tiles = CImg<char>::string(_argument);
+            gmic_strreplace_unquoted(arg_tiles.data());
+            CImg<st_gmic_parallel<T> > _threads_data(1,nb_threads);
+            st_gmic_tiles<T> tiles;
+            cimg_forY(_threads_data,l) {
+              cimg_snprintf(title,_title.width(),"*tiles%d",l);
+              gmic_prepare_thread(_threads_data[l],*this,title);
+              _threads_data[l].images = _threads_data[l].parent_images = &images;
+              _threads_data[l].images_names = _threads_data[l].parent_images_names = &images_names;
+              _threads_data[l].tiles = &tiles;
+              _threads_data[l].gmic_instance.commands_line_to_CImgList(arg_tiles.data()).
+                move_to(_threads_data[l].commands_line);
+            }
+
+            cimg_forY(selection,l) {
+              const unsigned int uind = selection[l];
+              CImg<T> &img = images[uind];
+              gmic_check(img);
+              CImg<T> res(img._width,img._height,img._depth,img._spectrum);
+              if (img) {
+
+                // Split image domain along its largest dimensions.
+                unsigned int nx = 1, ny = 1, nz = 1;
+                while (nx*ny*nz<nb_tiles) {
+                  const float ex = (float)img._width/nx, ey = (float)img._height/ny, ez = (float)img._depth/nz;
+                  if (ex>=ey && ex>=ez && ex>=2) ++nx;
+                  else if (ey>=ez && ey>=2) ++ny;
+                  else if (ez>=2) ++nz;
+                  else break;
+                }
+                tiles.img = &img;
+                tiles.res = &res;
+                tiles.width = img._width; tiles.height = img._height;
+                tiles.depth = img._depth; tiles.spectrum = img._spectrum;
+                tiles.nx = nx; tiles.ny = ny; tiles.nz = nz;
+                tiles.hx = (unsigned int)cimg::round(sep=='%'?halo*img._width/100:halo);
+                tiles.hy = (unsigned int)cimg::round(sep=='%'?halo*img._height/100:halo);
+                tiles.hz = (unsigned int)cimg::round(sep=='%'?halo*img._depth/100:halo);
+                tiles.nb_tiles = nx*ny*nz;
+                tiles.next_tile = 0;
+                tiles.is_failed = false;
+
+                // Run threads and wait for their termination.
+                cimg_forY(_threads_data,k) {
+#ifdef gmic_is_parallel
+#if cimg_OS!=2
+                  _threads_data[k].job.routine = gmic_parallel_tiles<T>;
+                  _threads_data[k].job.arg = (void*)&_threads_data[k];
+                  if (!gmic_thread_pool().submit(_threads_data[k].job)) // No worker available: run inline.
+                    gmic_parallel_tiles<T>((void*)&_threads_data[k]);
+#else // #if cimg_OS!=2
+                  _threads_data[k].thread_id = CreateThread(0,0,gmic_parallel_tiles<T>,
+                                                            (void*)&_threads_data[k],0,0);
+#endif // #if cimg_OS!=2
+#else // #ifdef gmic_is_parallel
+                  gmic_parallel_tiles<T>((void*)&_threads_data[k]);
+#endif // #ifdef gmic_is_parallel
+                }
+#ifdef gmic_is_parallel
+                cimg_forY(_threads_data,k) {
+#if cimg_OS!=2
+                  gmic_thread_pool().wait(_threads_data[k].job);
+#else // #if cimg_OS!=2
+                  WaitForSingleObject(_threads_data[k].thread_id,INFINITE);
+                  CloseHandle(_threads_data[k].thread_id);
+#endif // #if cimg_OS!=2
+                }
+#endif // #ifdef gmic_is_parallel
+
+                // Check for possible exceptions thrown by threads.
+                cimg_forY(_threads_data,k) if (_threads_data[k].exception._message)
+                  throw _threads_data[k].exception;
+              }
+              if (is_get_version) {
+                res.move_to(images);
+                images_names[uind].get_copymark().move_to(images_names);
+              } else res.move_to(images[uind]);
+            }
+            is_released = false; ++position; continue;
+          }
+
+          // Get, set or calibrate thresholds for parallel evaluation.
+          if (item_id==gmic_cmd_parallel_thresholds) {
+            gmic_substitute_args();
+            gmic_parallel_thresholds &thresholds = _gmic_parallel_thresholds;
+            if (!std::strcmp(argument,"get"))
+              print(images,0,"Get thresholds for parallel evaluation.");
+            else if (!std::strcmp(argument,"calibrate")) {
+#ifdef cimg_use_openmp
+              print(images,0,"Calibrate thresholds for parallel evaluation.");
+              gmic_calibrate_parallel_thresholds();
+              if (!gmic_save_parallel_thresholds())
+                warn(images,0,false,
+                     "Command '-parallel_thresholds': Cannot save thresholds in resource directory '%s'.",
+                     gmic::path_rc());
+#else // #ifdef cimg_use_openmp
+              error(images,0,"parallel_thresholds",
+                    "Command '-parallel_thresholds': Calibration requires OpenMP support.");
+#endif // #ifdef cimg_use_openmp
+            } else {
+              cimg::mutex(25);
+              const bool is_valid = gmic_parse_parallel_thresholds(argument,thresholds);
+              cimg::mutex(25,0);
+              if (!is_valid) arg_error("parallel_thresholds");
+              print(images,0,"Set thresholds for parallel evaluation to '%s'.",
+                    gmic_argument_text_printed());
+              gmic_apply_max_threads();
+            }
+            cimg_snprintf(title,_title.width(),"%lu,%lu,%u,%u,%u",
+                          thresholds.pointwise_size,thresholds.selection_size,
+                          thresholds.expression_width,thresholds.expression_length,thresholds.max_threads);
+            CImg<char>::string(title).move_to(status);
+            ++position; continue;
+          }
+
           // Permute axes.
-          if (!std::strcmp("-permute",command)) {
+          if (command_id==gmic_cmd_permute) {
             gmic_substitute_args();
             print(images,0,"Permute axes of image%s, with permutation '%s'.",
                   gmic_selection.data(),gmic_argument_text_printed());
@@ -9364,7 +13127,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Set progress indice.
-          if (!std::strcmp("-progress",item)) {
+          if (item_id==gmic_cmd_progress) {
             gmic_substitute_args();
             value = -1;
             if (cimg_sscanf(argument,"%lf%c",
@@ -9381,13 +13144,13 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Print.
-          if (!std::strcmp("-print",command) && !is_get_version) {
+          if (command_id==gmic_cmd_print && !is_get_version) {
             print_images(images,images_names,selection);
             is_released = true; continue;
           }
 
           // Power.
-          gmic_arithmetic_command("-pow",
+          gmic_arithmetic_command(pow,
                                   pow,
                                   "Compute image%s to the power of %g%s",
                                   gmic_selection.data(),value,ssep,Tfloat,
@@ -9399,7 +13162,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   "Compute sequential power of image%s");
 
           // Draw point.
-          if (!std::strcmp("-point",command)) {
+          if (command_id==gmic_cmd_point) {
             gmic_substitute_args();
             float x = 0, y = 0, z = 0;
             sepx = sepy = sepz = *argx = *argy = *argz = *color = 0;
@@ -9445,7 +13208,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Draw polygon.
-          if (!std::strcmp("-polygon",command)) {
+          if (command_id==gmic_cmd_polygon) {
             gmic_substitute_args();
             name.assign(256);
             float N = 0, x0 = 0, y0 = 0;
@@ -9521,7 +13284,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Draw plasma fractal.
-          if (!std::strcmp("-plasma",command)) {
+          if (command_id==gmic_cmd_plasma) {
             gmic_substitute_args();
             float alpha = 1, beta = 1, scale = 8;
             if ((cimg_sscanf(argument,"%f%c",
@@ -9543,7 +13306,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Convert 3d object primitives.
-          if (!std::strcmp("-primitives3d",command)) {
+          if (command_id==gmic_cmd_primitives3d) {
             gmic_substitute_args();
             unsigned int mode = 0;
             if (cimg_sscanf(argument,"%u%c",
@@ -9570,7 +13333,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Display as a graph plot.
-          if (!std::strcmp("-plot",command) && !is_get_version) {
+          if (command_id==gmic_cmd_plot && !is_get_version) {
             gmic_substitute_args();
             double ymin = 0, ymax = 0, xmin = 0, xmax = 0;
             unsigned int plot_type = 1, vertex_type = 1;
@@ -9635,7 +13398,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         else if (command1=='q') {
 
           // Draw quiver.
-          if (!std::strcmp("-quiver",command)) {
+          if (command_id==gmic_cmd_quiver) {
             gmic_substitute_args();
             float sampling = 25, factor = -20;
             unsigned int is_arrows = 1;
@@ -9694,7 +13457,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         else if (command1=='r') {
 
           // Remove images.
-          if (!std::strcmp("-remove",command)) {
+          if (command_id==gmic_cmd_remove) {
             print(images,0,"Remove image%s",
                   gmic_selection.data());
             CImgList<T> _images;
@@ -9706,7 +13469,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
               _images_names.move_to(images_names,0);
             }
             if (is_verbose) {
-              cimg::mutex(29);
+              gmic_lock_output();
               std::fprintf(cimg::output()," (%u image%s left).",
                            images.size(),images.size()==1?"":"s");
               std::fflush(cimg::output());
@@ -9716,11 +13479,12 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Repeat.
-          if (!std::strcmp("-repeat",item)) {
-            gmic_substitute_args();
+          if (item_id==gmic_cmd_repeat) {
+            const bool is_numeric = get_numeric_variable(argument,value,variables_sizes);
             float number = 0;
             *title  = 0;
-            if (cimg_sscanf(argument,"%f%c",&number,&end)==1 ||
+            if (is_numeric) number = (float)value; else gmic_substitute_args();
+            if (is_numeric || cimg_sscanf(argument,"%f%c",&number,&end)==1 ||
                 (cimg_sscanf(argument,"%f,%255[a-zA-Z0-9_]%c",&number,title,&sep)==2 &&
                  (*title<'0' || *title>'9'))) {
               const unsigned int nb = number<=0?0U:
@@ -9740,11 +13504,18 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                 CImg<unsigned int> rd(1,3 + (l?2:0));
                 rd[0] = position + 1; rd[1] = nb; rd[2] = 0;
                 if (l) {
-                  const unsigned int hashcode = gmic::hashcode(title,true);
-                  rd[3] = hashcode;
-                  rd[4] = variables[hashcode]->_width;
-                  CImg<char>::string(title).move_to(*variables_names[hashcode]);
-                  CImg<char>::string("0").move_to(*variables[hashcode]);
+                  CImg<char> counter;
+                  gmic_set_numeric_variable(counter,0);
+                  if (*title=='_') { // Global counter.
+                    const unsigned int kind = title[1]=='_'?2:1;
+                    rd[3] = kind;
+                    rd[4] = variables[kind - 1]->_width;
+                    CImg<char>::string(title).move_to(*variables_names[kind - 1]);
+                    counter.move_to(*variables[kind - 1]);
+                  } else {
+                    rd[3] = 0;
+                    rd[4] = ((_gmic_variables*)local_variables)->push(title,counter);
+                  }
                 }
                 rd.move_to(repeatdones);
               } else {
@@ -9753,15 +13524,13 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                     title);
                   else print(images,0,"Skip 'repeat..done' block (0 iteration).");
                 }
-                int nb_repeats = 0;
-                for (nb_repeats = 1; nb_repeats && position<commands_line.size(); ++position) {
-                  const char *it = commands_line[position].data();
-                  if (!std::strcmp("-repeat",it)) ++nb_repeats;
-                  else if (!std::strcmp("-done",it)) --nb_repeats;
-                }
-                if (nb_repeats && position>=commands_line.size())
+                const unsigned int position_done = gmic_block_end(position,2);
+                if (position_done==~0U) {
+                  position = commands_line.size();
                   error(images,0,0,
                         "Command '-repeat': Missing associated '-done' command.");
+                }
+                position = position_done + 1;
                 continue;
               }
             } else arg_error("repeat");
@@ -9769,7 +13538,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Resize.
-          if (!std::strcmp("-resize",command)) {
+          if (command_id==gmic_cmd_resize) {
             gmic_substitute_args();
             float valx = 100, valy = 100, valz = 100, valc = 100, cx = 0, cy = 0, cz = 0, cc = 0;
             CImg<char> indicesy(256), indicesz(256), indicesc(256);
@@ -9949,7 +13718,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Reverse positions.
-          if (!std::strcmp("-reverse",command)) {
+          if (command_id==gmic_cmd_reverse) {
             print(images,0,"Reverse positions of image%s.",
                   gmic_selection.data());
             if (is_get_version) cimg_forY(selection,l) {
@@ -9965,7 +13734,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Return.
-          if (!std::strcmp("-return",item)) {
+          if (item_id==gmic_cmd_return) {
             if (is_very_verbose) print(images,0,"Return.");
             position = commands_line.size();
             while (callstack && callstack.back()[0]=='*') {
@@ -9980,7 +13749,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Keep rows.
-          if (!std::strcmp("-rows",command)) {
+          if (command_id==gmic_cmd_rows) {
             gmic_substitute_args();
             ind0.assign(); ind1.assign();
             sep0 = sep1 = *argx = *argy = 0;
@@ -10033,7 +13802,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Rotate.
-          if (!std::strcmp("-rotate",command)) {
+          if (command_id==gmic_cmd_rotate) {
             gmic_substitute_args();
             float angle = 0, zoom = 1, cx = 0, cy = 0;
             unsigned int interpolation = 1;
@@ -10082,7 +13851,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Round.
-          if (!std::strcmp("-round",command)) {
+          if (command_id==gmic_cmd_round) {
             gmic_substitute_args();
             int rounding_type = 0;
             value = 1;
@@ -10101,7 +13870,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Fill with random values.
-          if (!std::strcmp("-rand",command)) {
+          if (command_id==gmic_cmd_rand) {
             gmic_substitute_args();
             ind0.assign(); ind1.assign();
             sep0 = sep1 = *argx = *argy = 0;
@@ -10153,7 +13922,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Rotate 3d object.
-          if (!std::strcmp("-rotate3d",command)) {
+          if (command_id==gmic_cmd_rotate3d) {
             gmic_substitute_args();
             float u = 0, v = 0, w = 1, angle = 0;
             if (cimg_sscanf(argument,"%f,%f,%f,%f%c",
@@ -10182,14 +13951,14 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // RGB to other color base.
-          gmic_simple_command("-rgb2hsi",RGBtoHSI,"Convert image%s from RGB to HSI color bases.");
-          gmic_simple_command("-rgb2hsl",RGBtoHSL,"Convert image%s from RGB to HSL color bases.");
-          gmic_simple_command("-rgb2hsv",RGBtoHSV,"Convert image%s from RGB to HSV color bases.");
-          gmic_simple_command("-rgb2lab",RGBtoLab,"Convert image%s from RGB to Lab color bases.");
-          gmic_simple_command("-rgb2srgb",RGBtosRGB,"Convert image%s from RGB to sRGB color bases.");
+          gmic_simple_command(rgb2hsi,RGBtoHSI,"Convert image%s from RGB to HSI color bases.");
+          gmic_simple_command(rgb2hsl,RGBtoHSL,"Convert image%s from RGB to HSL color bases.");
+          gmic_simple_command(rgb2hsv,RGBtoHSV,"Convert image%s from RGB to HSV color bases.");
+          gmic_simple_command(rgb2lab,RGBtoLab,"Convert image%s from RGB to Lab color bases.");
+          gmic_simple_command(rgb2srgb,RGBtosRGB,"Convert image%s from RGB to sRGB color bases.");
 
           // Bitwise left rotation.
-          gmic_arithmetic_command("-rol",
+          gmic_arithmetic_command(rol,
                                   rol,
                                   "Compute bitwise left rotation of image%s by %g%s",
                                   gmic_selection.data(),value,ssep,unsigned int,
@@ -10201,7 +13970,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   "Compute sequential bitwise left rotation of image%s");
 
           // Bitwise right rotation.
-          gmic_arithmetic_command("-ror",
+          gmic_arithmetic_command(ror,
                                   ror,
                                   "Compute bitwise right rotation of image%s by %g%s",
                                   gmic_selection.data(),value,ssep,unsigned int,
@@ -10213,7 +13982,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   "Compute sequential bitwise left rotation of image%s");
 
           // Reverse 3d object orientation.
-          if (!std::strcmp("-reverse3d",command)) {
+          if (command_id==gmic_cmd_reverse3d) {
             print(images,0,"Reverse orientation of 3d object%s.",
                   gmic_selection.data());
             cimg_forY(selection,l) {
@@ -10239,8 +14008,30 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         //----------------------------
         else if (command1=='s') {
 
+          // Manage semaphores of the threads of the current '-parallel' call.
+          if (item_id==gmic_cmd_semaphore) {
+            gmic_substitute_args();
+            unsigned int number, value = 0;
+            if ((cimg_sscanf(argument,"%u%c",
+                             &number,&end)==1 ||
+                 cimg_sscanf(argument,"%u,%u%c",
+                             &number,&value,&end)==2) &&
+                number<256) {
+              _gmic_parallel_group *const group = (_gmic_parallel_group*)parallel_group;
+              if (value) print(images,0,"Increment semaphore #%u by %u.",number,value);
+              else print(images,0,"Wait for semaphore #%u.",number);
+              if (!group) {
+                if (!value) error(images,0,"semaphore",
+                                  "Command '-semaphore': Cannot wait for semaphore #%u outside "
+                                  "a '-parallel' thread.",number);
+              } else if (value) group->semaphore_post(number,value);
+              else if (!group->semaphore_wait(number,is_abort)) throw CImgAbortException("");
+            } else arg_error("semaphore");
+            ++position; continue;
+          }
+
           // Set status.
-          if (!std::strcmp("-status",item)) {
+          if (item_id==gmic_cmd_status) {
             gmic_substitute_args();
             print(images,0,"Set status to '%s'.",gmic_argument_text_printed());
             CImg<char>::string(argument).move_to(status);
@@ -10248,7 +14039,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Skip argument.
-          if (!std::strcmp("-skip",item)) {
+          if (item_id==gmic_cmd_skip) {
             gmic_substitute_args();
             if (is_very_verbose)
               print(images,0,"Skip argument '%s'.",
@@ -10257,8 +14048,152 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
             continue;
           }
 
+          // Stream images of a .cimg file through a command pipeline, tile by tile.
+          // Threads whose job cannot be queued on the pool run it inline, as for '-parallel_tiles'.
+          if (item_id==gmic_cmd_stream_cimg) {
+            gmic_substitute_args();
+            const unsigned int siz_arg = (unsigned int)std::strlen(argument) + 1;
+            CImg<char> filename_in(siz_arg), filename_out(siz_arg);
+            const char *_argument = argument;
+            double max_memory = 256*1024*1024.0;
+            float halo = -1;
+            int nb_read = 0;
+            sep = 0;
+            if (cimg_sscanf(argument,"%[^,],%[^,],%n",filename_in.data(),filename_out.data(),&nb_read)==2 &&
+                nb_read) {
+              _argument+=nb_read; nb_read = 0;
+              if ((cimg_sscanf(_argument,"%f,%n",&halo,&nb_read)==1 ||
+                   (cimg_sscanf(_argument,"%f%c,%n",&halo,&sep,&nb_read)==2 && sep=='%')) &&
+                  nb_read && halo>=0) {
+                _argument+=nb_read; nb_read = 0;
+                if (cimg_sscanf(_argument,"%lf,%n",&max_memory,&nb_read)==1 && nb_read) _argument+=nb_read;
+              } else _argument = 0;
+            } else _argument = 0;
+            if (!_argument || !*_argument || max_memory<=0) arg_error("stream_cimg");
+            strreplace_fw(filename_in);
+            strreplace_fw(filename_out);
+            if (!std::strcmp(filename_in,filename_out))
+              error(images,0,"stream_cimg",
+                    "Command '-stream_cimg': Input and output files must be different (file '%s').",
+                    filename_in.data());
+            CImg<unsigned int> dims;
+            unsigned long long end_in = 0, end_out = 64;
+            if (!gmic_cimg_file_dims(filename_in,dims,0,0,&end_in))
+              error(images,0,"stream_cimg",
+                    "Command '-stream_cimg': Cannot read dimensions of uncompressed .cimg file '%s'.",
+                    filename_in.data());
+            cimg_forY(dims,n) // Upper bound of the size of the output file (with 64 bytes per header line).
+              end_out+=64 + (unsigned long long)dims(0,n)*dims(1,n)*dims(2,n)*dims(3,n)*sizeof(T);
+#if cimg_OS!=2
+            // Tiles are read and written by CImg, which seeks with file offsets of type 'long'.
+            if (cimg::max(end_in,end_out)>(unsigned long long)cimg::type<long>::max())
+              error(images,0,"stream_cimg",
+                    "Command '-stream_cimg': Files '%s' and '%s' are too large for the file offsets "
+                    "of this build (%u bits).",
+                    filename_in.data(),filename_out.data(),8*(unsigned int)sizeof(long));
+#endif // #if cimg_OS!=2
+            const unsigned int max_threads = gmic_nb_threads();
+            print(images,0,"Stream %u image%s of file '%s' into file '%s', applying command '%s' on tiles "
+                  "with halo %g%s and memory budget %g MB (%u thread%s max.).",
+                  dims._height,dims._height>1?"s":"",filename_in.data(),filename_out.data(),
+                  is_verbose?gmic::ellipsize(_argument,argument_text,80,false):"",
+                  halo,sep=='%'?"%":"",max_memory/(1024*1024),max_threads,max_threads>1?"s":"");
+            mapped.detach(filename_out); // Do not truncate a mapped file.
+            gmic_save_empty_cimg<T>(filename_out,dims);
+
+            // Prepare thread structures.
+            CImg<char> arg_tiles = CImg<char>::string(_argument);
+            gmic_strreplace_unquoted(arg_tiles.data());
+            CImg<st_gmic_parallel<T> > _threads_data(1,max_threads);
+            st_gmic_tiles<T> tiles;
+            tiles.command = "stream_cimg";
+            tiles.filename_in = filename_in;
+            tiles.filename_out = filename_out;
+            cimg_forY(_threads_data,l) {
+              cimg_snprintf(title,_title.width(),"*stream%d",l);
+              gmic_prepare_thread(_threads_data[l],*this,title);
+              _threads_data[l].images = _threads_data[l].parent_images = &images;
+              _threads_data[l].images_names = _threads_data[l].parent_images_names = &images_names;
+              _threads_data[l].tiles = &tiles;
+              _threads_data[l].gmic_instance.commands_line_to_CImgList(arg_tiles.data()).
+                move_to(_threads_data[l].commands_line);
+            }
+
+            cimg_forY(dims,n) {
+              const unsigned int W = dims(0,n), H = dims(1,n), D = dims(2,n), S = dims(3,n);
+              if (!W || !H || !D || !S) continue;
+              tiles.n = n;
+              tiles.width = W; tiles.height = H; tiles.depth = D; tiles.spectrum = S;
+              tiles.hx = (unsigned int)cimg::round(sep=='%'?halo*W/100:halo);
+              tiles.hy = (unsigned int)cimg::round(sep=='%'?halo*H/100:halo);
+              tiles.hz = (unsigned int)cimg::round(sep=='%'?halo*D/100:halo);
+
+              // Split image domain along its largest dimensions, until a tile (with its halo) fits
+              // in the memory budget of its thread (input tile + 3 temporary images of same size).
+              const double max_voxels = max_memory/(4.0*max_threads*S*sizeof(T));
+              unsigned int nx = 1, ny = 1, nz = 1;
+              for (;;) {
+                const float ex = (float)W/nx, ey = (float)H/ny, ez = (float)D/nz;
+                if ((ex + 2*tiles.hx)*(ey + 2*tiles.hy)*(ez + 2*tiles.hz)<=max_voxels) break;
+                if (ex>=ey && ex>=ez && ex>=2*cimg::max(1U,tiles.hx)) ++nx;
+                else if (ey>=ez && ey>=2*cimg::max(1U,tiles.hy)) ++ny;
+                else if (ez>=2*cimg::max(1U,tiles.hz)) ++nz;
+                else break;
+              }
+              const float
+                ex = (float)W/nx + 2*tiles.hx, ey = (float)H/ny + 2*tiles.hy, ez = (float)D/nz + 2*tiles.hz;
+              if (ex*ey*ez>max_voxels)
+                warn(images,0,false,
+                     "Command '-stream_cimg': Smallest tiles (%g,%g,%g,%u) of image #%u exceed the memory "
+                     "budget of %g MB (%g MB needed).",
+                     std::ceil(ex),std::ceil(ey),std::ceil(ez),S,n,max_memory/(1024*1024),
+                     4.0*max_threads*ex*ey*ez*S*sizeof(T)/(1024*1024));
+              tiles.nx = nx; tiles.ny = ny; tiles.nz = nz;
+              tiles.nb_tiles = nx*ny*nz;
+              tiles.next_tile = 0;
+              tiles.is_failed = false;
+              const unsigned int nb_threads = cimg::min(tiles.nb_tiles,max_threads);
+              if (is_very_verbose)
+                print(images,0,"Stream image #%u (%u,%u,%u,%u) as %u tile%s (%u,%u,%u).",
+                      n,W,H,D,S,tiles.nb_tiles,tiles.nb_tiles>1?"s":"",nx,ny,nz);
+
+              // Run threads and wait for their termination.
+              for (unsigned int k = 0; k<nb_threads; ++k) {
+#ifdef gmic_is_parallel
+#if cimg_OS!=2
+                _threads_data[k].job.routine = gmic_parallel_tiles<T>;
+                _threads_data[k].job.arg = (void*)&_threads_data[k];
+                if (!gmic_thread_pool().submit(_threads_data[k].job)) // No worker available: run inline.
+                  gmic_parallel_tiles<T>((void*)&_threads_data[k]);
+#else // #if cimg_OS!=2
+                _threads_data[k].thread_id = CreateThread(0,0,gmic_parallel_tiles<T>,
+                                                          (void*)&_threads_data[k],0,0);
+#endif // #if cimg_OS!=2
+#else // #ifdef gmic_is_parallel
+                gmic_parallel_tiles<T>((void*)&_threads_data[k]);
+#endif // #ifdef gmic_is_parallel
+              }
+#ifdef gmic_is_parallel
+              for (unsigned int k = 0; k<nb_threads; ++k) {
+#if cimg_OS!=2
+                gmic_thread_pool().wait(_threads_data[k].job);
+#else // #if cimg_OS!=2
+                WaitForSingleObject(_threads_data[k].thread_id,INFINITE);
+                CloseHandle(_threads_data[k].thread_id);
+#endif // #if cimg_OS!=2
+              }
+#endif // #ifdef gmic_is_parallel
+
+              // Check for possible exceptions thrown by threads.
+              cimg_forY(_threads_data,k) if (_threads_data[k].exception._message)
+                throw _threads_data[k].exception;
+              if (*is_abort) throw CImgAbortException("");
+            }
+            ++position; continue;
+          }
+
           // Set pixel value.
-          if (!std::strcmp("-set",command)) {
+          if (command_id==gmic_cmd_set) {
             gmic_substitute_args();
             float x = 0, y = 0, z = 0, c = 0;
             value = 0;
@@ -10307,7 +14242,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Split.
-          if (!std::strcmp("-split",command)) {
+          if (command_id==gmic_cmd_split) {
             bool is_valid_argument = false;
             gmic_substitute_args();
             float nb = -1;
@@ -10471,26 +14406,23 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Shared input.
-          if (!std::strcmp("-shared",command)) {
+          if (command_id==gmic_cmd_shared) {
             gmic_substitute_args();
-            CImg<char> st0(256), st1(256), st2(256), st3(256), st4(256);
+            const _gmic_fields fields(argument);
+            const unsigned int nb_fields =
+              !argument[std::strspn(argument,"0123456789.eE%+,")] && fields.is_numeric(true)?fields.nb_fields:0;
             char sep2 = 0, sep3 = 0, sep4 = 0;
             float a0 = 0, a1 = 0, a2 = 0, a3 = 0, a4 = 0;
-            sep0 = sep1 = *st0 = *st1 = *st2 = *st3 = *st4 = 0;
-            if (cimg_sscanf(argument,
-                            "%255[0-9.eE%+],%255[0-9.eE%+],%255[0-9.eE%+],%255[0-9.eE%+],"
-                            "%255[0-9.eE%+]%c",
-                            st0.data(),st1.data(),st2.data(),st3.data(),st4.data(),&end)==5 &&
-                (cimg_sscanf(st0,"%f%c",&a0,&end)==1 ||
-                 (cimg_sscanf(st0,"%f%c%c",&a0,&sep0,&end)==2 && sep0=='%')) &&
-                (cimg_sscanf(st1,"%f%c",&a1,&end)==1 ||
-                 (cimg_sscanf(st1,"%f%c%c",&a1,&sep1,&end)==2 && sep1=='%')) &&
-                (cimg_sscanf(st2,"%f%c",&a2,&end)==1 ||
-                 (cimg_sscanf(st2,"%f%c%c",&a2,&sep2,&end)==2 && sep2=='%')) &&
-                (cimg_sscanf(st3,"%f%c",&a3,&end)==1 ||
-                 (cimg_sscanf(st3,"%f%c%c",&a3,&sep3,&end)==2 && sep3=='%')) &&
-                (cimg_sscanf(st4,"%f%c",&a4,&end)==1 ||
-                 (cimg_sscanf(st4,"%f%c%c",&a4,&sep4,&end)==2 && sep4=='%'))) {
+            sep0 = sep1 = 0;
+            if (nb_fields<=5) {
+              float *const a[] = { &a0,&a1,&a2,&a3,&a4 };
+              char *const seps[] = { &sep0,&sep1,&sep2,&sep3,&sep4 };
+              for (unsigned int k = 0; k<nb_fields; ++k) {
+                *(a[k]) = fields[k];
+                *(seps[k]) = fields.types[k]=='%'?'%':0;
+              }
+            }
+            if (nb_fields==5) {
               print(images,0,
                     "Insert shared buffer%s from points (%g%s->%g%s,%g%s,%g%s,%g%s) of image%s.",
                     selection.height()>1?"s":"",
@@ -10512,18 +14444,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                 images_names.insert(images_names[selection[l]].get_copymark());
               }
               ++position;
-            } else if (cimg_sscanf(argument,
-                                   "%255[0-9.eE%+],%255[0-9.eE%+],%255[0-9.eE%+],"
-                                   "%255[0-9.eE%+],%c",
-                                   st0.data(),st1.data(),st2.data(),st3.data(),&end)==4 &&
-                       (cimg_sscanf(st0,"%f%c",&a0,&end)==1 ||
-                        (cimg_sscanf(st0,"%f%c%c",&a0,&sep0,&end)==2 && sep0=='%')) &&
-                       (cimg_sscanf(st1,"%f%c",&a1,&end)==1 ||
-                        (cimg_sscanf(st1,"%f%c%c",&a1,&sep1,&end)==2 && sep1=='%')) &&
-                       (cimg_sscanf(st2,"%f%c",&a2,&end)==1 ||
-                        (cimg_sscanf(st2,"%f%c%c",&a2,&sep2,&end)==2 && sep2=='%')) &&
-                       (cimg_sscanf(st3,"%f%c",&a3,&end)==1 ||
-                        (cimg_sscanf(st3,"%f%c%c",&a3,&sep3,&end)==2 && sep3=='%'))) {
+            } else if (nb_fields==4) {
               print(images,0,"Insert shared buffer%s from lines (%g%s->%g%s,%g%s,%g%s) of image%s.",
                     selection.height()>1?"s":"",
                     a0,sep0=='%'?"%":"",
@@ -10542,14 +14463,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                 images_names.insert(images_names[selection[l]].get_copymark());
               }
               ++position;
-            } else if (cimg_sscanf(argument,"%255[0-9.eE%+],%255[0-9.eE%+],%255[0-9.eE%+]%c",
-                                   st0.data(),st1.data(),st2.data(),&end)==3 &&
-                       (cimg_sscanf(st0,"%f%c",&a0,&end)==1 ||
-                        (cimg_sscanf(st0,"%f%c%c",&a0,&sep0,&end)==2 && sep0=='%')) &&
-                       (cimg_sscanf(st1,"%f%c",&a1,&end)==1 ||
-                        (cimg_sscanf(st1,"%f%c%c",&a1,&sep1,&end)==2 && sep1=='%')) &&
-                       (cimg_sscanf(st2,"%f%c",&a2,&end)==1 ||
-                        (cimg_sscanf(st2,"%f%c%c",&a2,&sep2,&end)==2 && sep2=='%'))) {
+            } else if (nb_fields==3) {
               print(images,0,"Insert shared buffer%s from planes (%g%s->%g%s,%g%s) of image%s.",
                     selection.height()>1?"s":"",
                     a0,sep0=='%'?"%":"",
@@ -10566,12 +14480,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                 images_names.insert(images_names[selection[l]].get_copymark());
               }
               ++position;
-            } else if (cimg_sscanf(argument,"%255[0-9.eE%+],%255[0-9.eE%+]%c",
-                                   st0.data(),st1.data(),&end)==2 &&
-                       (cimg_sscanf(st0,"%f%c",&a0,&end)==1 ||
-                        (cimg_sscanf(st0,"%f%c%c",&a0,&sep0,&end)==2 && sep0=='%')) &&
-                       (cimg_sscanf(st1,"%f%c",&a1,&end)==1 ||
-                        (cimg_sscanf(st1,"%f%c%c",&a1,&sep1,&end)==2 && sep1=='%'))) {
+            } else if (nb_fields==2) {
               print(images,0,"Insert shared buffer%s from channels (%g%s->%g%s) of image%s.",
                     selection.height()>1?"s":"",
                     a0,sep0=='%'?"%":"",
@@ -10600,7 +14509,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Shift.
-          if (!std::strcmp("-shift",command)) {
+          if (command_id==gmic_cmd_shift) {
             gmic_substitute_args();
             float dx = 0, dy = 0, dz = 0, dc = 0;
             sepx = sepy = sepz = sepc = *argx = *argy = *argz = *argc = 0;
@@ -10657,7 +14566,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Keep slices.
-          if (!std::strcmp("-slices",command)) {
+          if (command_id==gmic_cmd_slices) {
             gmic_substitute_args();
             ind0.assign(); ind1.assign();
             sep0 = sep1 = *argx = *argy = 0;
@@ -10710,7 +14619,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Sub.
-          gmic_arithmetic_command("-sub",
+          gmic_arithmetic_command(sub,
                                   operator-=,
                                   "Subtract %g%s to image%s",
                                   value,ssep,gmic_selection.data(),Tfloat,
@@ -10721,19 +14630,19 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                   gmic_argument_text_printed(),gmic_selection.data(),
                                   "Subtract image%s");
           // Square root.
-          gmic_simple_command("-sqrt",sqrt,"Compute pointwise square root of image%s.");
+          gmic_simple_command(sqrt,sqrt,"Compute pointwise square root of image%s.");
 
           // Square.
-          gmic_simple_command("-sqr",sqr,"Compute pointwise square function of image%s.");
+          gmic_simple_command(sqr,sqr,"Compute pointwise square function of image%s.");
 
           // Sign.
-          gmic_simple_command("-sign",sign,"Compute pointwise sign of image%s.");
+          gmic_simple_command(sign,sign,"Compute pointwise sign of image%s.");
 
           // Sine.
-          gmic_simple_command("-sin",sin,"Compute pointwise sine of image%s.");
+          gmic_simple_command(sin,sin,"Compute pointwise sine of image%s.");
 
           // Sort.
-          if (!std::strcmp("-sort",command)) {
+          if (command_id==gmic_cmd_sort) {
             gmic_substitute_args();
             char order = '+';
             axis = 0;
@@ -10751,7 +14660,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Solve.
-          if (!std::strcmp("-solve",command)) {
+          if (command_id==gmic_cmd_solve) {
             gmic_substitute_args();
             sep = 0;
             if (cimg_sscanf(argument,"[%255[a-zA-Z0-9_.%+-]%c%c",indices,&sep,&end)==2 &&
@@ -10767,7 +14676,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Shift 3d object, with opposite displacement.
-          if (!std::strcmp("-sub3d",command)) {
+          if (command_id==gmic_cmd_sub3d) {
             gmic_substitute_args();
             float tx = 0, ty = 0, tz = 0;
             if (cimg_sscanf(argument,"%f%c",
@@ -10796,7 +14705,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Sharpen.
-          if (!std::strcmp("-sharpen",command)) {
+          if (command_id==gmic_cmd_sharpen) {
             gmic_substitute_args();
             float amplitude = 0, edge = -1, alpha = 0, sigma = 0;
             if ((cimg_sscanf(argument,"%f%c",
@@ -10820,13 +14729,13 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                 print(images,0,"Sharpen image%s with inverse diffusion and amplitude %g.",
                       gmic_selection.data(),
                       amplitude);
-              cimg_forY(selection,l) gmic_apply(sharpen(amplitude,(bool)(edge>=0),edge,alpha,sigma));
+              gmic_apply_parallel(sharpen(amplitude,(bool)(edge>=0),edge,alpha,sigma));
             } else arg_error("sharpen");
             is_released = false; ++position; continue;
           }
 
           // Set random generator seed.
-          if (!std::strcmp("-srand",item)) {
+          if (item_id==gmic_cmd_srand) {
             gmic_substitute_args();
             value = 0;
             if (cimg_sscanf(argument,"%lf%c",
@@ -10844,7 +14753,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Anisotropic PDE-based smoothing.
-          if (!std::strcmp("-smooth",command)) {
+          if (command_id==gmic_cmd_smooth) {
             gmic_substitute_args();
             float amplitude = 0, sharpness = 0.7f, anisotropy = 0.3f, alpha = 0.6f,
               sigma = 1.1f, dl =0.8f, da = 30.0f, gauss_prec = 2.0f;
@@ -10951,7 +14860,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
 
           // Split 3d objects, into 6 vector images
           // { header,N,vertices,primitives,colors,opacities }
-          if (!std::strcmp("-split3d",command)) {
+          if (command_id==gmic_cmd_split3d) {
             bool keep_shared = true;
             gmic_substitute_args();
             if ((*argument=='0' || *argument=='1') && !argument[1]) {
@@ -11002,7 +14911,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // SVD.
-          if (!std::strcmp("-svd",command)) {
+          if (command_id==gmic_cmd_svd) {
             print(images,0,"Compute SVD decomposition%s of matri%s%s.",
                   selection.height()>1?"s":"",selection.height()>1?"ce":"x",gmic_selection.data());
             CImg<float> U, S, V;
@@ -11031,7 +14940,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Input 3d sphere.
-          if (!std::strcmp("-sphere3d",item)) {
+          if (item_id==gmic_cmd_sphere3d) {
             gmic_substitute_args();
             float radius = 100, recursions = 3;
             if ((cimg_sscanf(argument,"%f%c",
@@ -11052,7 +14961,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Set 3d specular light parameters.
-          if (!std::strcmp("-specl3d",item)) {
+          if (item_id==gmic_cmd_specl3d) {
             gmic_substitute_args();
             value = 0.15;
             if (cimg_sscanf(argument,"%lf%c",
@@ -11064,7 +14973,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
             continue;
           }
 
-          if (!std::strcmp("-specs3d",item)) {
+          if (item_id==gmic_cmd_specs3d) {
             gmic_substitute_args();
             value = 0.8;
             if (cimg_sscanf(argument,"%lf%c",
@@ -11077,16 +14986,16 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Sine-cardinal.
-          gmic_simple_command("-sinc",sinc,"Compute pointwise sinc function of image%s.");
+          gmic_simple_command(sinc,sinc,"Compute pointwise sinc function of image%s.");
 
           // Hyperbolic sine.
-          gmic_simple_command("-sinh",sinh,"Compute pointwise hyperpolic sine of image%s.");
+          gmic_simple_command(sinh,sinh,"Compute pointwise hyperpolic sine of image%s.");
 
           // sRGB to RGB.
-          gmic_simple_command("-srgb2rgb",sRGBtoRGB,"Convert image%s from sRGB to RGB color bases.");
+          gmic_simple_command(srgb2rgb,sRGBtoRGB,"Convert image%s from sRGB to RGB color bases.");
 
           // Extract 3d streamline.
-          if (!std::strcmp("-streamline3d",command)) {
+          if (command_id==gmic_cmd_streamline3d) {
             gmic_substitute_args();
             unsigned int interp = 2, is_backward = 0, is_oriented_only = 0;
             float x = 0, y = 0, z = 0, L = 100, dl = 0.1f;
@@ -11190,7 +15099,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Compute structure tensor field.
-          if (!std::strcmp("-structuretensors",command)) {
+          if (command_id==gmic_cmd_structuretensors) {
             gmic_substitute_args();
             unsigned int scheme = 0;
             if (cimg_sscanf(argument,"%u%c",&scheme,&end)==1 &&
@@ -11204,7 +15113,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Select image feature.
-          if (!std::strcmp("-select",command)) {
+          if (command_id==gmic_cmd_select) {
             gmic_substitute_args();
             unsigned int feature_type = 0, X=~0U, Y=~0U, Z=~0U;
             bool is_xyz = false;
@@ -11216,7 +15125,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                     feature_type==0?"point":feature_type==1?"segment":feature_type==2?"rectangle":
                     "ellipse",gmic_selection.data());
               if (is_verbose) {
-                cimg::mutex(29);
+                gmic_lock_output();
                 if (is_xyz) std::fprintf(cimg::output(),", from point (%u,%u,%u)",X,Y,Z);
                 std::fprintf(cimg::output()," (skipped, no display support).");
                 std::fflush(cimg::output());
@@ -11232,7 +15141,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                       feature_type==0?"point":feature_type==1?"segment":
                       feature_type==2?"rectangle":"ellipse",gmic_selection.data());
                 if (is_verbose) {
-                  cimg::mutex(29);
+                  gmic_lock_output();
                   if (is_xyz) std::fprintf(cimg::output(),", from point (%u,%u,%u)",X,Y,Z);
                   std::fprintf(cimg::output()," (skipped, no display available).");
                   std::fflush(cimg::output());
@@ -11244,7 +15153,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                       feature_type==0?"point":feature_type==1?"segment":
                       feature_type==2?"rectangle":"ellipse",gmic_selection.data());
                 if (is_verbose) {
-                  cimg::mutex(29);
+                  gmic_lock_output();
                   if (is_xyz) std::fprintf(cimg::output(),", from point (%u,%u,%u).",X,Y,Z);
                   else std::fprintf(cimg::output(),".");
                   std::fflush(cimg::output());
@@ -11264,7 +15173,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Serialize.
-          if (!std::strcmp("-serialize",command)) {
+          if (command_id==gmic_cmd_serialize) {
 #define gmic_serialize(value_type,svalue_type)  \
   if (!std::strcmp(argx,svalue_type)) \
     CImgList<value_type>(nimages,cimg::type<T>::string()==cimg::type<value_type>::string()). \
@@ -11352,7 +15261,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         else if (command1=='t') {
 
           // Threshold.
-          if (!std::strcmp("-threshold",command)) {
+          if (command_id==gmic_cmd_threshold) {
             gmic_substitute_args();
             unsigned int is_soft = 0;
             value = 0;
@@ -11464,10 +15373,10 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Tangent.
-          gmic_simple_command("-tan",tan,"Compute pointwise tangent of image%s.");
+          gmic_simple_command(tan,tan,"Compute pointwise tangent of image%s.");
 
           // Draw text.
-          if (!std::strcmp("-text",command)) {
+          if (command_id==gmic_cmd_text) {
             gmic_substitute_args();
             name.assign(4096);
             *argx = *argy = *argz = *name = *color = 0;
@@ -11525,7 +15434,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Texturize 3d object.
-          if (!std::strcmp("-texturize3d",command)) {
+          if (command_id==gmic_cmd_texturize3d) {
             gmic_substitute_args();
             CImg<unsigned int> ind_texture, ind_coords;
             sep = *argx = *argy = 0;
@@ -11566,7 +15475,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Tridiagonal solve.
-          if (!std::strcmp("-trisolve",command)) {
+          if (command_id==gmic_cmd_trisolve) {
             gmic_substitute_args();
             sep = 0;
             if (cimg_sscanf(argument,"[%255[a-zA-Z0-9_.%+-]%c%c",indices,&sep,&end)==2 &&
@@ -11583,7 +15492,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Hyperbolic tangent.
-          gmic_simple_command("-tanh",tanh,"Compute pointwise hyperbolic tangent of image%s.");
+          gmic_simple_command(tanh,tanh,"Compute pointwise hyperbolic tangent of image%s.");
 
         } // command1=='t'.
 
@@ -11593,7 +15502,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         else if (command1=='u') {
 
           // Unroll.
-          if (!std::strcmp("-unroll",command)) {
+          if (command_id==gmic_cmd_unroll) {
             gmic_substitute_args();
             axis = 'y';
             if ((*argument=='x' || *argument=='y' ||
@@ -11609,7 +15518,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Remove custom command.
-          if (!std::strcmp("-uncommand",item)) {
+          if (item_id==gmic_cmd_uncommand) {
             gmic_substitute_args();
             if (argument[0]=='*' && !argument[1]) { // Discard all custom commands.
               unsigned int nb_commands = 0;
@@ -11618,6 +15527,8 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                 commands[i].assign();
                 commands_names[i].assign();
                 commands_has_arguments[i].assign();
+                commands_items[i].assign();
+                commands_ids[i].assign();
               }
               print(images,0,"Discard definitions of all custom commmands (%u command%s discarded).",
                     nb_commands,nb_commands>1?"s":"");
@@ -11638,12 +15549,14 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                       commands_names[ind].remove(l);
                       commands[ind].remove(l);
                       commands_has_arguments[ind].remove(l);
+                      if (commands_items[ind].size()>(unsigned int)l) commands_items[ind].remove(l);
+                      if (commands_ids[ind].size()>(unsigned int)l) commands_ids[ind].remove(l);
                       ++nb_removed; break;
                     }
                 }
               }
               if (is_verbose) {
-                cimg::mutex(29);
+                gmic_lock_output();
                 unsigned int siz = 0;
                 for (unsigned int l = 0; l<512; ++l) siz+=commands[l].size();
                 std::fprintf(cimg::output()," (%u found, %u command%s left).",
@@ -11652,11 +15565,12 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                 cimg::mutex(29,0);
               }
             }
+            commands_version = gmic_new_commands_version();
             ++position; continue;
           }
 
           // Unserialize.
-          if (!std::strcmp("-unserialize",command)) {
+          if (command_id==gmic_cmd_unserialize) {
             print(images,0,"Unserialize image%s.",
                   gmic_selection.data());
             int off = 0;
@@ -11706,7 +15620,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
 
           // Set verbosity
           // (actually only display a log message, since it has been already processed before).
-          if (!std::strcmp("-verbose",item)) {
+          if (item_id==gmic_cmd_verbose) {
             if (*argument=='-' && !argument[1])
               print(images,0,"Decrement verbosity level (set to %d).",
                     verbosity);
@@ -11721,7 +15635,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Vanvliet filter.
-          if (!std::strcmp("-vanvliet",command)) {
+          if (command_id==gmic_cmd_vanvliet) {
             gmic_substitute_args();
             unsigned int order = 0;
             float sigma = 0;
@@ -11741,7 +15655,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                     sigma,sep=='%'?"%":"",
                     boundary?"neumann":"dirichlet");
               if (sep=='%') sigma = -sigma;
-              cimg_forY(selection,l) gmic_apply(vanvliet(sigma,order,axis,(bool)boundary));
+              gmic_apply_parallel(vanvliet(sigma,order,axis,(bool)boundary));
             } else arg_error("vanvliet");
             is_released = false; ++position; continue;
           }
@@ -11754,15 +15668,17 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         else if (command1=='w') {
 
           // While.
-          if (!std::strcmp("-while",item)) {
-            gmic_substitute_args();
+          if (item_id==gmic_cmd_while) {
+            const bool is_numeric = get_numeric_variable(argument,value,variables_sizes);
+            if (is_numeric) gmic_substitute_numeric_arg() else gmic_substitute_args();
             const CImg<char>& s = callstack.back();
             if (s[0]!='*' || s[1]!='d')
               error(images,0,0,
                     "Command '-while': Not associated to a '-do' command within the same scope.");
             float _is_cond = 0;
             bool is_filename = false;
-            if (cimg_sscanf(argument,"%f%c",&_is_cond,&end)!=1) {
+            if (is_numeric) _is_cond = (float)value;
+            else if (cimg_sscanf(argument,"%f%c",&_is_cond,&end)!=1) {
               is_filename = true;
               name.assign(argument,(unsigned int)std::strlen(argument) + 1);
               strreplace_fw(name);
@@ -11788,7 +15704,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Warning.
-          if (!std::strcmp("-warn",command) && !is_get_version) {
+          if (command_id==gmic_cmd_warn && !is_get_version) {
             gmic_substitute_args();
             bool force_visible = false;
             if ((*argument=='0' || *argument=='1') && argument[1]==',') {
@@ -11803,7 +15719,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
 
           // Display images in display window.
           unsigned int wind = 0;
-          if ((!std::strcmp("-window",command) ||
+          if ((command_id==gmic_cmd_window ||
                cimg_sscanf(command,"-window%u%c",&wind,&end)==1 ||
                cimg_sscanf(command,"-w%u%c",&wind,&end)==1) &&
               wind<10 && !is_get_version) {
@@ -11958,7 +15874,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Warp.
-          if (!std::strcmp("-warp",command)) {
+          if (command_id==gmic_cmd_warp) {
             gmic_substitute_args();
             unsigned int interpolation = 1, mode = 0;
             float nb_frames = 1;
@@ -12021,7 +15937,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Watershed transform.
-          if (!std::strcmp("-watershed",command)) {
+          if (command_id==gmic_cmd_watershed) {
             gmic_substitute_args();
             unsigned int is_filled = 1;
             sep = 0;
@@ -12042,7 +15958,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           // Wait for a given delay of for user events on display window.
-          if (!std::strcmp("-wait",command) && !is_get_version) {
+          if (command_id==gmic_cmd_wait && !is_get_version) {
             gmic_substitute_args();
             if (!is_restriction)
               CImg<unsigned int>::vector(0,1,2,3,4,5,6,7,8,9).move_to(selection);
@@ -12131,7 +16047,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         else if (command1=='x') {
 
           // Bitwise xor.
-          gmic_arithmetic_command("-xor",
+          gmic_arithmetic_command(xor,
                                   operator^=,
                                   "Compute bitwise XOR of image%s by %g%s",
                                   gmic_selection.data(),value,ssep,Tlong,
@@ -12149,12 +16065,14 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         //----------------------------
 
         // If..[elif]..[else]..endif.
-        if (!std::strcmp("-if",item) || (!std::strcmp("-elif",item) && check_elif)) {
-          gmic_substitute_args();
+        if (item_id==gmic_cmd_if || (item_id==gmic_cmd_elif && check_elif)) {
+          const bool is_numeric = get_numeric_variable(argument,value,variables_sizes);
+          if (is_numeric) gmic_substitute_numeric_arg() else gmic_substitute_args();
           check_elif = false;
           float _is_cond = 0;
           bool is_filename = false;
-          if (cimg_sscanf(argument,"%f%c",&_is_cond,&end)!=1) {
+          if (is_numeric) _is_cond = (float)value;
+          else if (cimg_sscanf(argument,"%f%c",&_is_cond,&end)!=1) {
             is_filename = true;
             name.assign(argument,(unsigned int)std::strlen(argument) + 1);
             strreplace_fw(name);
@@ -12178,18 +16096,18 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                                                          "does not exist"):
                                             (is_cond?"is true":"is false"));
           if (!is_cond) {
-            for (int nb_ifs = 1; nb_ifs && position<commands_line.size(); ++position) {
-              const char *const it = commands_line[position].data();
-              if (*it==1 &&
-                  cimg_sscanf(commands_line[position].data() + 1,"%x,%x",&_debug_line,&(_debug_filename=0))>0) {
-                is_debug_info = true; next_debug_line = _debug_line; next_debug_filename = _debug_filename;
-              } else if (!std::strcmp("-if",it)) ++nb_ifs;
-              else if (!std::strcmp("-endif",it)) { --nb_ifs; if (!nb_ifs) --position; }
-              else if (nb_ifs==1) {
-                if (!std::strcmp("-else",it)) --nb_ifs;
-                else if (!std::strcmp("-elif",it)) { --nb_ifs; check_elif = true; --position;}
+            const unsigned int position_else = gmic_block_end(position,7);
+            unsigned int nposition = commands_line.size();
+            if (position_else!=~0U) {
+              const char *const it = commands_line[position_else].data();
+              if (!std::strcmp("-else",it)) nposition = position_else + 1;
+              else {
+                if (!std::strcmp("-elif",it)) check_elif = true;
+                nposition = position_else;
               }
             }
+            gmic_skip_debug_info(position,nposition);
+            position = nposition;
             continue;
           }
           ++position; continue;
@@ -12197,8 +16115,8 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
 
         // Break and continue.
         bool is_continue = false;
-        if (!std::strcmp("-break",item) ||
-            (!std::strcmp("-continue",item) && (is_continue=true)==true)) {
+        if (item_id==gmic_cmd_break ||
+            (item_id==gmic_cmd_continue && (is_continue=true)==true)) {
           const char
 	    *const com = is_continue?"continue":"break",
 	    *const Com = is_continue?"Continue":"Break";
@@ -12211,39 +16129,23 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
             else if (s[0]!='*' || s[1]!='i') break;
           }
           const char *stb = 0, *ste = 0;
-          unsigned int callstack_ind = 0;
-          int level = 0;
+          unsigned int callstack_ind = 0, position_end = ~0U;
           if (callstack_repeat) {
             print(images,0,"%s %scurrent 'repeat..done' block.",
                   Com,is_continue?"to next iteration of ":"");
-            for (level = 1; level && position<commands_line.size(); ++position) {
-              const char *it = commands_line[position].data();
-              if (!std::strcmp("-repeat",it)) ++level;
-              else if (!std::strcmp("-done",it)) --level;
-            }
+            position_end = gmic_block_end(position,2);
             callstack_ind = callstack_repeat;
             stb = "repeat"; ste = "done";
           } else if (callstack_do) {
             print(images,0,"%s %scurrent 'do..while' block.",
                   Com,is_continue?"to next iteration of ":"");
-            for (level = 1; level && position<commands_line.size(); ++position) {
-              const char *it = commands_line[position].data();
-              if (!std::strcmp("-do",it)) ++level;
-              else if (!std::strcmp("-while",it)) --level;
-            }
+            position_end = gmic_block_end(position,3);
             callstack_ind = callstack_do;
             stb = "do"; ste = "while";
           } else if (callstack_local) {
             print(images,0,"%s %scurrent local environment.",
                   Com,is_continue?"to end of ":"");
-            for (level = 1; level && position<commands_line.size(); ++position) {
-              const char *it = commands_line[position].data();
-              if (!std::strcmp("-local",it) || !std::strcmp("-l",it) ||
-                  !std::strcmp("--local",it) || !std::strcmp("--l",it) ||
-                  !std::strncmp("-local[",it,7) || !std::strncmp("-l[",it,3) ||
-                  !std::strncmp("--local[",it,8) || !std::strncmp("--l[",it,4)) ++level;
-              else if (!std::strcmp("-endlocal",it) || !std::strcmp("-endl",it)) --level;
-            }
+            position_end = gmic_block_end(position,4);
             callstack_ind = callstack_local;
             stb = "local"; ste = "endlocal";
           } else {
@@ -12252,9 +16154,12 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                   "Command '-%s': There are no loops or local environment to %s.",com,com);
             continue;
           }
-          if (level && position>=commands_line.size())
+          if (position_end==~0U) {
+            position = commands_line.size();
             error(images,0,0,
                   "Command '-%s': Missing associated '-%s' command.",stb,ste);
+          }
+          position = position_end + 1;
           if (is_continue || callstack_local) {
 	    if (callstack_ind<callstack.size() - 1) callstack.remove(callstack_ind + 1,callstack.size() - 1);
 	    --position;
@@ -12266,7 +16171,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         }
 
         // Quit.
-        if (!std::strcmp("-quit",item)) {
+        if (item_id==gmic_cmd_quit) {
           print(images,0,"Quit G'MIC interpreter.");
           dowhiles.assign();
           repeatdones.assign();
@@ -12277,8 +16182,8 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         }
 
         // Compute direct or inverse FFT.
-        const bool inv_fft = !std::strcmp("-ifft",command);
-        if (!std::strcmp("-fft",command) || inv_fft) {
+        const bool inv_fft = command_id==gmic_cmd_ifft;
+        if (command_id==gmic_cmd_fft || inv_fft) {
           gmic_substitute_args();
           bool is_valid_argument = *argument!=0;
           if (is_valid_argument) for (const char *s = argument; *s; ++s) {
@@ -12307,7 +16212,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
             name = images_names[uind0];
             if (uind1!=~0U) { // Complex transform.
               if (is_verbose) {
-                cimg::mutex(29);
+                gmic_lock_output();
                 std::fprintf(cimg::output()," ([%u],[%u])%c",uind0,uind1,
 			     l>=selection.height() - 2?'.':',');
                 std::fflush(cimg::output());
@@ -12333,7 +16238,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
               ++l;
             } else { // Real transform.
               if (is_verbose) {
-                cimg::mutex(29);
+                gmic_lock_output();
                 std::fprintf(cimg::output()," ([%u],0)%c",uind0,
 			     l>=selection.height() - 2?'.':',');
                 std::fflush(cimg::output());
@@ -12365,8 +16270,8 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         }
 
         // Inverse scale of a 3d object.
-        const bool divide3d = !std::strcmp("-div3d",command);
-        if (!std::strcmp("-mul3d",command) || divide3d) {
+        const bool divide3d = command_id==gmic_cmd_div3d;
+        if (command_id==gmic_cmd_mul3d || divide3d) {
           gmic_substitute_args();
           float sx = 0, sy = 1, sz = 1;
           if ((cimg_sscanf(argument,"%f%c",
@@ -12402,17 +16307,17 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         }
 
         // Check for a custom command, and execute it, if found.
-        if (std::strcmp("-input",command)) {
+        if (command_id!=gmic_cmd_input) {
           const char *custom_command = 0, cc = *(command + 1);
           bool custom_command_found = false, has_arguments = false, _is_noarg = false;
           CImg<char> substituted_command;
+          CImgList<char> ncommands_line;
+          CImg<unsigned int> ncommands_info, command_ids, ids_positions;
           if ((cc>='a' && cc<='z') || (cc>='A' && cc<='Z') || cc=='_') {
             const int ind = (int)hashcode(command + 1,false);
             cimglist_for(commands_names[ind],l) {
               custom_command = commands_names[ind][l].data();
-              const char
-                *const command_code = commands[ind][l].data(),
-                *const command_code_back = &commands[ind][l].back();
+              const char *const command_code = commands[ind][l].data();
 
               if (!std::strcmp(command + 1,custom_command)) {
                 custom_command_found = true;
@@ -12471,211 +16376,93 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                 }
 
                 // Substitute arguments in custom command expression.
-                CImgList<char> substituted_items;
-                CImg<char> inbraces;
-
-                for (const char *nsource = command_code; *nsource;)
-                  if (*nsource!='$') {
-
-                    // If not starting with '$'.
-                    const char *const nsource0 = nsource;
-                    nsource = std::strchr(nsource0,'$');
-                    if (!nsource) nsource = command_code_back;
-                    CImg<char>(nsource0,(unsigned int)(nsource - nsource0)).move_to(substituted_items);
-                  } else { // '$' expression found.
-                    CImg<char> substr(324);
-                    inbraces.assign(1,1,1,1,0);
-                    int ind = 0, ind1 = 0, l_inbraces = 0;
-                    bool is_braces = false;
-                    sep = 0;
-
-                    if (nsource[1]=='{') {
-                      const char *const ptr_beg = nsource + 2, *ptr_end = ptr_beg;
-                      unsigned int p = 0;
-                      for (p = 1; p>0 && *ptr_end; ++ptr_end) {
-                        if (*ptr_end=='{') ++p;
-                        if (*ptr_end=='}') --p;
-                      }
-                      if (p) { CImg<char>(nsource++,1).move_to(substituted_items); continue; }
-                      l_inbraces = (int)(ptr_end - ptr_beg - 1);
-                      if (l_inbraces>0) inbraces.assign(ptr_beg,l_inbraces + 1).back() = 0;
-                      is_braces = true;
-                    }
+                const CImg<char>& command_items =
+                  commands_items[ind].size()==commands[ind].size()?commands_items[ind][l]:CImg<char>::empty();
+                if (command_items && !is_debug) { // Splice pre-parsed items of the command code.
+                  CImgList<char> substituted_items;
+                  bool is_spliced = true;
+                  for (const char *ptrs = command_items, *const ptre = command_items.end(); ptrs<ptre; ) {
+                    const char kind = *(ptrs++);
+                    if (kind=='t') {
+                      substitute_arguments(ptrs,custom_command,argument,arguments,nb_arguments,has_arguments,
+                                           selection,images,images_names).move_to(substituted_items);
+
+                      // Substituted item must not interfere with its neighbors (unclosed strings or
+                      // trailing '\\'), otherwise the whole command code is parsed again.
+                      const char *s = substituted_items.back().data();
+                      bool is_dquoted = false;
+                      unsigned int nb_dquotes = 0;
+                      for ( ; *s; ++s)
+                        if (*s=='\"') { is_dquoted = !is_dquoted; ++nb_dquotes; }
+                        else if (*s==_dquote && !is_dquoted) ++nb_dquotes;
+                      if (is_dquoted || nb_dquotes%2 || (s>substituted_items.back().data() && *(s - 1)=='\\'))
+                        is_spliced = false;
+                    } else ptrs+=std::strlen(ptrs) + 1;
+                    ptrs+=std::strlen(ptrs) + 1;
+                  }
 
-                    // Substitute $? -> string describing image indices.
-                    if (nsource[1]=='?') {
-                      nsource+=2;
-                      selection2string(selection,images_names,1,true,gmic_selection);
-                      cimg_snprintf(substr,substr.width(),"%s",gmic_selection.data());
-                      CImg<char>(substr.data(),(unsigned int)std::strlen(substr)).move_to(substituted_items);
-
-                      // Substitute $# -> maximum indice of known arguments.
-                    } else if (nsource[1]=='#') {
-                      nsource+=2;
-                      cimg_snprintf(substr,substr.width(),"%u",nb_arguments);
-                      CImg<char>(substr.data(),(unsigned int)std::strlen(substr)).move_to(substituted_items);
-                      has_arguments = true;
-
-                      // Substitute $* -> copy of the specified arguments string.
-                    } else if (nsource[1]=='*') {
-                      nsource+=2;
-                      CImg<char>(argument,(unsigned int)std::strlen(argument)).move_to(substituted_items);
-                      has_arguments = true;
-
-                      // Substitute $"*" -> copy of the specified "quoted" arguments string.
-                    } else if (nsource[1]=='\"' && nsource[2]=='*' && nsource[3]=='\"') {
-                      nsource+=4;
-                      for (unsigned int i = 1; i<=nb_arguments; ++i) {
-                        CImg<char>(1,1,1,1,'\"').move_to(substituted_items);
-                        CImg<char>(arguments[i].data(),arguments[i].width() - 1).
-                          move_to(substituted_items);
-                        if (i==nb_arguments) CImg<char>(1,1,1,1,'\"').move_to(substituted_items);
-                        else CImg<char>(2,1,1,1,'\"',',').move_to(substituted_items);
-                      }
-                      has_arguments = true;
-
-                      // Substitute $= -> transfer (quoted) arguments to named variables.
-                    } else if (nsource[1]=='=' &&
-                               cimg_sscanf(nsource + 2,"%255[a-zA-Z0-9_]",title)==1 &&
-                               (*title<'0' || *title>'9')) {
-                      nsource+=2 + std::strlen(title);
-                      for (unsigned int i = 0; i<=nb_arguments; ++i) {
-                        cimg_snprintf(substr,substr.width()," %s%u=\"",title,i);
-                        CImg<char>(substr.data(),(unsigned int)std::strlen(substr)).move_to(substituted_items);
-                        CImg<char>(arguments[i].data(),arguments[i].width() - 1).
-                          move_to(substituted_items);
-                        CImg<char>(2,1,1,1,'\"',' ').move_to(substituted_items);
-                      }
-                      has_arguments = true;
-
-                      // Substitute $i and ${i} -> value of the i^th argument.
-                    } else if ((cimg_sscanf(nsource,"$%d",&ind)==1 ||
-                                (cimg_sscanf(nsource,"${%d%c",&ind,&sep)==2 && sep=='}'))) {
-                      const int nind = ind + (ind<0?(int)nb_arguments + 1:0);
-                      if ((nind<=0 && ind) || nind>=arguments.width() || !arguments[nind]) {
-                        error(images,0,custom_command,
-                              "Command '-%s': Undefined argument '$%d', in expression '$%s%d%s' "
-                              "(for %u argument%s specified).",
-                              custom_command,ind,sep=='}'?"{":"",ind,sep=='}'?"}":"",
-                              nb_arguments,nb_arguments!=1?"s":"");
-                      }
-                      nsource+=cimg_snprintf(substr,substr.width(),"$%d",ind) + (sep=='}'?2:0);
-                      if (arguments[nind].width()>1)
-                        CImg<char>(arguments[nind].data(),arguments[nind].width() - 1).
-                          move_to(substituted_items);
-                      if (nind!=0) has_arguments = true;
-
-                      // Substitute ${i=$j} -> value of the i^th argument, or the default value,
-                      // i.e. the value of another argument.
-                    } else if (cimg_sscanf(nsource,"${%d=$%d%c",&ind,&ind1,&sep)==3 && sep=='}' &&
-                               ind>0) {
-                      const int nind1 = ind1 + (ind1<0?(int)nb_arguments + 1:0);
-                      if (nind1<=0 || nind1>=arguments.width() || !arguments[nind1])
-                        error(images,0,custom_command,
-                              "Command '-%s': Undefined argument '$%d', in expression '${%d=$%d}' "
-                              "(for %u argument%s specified).",
-                              custom_command,ind1,ind,ind1,
-                              nb_arguments,nb_arguments!=1?"s":"");
-                      nsource+=cimg_snprintf(substr,substr.width(),"${%d=$%d}",ind,ind1);
-                      if (ind>=arguments.width()) arguments.insert(2 + 2*ind - arguments.size());
-                      if (!arguments[ind]) {
-                        arguments[ind] = arguments[nind1];
-                        if (ind>(int)nb_arguments) nb_arguments = (unsigned int)ind;
+                  unsigned int k = 0;
+                  if (is_spliced) {
+                    // Identifiers of native commands are cached with the command, for its literal items.
+                    if (commands_ids[ind].size()==commands[ind].size()) {
+                      command_ids.assign(commands_ids[ind][l],true);
+                      ids_positions.assign(command_ids._width,1,1,1,~0U);
+                    }
+                    unsigned int j = 0;
+                    for (const char *ptrs = command_items, *const ptre = command_items.end(); ptrs<ptre; ++j) {
+                      const char kind = *(ptrs++);
+                      ptrs+=std::strlen(ptrs) + 1;
+                      if (kind=='t') {
+                        CImg<char>& substituted_item = substituted_items[k++];
+                        bool is_dquoted = false;
+                        for (char *s = substituted_item.data(); *s; ++s) {
+                          const char c = *s;
+                          if (c=='\"') is_dquoted = !is_dquoted;
+                          if (!is_dquoted) *s = c<' '?(c==_dollar?'$':c==_lbrace?'{':c==_rbrace?'}':
+                                                       c==_comma?',':c==_dquote?'\"':c):c;
+                        }
+                        append_command_items(substituted_item,ncommands_line);
+                      } else {
+                        const unsigned int l_item = (unsigned int)std::strlen(ptrs) + 1;
+                        if (j<ids_positions._width) ids_positions[j] = ncommands_line.size();
+                        CImg<char>(ptrs,l_item).move_to(ncommands_line);
+                        ptrs+=l_item;
                       }
-                      if (arguments[ind].width()>1)
-                        CImg<char>(arguments[ind].data(),arguments[ind].width() - 1).
-                          move_to(substituted_items);
-                      has_arguments = true;
-
-                      // Substitute ${i=$#} -> value of the i^th argument, or the default value,
-                      // i.e. the maximum indice of known arguments.
-                    } else if (cimg_sscanf(nsource,"${%d=$#%c",&ind,&sep)==2 && sep=='}' &&
-                               ind>0) {
-                      if (ind>=arguments.width()) arguments.insert(2 + 2*ind - arguments.size());
-                      if (!arguments[ind]) {
-                        cimg_snprintf(substr,substr.width(),"%u",nb_arguments);
-                        CImg<char>::string(substr).move_to(arguments[ind]);
-                        if (ind>(int)nb_arguments) nb_arguments = (unsigned int)ind;
+                    }
+                    if (ncommands_line && !*ncommands_line.back()) ncommands_line.remove();
+                    if (command_ids) {
+                      ncommands_info.assign(ncommands_line._width,2,1,1,~0U);
+                      cimg_forX(ids_positions,j) {
+                        const unsigned int p = ids_positions[j];
+                        if (p<ncommands_info._width && command_ids(j,0)!=~0U && command_ids(j,1)!=~0U) {
+                          ncommands_info(p,0) = command_ids(j,0);
+                          ncommands_info(p,1) = command_ids(j,1);
+                        }
                       }
-                      nsource+=cimg_snprintf(substr,substr.width(),"${%d=$#}",ind);
-                      if (arguments[ind].width()>1)
-                        CImg<char>(arguments[ind].data(),arguments[ind].width() - 1).
-                          move_to(substituted_items);
-                      has_arguments = true;
-
-                      // Substitute ${i=default} -> value of the i^th argument,
-                      // or the specified default value.
-                    } else if (cimg_sscanf(inbraces,"%d%c",&ind,&sep)==2 && sep=='=' &&
-                               ind>0) {
-                      nsource+=l_inbraces + 3;
-                      if (ind>=arguments.width()) arguments.insert(2 + 2*ind - arguments.size());
-                      if (!arguments[ind]) {
-                        CImg<char>::string(inbraces.data() +
-                                           cimg_snprintf(substr,substr.width(),"%d=",ind)).
-                          move_to(arguments[ind]);
-                        if (ind>(int)nb_arguments) nb_arguments = (unsigned int)ind;
+                    }
+                  } else { // Rebuild the whole substituted command code.
+                    CImgList<char> command_code_items;
+                    for (const char *ptrs = command_items, *const ptre = command_items.end(); ptrs<ptre; ) {
+                      const char kind = *(ptrs++);
+                      const unsigned int l_item = (unsigned int)std::strlen(ptrs) + 1;
+                      if (kind=='t') substituted_items[k++].move_to(command_code_items);
+                      else {
+                        CImg<char>(ptrs,l_item).move_to(command_code_items);
+                        ptrs+=std::strlen(ptrs + l_item) + 1;
                       }
-                      if (arguments[ind].width()>1)
-                        CImg<char>(arguments[ind].data(),arguments[ind].width() - 1).
-                          move_to(substituted_items);
-                      has_arguments = true;
-
-                      // Substitute any other expression starting by '$'.
-                    } else {
-
-                      // Substitute ${subset} -> values of the selected subset of arguments,
-                      // separated by ','.
-                      if (is_braces) {
-                        if ((*inbraces>='a' && *inbraces<='z') ||
-                            (*inbraces>='A' && *inbraces<='Z') ||
-                            *inbraces=='_' || !*inbraces ||
-                            std::strchr(inbraces,' ')) {
-                          CImg<char>(nsource++,1).move_to(substituted_items);
-                        } else {
-                          CImg<unsigned int> inds;
-                          const int _verbosity = verbosity;
-                          const bool _is_debug = is_debug;
-                          bool is_valid_subset = true;
-                          verbosity = -16384; is_debug = false;
-                          CImg<char> _status;
-                          status.move_to(_status); // Save status because 'selection2cimg' can change it.
-                          try {
-                            inds = selection2cimg(inbraces,nb_arguments + 1,
-                                                  CImgList<char>::empty(),"",false,
-                                                  false,CImg<char>::empty());
-                          } catch (...) { inds.assign(); is_valid_subset = false; }
-                          _status.move_to(status);
-                          verbosity = _verbosity; is_debug = _is_debug;
-                          if (is_valid_subset) {
-                            nsource+=l_inbraces + 3;
-                            if (inds) {
-                              cimg_forY(inds,j) {
-                                const unsigned int uind = inds[j];
-                                if (uind) has_arguments = true;
-                                if (!arguments[uind])
-                                  error(images,0,custom_command,
-                                        "Command '-%s': Undefined argument '$%d', "
-                                        "in expression '${%s}'.",
-                                        custom_command,uind,inbraces.data());
-                                substituted_items.insert(arguments[uind]);
-                                substituted_items.back().back() = ',';
-                              }
-                              if (substituted_items.back().width()>1)
-                                --(substituted_items.back()._width);
-                              else substituted_items.remove();
-                              has_arguments = true;
-                            }
-                          } else CImg<char>(nsource++,1).move_to(substituted_items);
-                        }
-                      } else CImg<char>(nsource++,1).move_to(substituted_items);
+                      command_code_items.back().back() = ' ';
+                      ptrs+=l_item;
                     }
+                    command_code_items.back().back() = 0;
+                    (command_code_items>'x').move_to(substituted_command);
                   }
-                CImg<char>::vector(0).move_to(substituted_items);
-                (substituted_items>'x').move_to(substituted_command);
+                } else substitute_arguments(command_code,custom_command,argument,arguments,nb_arguments,
+                                            has_arguments,selection,images,images_names).
+                         move_to(substituted_command);
 
                 // Substitute special character codes appearing outside strings.
                 bool is_dquoted = false;
-                for (char *s = substituted_command.data(); *s; ++s) {
+                for (char *s = substituted_command.data(); s && *s; ++s) {
                   const char c = *s;
                   if (c=='\"') is_dquoted = !is_dquoted;
                   if (!is_dquoted) *s = c<' '?(c==_dollar?'$':c==_lbrace?'{':c==_rbrace?'}':
@@ -12702,32 +16489,40 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           }
 
           if (custom_command_found) {
-            const CImgList<char>
-	      ncommands_line = commands_line_to_CImgList(substituted_command.data());
-            CImg<unsigned int> nvariables_sizes(512);
-	    cimg_forX(nvariables_sizes,l) nvariables_sizes[l] = variables[l]->size();
+            if (substituted_command)
+              commands_line_to_CImgList(substituted_command.data()).move_to(ncommands_line);
+            _gmic_variables &locals = *(_gmic_variables*)local_variables;
+            const unsigned int nvariables_sizes = locals.siz;
             CImgList<char> nimages_names(selection.height());
             CImgList<T> nimages(selection.height());
             unsigned int nposition = 0;
+            const unsigned long ncommands_version = commands_version;
             gmic_exception exception;
             const unsigned int
               previous_debug_filename = debug_filename,
               previous_debug_line = debug_line;
             CImg<char>::string(custom_command).move_to(callstack);
             if (is_get_version) {
+              _gmic_deferred_images &deferred = *(_gmic_deferred_images*)deferred_images;
+              const _gmic_deferred_scope deferred_scope(deferred);
               cimg_forY(selection,l) {
                 const unsigned int uind = selection[l];
-                nimages[l] = images[uind];
+                if (images[uind].is_empty()) nimages[l] = images[uind];
+                else { // Make deferred copy.
+                  nimages[l].assign(images[uind],true);
+                  deferred.add(nimages[l]._data);
+                }
                 nimages_names[l] = images_names[uind];
               }
               try {
                 is_debug_info = false;
-                _run(ncommands_line,nposition,nimages,nimages_names,images,images_names,nvariables_sizes,&_is_noarg,
-                     argument);
+                _run(ncommands_line,nposition,nimages,nimages_names,images,images_names,&nvariables_sizes,&_is_noarg,
+                     argument,ncommands_info?&ncommands_info:0);
               } catch (gmic_exception &e) {
                 cimg::swap(exception._command_help,e._command_help);
                 cimg::swap(exception._message,e._message);
               }
+              cimglist_for(nimages,l) deferred.materialize(nimages[l],*(_gmic_mapped_files*)mapped_files);
               nimages.move_to(images,~0U);
               cimglist_for(nimages_names,l) nimages_names[l].copymark();
               nimages_names.move_to(images_names,~0U);
@@ -12742,7 +16537,9 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                         "(image [%u] is already used in another thread).",
                         custom_command,name.data() + (*name=='s'?1:0),uind);
                 }
-                if (images[uind].is_shared())
+                if (images[uind].is_shared() &&
+                    !((_gmic_deferred_images*)deferred_images)->contains(images[uind]._data) &&
+                    !((_gmic_mapped_files*)mapped_files)->contains(images[uind]._data))
                   nimages[l].assign(images[uind],false);
                 else {
                   nimages[l].swap(images[uind]);
@@ -12756,8 +16553,8 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
 
               try {
                 is_debug_info = false;
-                _run(ncommands_line,nposition,nimages,nimages_names,images,images_names,nvariables_sizes,&_is_noarg,
-                     argument);
+                _run(ncommands_line,nposition,nimages,nimages_names,images,images_names,&nvariables_sizes,&_is_noarg,
+                     argument,ncommands_info?&ncommands_info:0);
               } catch (gmic_exception &e) {
                 cimg::swap(exception._command_help,e._command_help);
                 cimg::swap(exception._message,e._message);
@@ -12784,10 +16581,17 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                 nimages.move_to(images,uind0);
               }
             }
-	    for (unsigned int l = 0; l<nvariables_sizes._width - 2; ++l) if (variables[l]->size()>nvariables_sizes[l]) {
-		variables_names[l]->remove(nvariables_sizes[l],variables[l]->size() - 1);
-		variables[l]->remove(nvariables_sizes[l],variables[l]->size() - 1);
-	      }
+            // Store identifiers resolved for literal items with the command (unless commands have changed).
+            // They only change from ~0U to their final value, so threads sharing the commands may do it too.
+            if (ncommands_info && commands_version==ncommands_version)
+              cimg_forX(ids_positions,j) {
+                const unsigned int p = ids_positions[j];
+                if (p<ncommands_info._width && command_ids(j,0)==~0U && ncommands_info(p,0)!=~0U) {
+                  command_ids(j,1) = ncommands_info(p,1);
+                  command_ids(j,0) = ncommands_info(p,0);
+                }
+              }
+            locals.pop(nvariables_sizes);
             callstack.remove();
             debug_filename = previous_debug_filename;
             debug_line = previous_debug_line;
@@ -12813,7 +16617,12 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
 
       // Input.
       if (!std::strcmp("-input",command) && !is_get_version) ++position;
-      else { std::strcpy(command,"-input"); argument = item; *restriction = 0; }
+      else {
+        std::strcpy(command,"-input"); argument = item; *restriction = 0;
+        if (((_gmic_memory_profile*)memory_profile)->is_enabled &&
+            !memory_window.open(*(_gmic_memory_profile*)memory_profile,gmic_cmd_input,"input",gmic_list_size(images)))
+          memory_window.create(callstack2string(),"input");
+      }
       gmic_substitute_args();
       if (!is_restriction || !selection) selection.assign(1,1,1,1,images.size());
 
@@ -12822,6 +16631,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
       CImg<unsigned int> indx, indy, indz, indc;
       CImgList<char> input_images_names;
       CImgList<T> input_images;
+      bool is_mapped_input = false;
       sepx = sepy = sepz = sepc = *indices = *indicesy = *indicesz = *indicesc = *argx = *argy = *argz = *argc = 0;
 
       CImg<char> arg_input(argument,(unsigned int)std::strlen(argument) + 1);
@@ -12940,7 +16750,8 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         } else
           print(images,0,"Input black image at position%s",
                 _gmic_selection.data());
-        CImg<T> new_image(idx,idy,idz,idc,0);
+        CImg<T> new_image;
+        ((_gmic_buffer_pool*)buffer_pool)->take(new_image,idx,idy,idz,idc).fill((T)0);
         if (s_values) {
           new_image.fill(s_values.data(),true);
           cimg_snprintf(title,_title.width(),"[image of '%s']",s_values.data());
@@ -13106,16 +16917,18 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
           float
             n0 = -1, x0 = -1, y0 = -1, z0 = -1, c0 = -1,
             n1 = -1, x1 = -1, y1 = -1, z1 = -1, c1 = -1;
-          if ((cimg_sscanf(options,"%f,%f%c",
-                           &n0,&n1,&end)==2 ||
-               cimg_sscanf(options,"%f,%f,%f,%f%c",
-                           &n0,&n1,&x0,&x1,&end)==4 ||
-               cimg_sscanf(options,"%f,%f,%f,%f,%f,%f%c",
-                           &n0,&n1,&x0,&y0,&x1,&y1,&end)==6 ||
-               cimg_sscanf(options,"%f,%f,%f,%f,%f,%f,%f,%f%c",
-                           &n0,&n1,&x0,&y0,&z0,&x1,&y1,&z1,&end)==8 ||
-               cimg_sscanf(options,"%f,%f,%f,%f,%f,%f,%f,%f,%f,%f%c",
-                           &n0,&n1,&x0,&y0,&z0,&c0,&x1,&y1,&z1,&c1,&end)==10) &&
+          const _gmic_fields fields(options);
+          const bool is_valid_fields = fields.is_numeric() && !(fields.nb_fields%2) && fields.nb_fields<=10;
+          if (is_valid_fields) {
+            float *const starts[] = { &x0,&y0,&z0,&c0 }, *const ends[] = { &x1,&y1,&z1,&c1 };
+            const unsigned int nb_coords = fields.nb_fields/2 - 1;
+            n0 = fields[0]; n1 = fields[1];
+            for (unsigned int k = 0; k<nb_coords; ++k) {
+              *(starts[k]) = fields[2 + k];
+              *(ends[k]) = fields[2 + nb_coords + k];
+            }
+          }
+          if (is_valid_fields &&
               (n0==-1 || n0>=0) && (n1==-1 || n1>=0) &&
               (x0==-1 || x0>=0) && (x1==-1 || x1>=0) &&
               (y0==-1 || y0>=0) && (y1==-1 || y1>=0) &&
@@ -13217,10 +17030,13 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                   _filename0);
 
         } else if (!cimg::strcasecmp(ext,"cimg") || !cimg::strcasecmp(ext,"cimgz")) {
-          print(images,0,"Input file '%s' at position%s",
+          is_mapped_input = !is_stdin && !cimg::strcasecmp(ext,"cimg") &&
+            gmic_map_cimg(filename,input_images,*(_gmic_mapped_files*)mapped_files);
+          print(images,0,"Input %sfile '%s' at position%s",
+                is_mapped_input?"memory-mapped ":"",
                 _filename0,
                 _gmic_selection.data());
-          input_images.load_cimg(filename);
+          if (!is_mapped_input) input_images.load_cimg(filename);
           if (input_images) {
             input_images_names.insert(__filename0);
             if (input_images.size()>1)
@@ -13493,7 +17309,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
             unsigned int nb_added = 0;
             for (unsigned int l = 0; l<512; ++l) nb_added+=commands[l].size();
             nb_added-=siz;
-            cimg::mutex(29);
+            gmic_lock_output();
             std::fprintf(cimg::output()," (added %u command%s, total %u).",
                          nb_added,nb_added>1?"s":"",siz + nb_added);
             std::fflush(cimg::output());
@@ -13560,11 +17376,11 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                     "d3d","+3d","/3d","f3d","j3d","l3d","m3d","*3d","o3d","p3d","r3d","s3d","-3d",
                     "t3d","db3d","md3d","rv3d","sl3d","ss3d","div3d",
                     "append","autocrop","add","add3d","abs","and","atan2","acos","asin","atan",
-                    "axes",
-                    "blur","boxfilter","bsr","bsl","bilateral","break",
+                    "atomic","async","await","axes",
+                    "blur","boxfilter","bsr","bsl","bilateral","break","barrier","buffer_pool",
                     "check","check3d","crop","channels","columns","command","camera","cut","cos",
                     "convolve","correlate","color3d","col3d","cosh","continue","cumulate",
-                    "cursor",
+                    "cursor","compact",
                     "done","do","debug","divide","distance","dilate","discard","double3d","denoise",
                     "deriche","dijkstra","displacement","display","display3d",
                     "endif","else","elif","endlocal","endl","echo","exec","error","endian","exp",
@@ -13577,11 +17393,11 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                     "keep",
                     "local","le","lt","log","log2","log10","line","lab2rgb","label","light3d",
                     "move","mirror","mul","mutex","mod","max","min","mmul","mode3d","moded3d",
-                    "map","median","mdiv","mse","mandelbrot","mul3d",
+                    "map","median","mdiv","mse","mandelbrot","mul3d","memory_profile",
                     "name","normalize","neq","noarg","noise",
                     "output","onfail","object3d","or","opacity3d",
-                    "parallel","pass","permute","progress","print","pow","point","polygon","plasma",
-                    "primitives3d","plot",
+                    "parallel","parallel_thresholds","parallel_tiles","pass","permute","progress","print",
+                    "pow","point","polygon","plasma","primitives3d","plot",
                     "quiver","quit",
                     "remove","repeat","resize","reverse","return","rows","rotate",
                     "round","rand","rotate3d","rgb2hsi","rgb2hsl","rgb2hsv","rgb2lab",
@@ -13589,7 +17405,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                     "status","_status","skip","set","split","shared","shift","slices","srand","sub","sqrt",
                     "sqr","sign","sin","sort","solve","sub3d","sharpen","smooth","split3d",
                     "svd","sphere3d","specl3d","specs3d","sinc","sinh","srgb2rgb","streamline3d",
-                    "structuretensors","select","serialize",
+                    "structuretensors","select","semaphore","serialize","stream_cimg",
                     "threshold","tan","text","texturize3d","trisolve","tanh",
                     "unroll","uncommand","unserialize",
                     "vanvliet","verbose",
@@ -13642,7 +17458,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
       }
 
       if (is_verbose) {
-        cimg::mutex(29);
+        gmic_lock_output();
         if (input_images) {
           const unsigned int last = input_images.size() - 1;
           if (input_images.size()==1) {
@@ -13674,8 +17490,12 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         const unsigned int uind = selection[l] + off;
         off+=input_images.size();
         if (l!=siz) {
-          images.insert(input_images,uind);
+          images.insert(input_images,uind,is_mapped_input);
           images_names.insert(input_images_names,uind);
+        } else if (is_mapped_input) { // Keep images of a mapped file shared.
+          images.insert(input_images.size(),uind);
+          cimglist_for(input_images,k) images[uind + k].swap(input_images[k]);
+          input_images_names.move_to(images_names,uind);
         } else {
           input_images.move_to(images,uind);
           input_images_names.move_to(images_names,uind);
@@ -13691,7 +17511,7 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
     cimglist_for(threads_data,i) cimg_forY(threads_data[i],l) {
       if (!threads_data(i,l).is_thread_running) threads_data(i,l).gmic_instance.is_abort_thread = true;
 #if cimg_OS!=2
-      pthread_join(threads_data(i,l).thread_id,0);
+      gmic_thread_pool().wait(threads_data(i,l).job);
 #else // #if cimg_OS!=2
       WaitForSingleObject(threads_data(i,l).thread_id,INFINITE);
       CloseHandle(threads_data(i,l).thread_id);
@@ -13705,6 +17525,25 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
         throw threads_data(i,l).exception;
 #endif // #ifdef gmic_is_parallel
 
+    // Wait for asynchronous jobs that have not been awaited, when leaving the interpreter.
+    if (callstack.size()==1) {
+      _gmic_async_jobs &jobs = *(_gmic_async_jobs*)async_jobs;
+      gmic_exception exception;
+      while (jobs.first) {
+        st_gmic_async<T> *const job = (st_gmic_async<T>*)jobs.remove(jobs.first->id,CImg<T>::pixel_type());
+        if (!job) { jobs.clear(false); break; }
+        gmic_async_wait(*job);
+        if (job->thread.exception._message && !exception._message) {
+          exception._command_help.swap(job->thread.exception._command_help);
+          exception._message.swap(job->thread.exception._message);
+        }
+        delete job;
+      }
+      if (exception._message) throw exception;
+    }
+
+    if (memory_window.ind!=~0U) memory_window.close(gmic_list_size(images));
+
     // Post-check global environment consistency.
     if (images_names.size()!=images.size())
       error(images,0,0,
@@ -13732,6 +17571,11 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
       }
     } else if (initial_callstack_size<callstack.size()) callstack.remove(initial_callstack_size,callstack.size() - 1);
 
+    // Compact back images uncompacted in this environment. Return regular images to the caller.
+    if (callstack.size()==1) {
+      if (compacts.is_used) cimglist_for(images,l) gmic_uncompact(images[l]);
+    } else if (compacts.siz) compacts.compact(images,initial_callstack_size);
+
     // Post-check validity of shared images.
     cimglist_for(images,l) gmic_check(images[l]);
 
@@ -13767,15 +17611,34 @@ gmic& gmic::_run(const CImgList<char>& commands_line, unsigned int& position,
                         cimg::t_bold,callstack.back().data(),cimg::t_normal);
 
     if (callstack.size()==1) {
+      if (is_debug) {
+        const _gmic_math_cache &cache = *(_gmic_math_cache*)math_cache;
+        debug(images,"Math expression cache: %u hit%s, %u compilation%s, %u image-dependent evaluation%s.",
+              cache.nb_hits,cache.nb_hits>1?"s":"",cache.nb_misses,cache.nb_misses>1?"s":"",
+              cache.nb_dependents,cache.nb_dependents>1?"s":"");
+        const _gmic_mutex &mutexes = gmic_mutex();
+        for (unsigned int i = 0; i<256; ++i) if (mutexes.nb_locks[i])
+          debug(images,"Mutex #%u: %u lock%s, %u contended.",
+                i,mutexes.nb_locks[i],mutexes.nb_locks[i]>1?"s":"",mutexes.nb_contentions[i]);
+        const _gmic_buffer_pool &pool = *(_gmic_buffer_pool*)buffer_pool;
+        if (pool.nb_hits || pool.nb_misses)
+          debug(images,"Buffer pool: %lu hit%s, %lu miss%s, %g bytes retained (max. %g).",
+                pool.nb_hits,pool.nb_hits>1?"s":"",pool.nb_misses,pool.nb_misses>1?"es":"",
+                (double)pool.retained_size,(double)pool.max_retained_size);
+      }
+      if (((_gmic_memory_profile*)memory_profile)->is_enabled) print_memory_profile(images);
       if (is_quit) {
         if (verbosity>=0 || is_debug) {
+          gmic_lock_output();
           std::fputc('\n',cimg::output());
           std::fflush(cimg::output());
+          cimg::mutex(29,0);
         }
       } else {
         print(images,0,"End G'MIC interpreter.\n");
         is_quit = true;
       }
+      gmic_flush_log();
     }
   } catch (CImgAbortException &) { // Special case of abort (abort from a CImg method).
     // Do the same as for a cancellation point.
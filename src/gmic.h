@@ -162,7 +162,22 @@ static struct cimg_is_abort {
 #else
 #define cimg_test_abort() if (*_cimg_is_abort.ptr) throw CImgAbortException("")
 #endif // #ifdef cimg_use_openmp
+
+// Abort test usable from any thread (poll it inside OpenMP regions, throw after them).
+#define gmic_is_abort() (*_cimg_is_abort.ptr)
+#else
+#define gmic_is_abort() false
 #endif // #ifdef cimg_use_abort
+#define gmic_test_abort() if (gmic_is_abort()) throw CImgAbortException("")
+
+// Thresholds for parallel evaluation, tunable at runtime (see command '-parallel_thresholds').
+// A 'selection_size' of 0 disables the parallel processing of selected images.
+static struct gmic_parallel_thresholds {
+  unsigned long pointwise_size, selection_size;
+  unsigned int expression_width, expression_length, max_threads;
+  gmic_parallel_thresholds():pointwise_size(131072),selection_size(0),
+                             expression_width(512),expression_length(6),max_threads(0) {}
+} _gmic_parallel_thresholds;
 #include "./CImg.h"
 
 #if cimg_OS==2
@@ -172,7 +187,16 @@ static struct cimg_is_abort {
 #elif cimg_OS==1
 #include <cerrno>
 #include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <signal.h>
+#include <poll.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif // #ifdef __GLIBC__
 #endif // #if cimg_OS==2
 
 // Define some special character codes used for replacement in double quoted strings.
@@ -220,6 +244,7 @@ struct gmic {
   static int levenshtein(const char *const s, const char *const t);
   static bool check_filename(const char *const filename);
   static unsigned int hashcode(const char *const str, const bool is_variable);
+  static unsigned int native_command_id(const char *const command);
   static bool command_has_arguments(const char *const command);
   static const char* basename(const char *const str);
   static char *strreplace_fw(char *const str);
@@ -243,6 +268,9 @@ struct gmic {
                             const bool add_new_variable,
                             const unsigned int *const variables_sizes=0);
 
+  bool get_numeric_variable(const char *const argument, double &value,
+                            const unsigned int *const variables_sizes) const;
+
   gmic& add_commands(const char *const data_commands, const char *const commands_file=0);
   gmic& add_commands(std::FILE *const file, const char *const filename=0);
 
@@ -264,6 +292,11 @@ struct gmic {
                                      gmic_image<char>& res) const;
 
   gmic_list<char> commands_line_to_CImgList(const char *const commands_line);
+  static const char *command_item_end(const char *ptrs, bool &is_dquoted);
+  static gmic_image<char> command_item(const char *ptrs, const char *const ptre);
+  static gmic_image<char> command_to_items(const char *const command_code);
+  static bool append_command_items(const char *const str, gmic_list<char>& items);
+  static gmic_image<unsigned int> commands_line_blocks(const gmic_list<char>& commands_line);
 
   template<typename T>
   void _gmic_substitute_args(const char *const argument, const char *const argument0,
@@ -279,6 +312,12 @@ struct gmic {
                                    gmic_list<T>& parent_images, gmic_list<char>& parent_images_names,
 				   const unsigned int *const variables_sizes);
   template<typename T>
+  gmic_image<char> substitute_arguments(const char *const source, const char *const custom_command,
+                                        const char *const argument, gmic_list<char>& arguments,
+                                        unsigned int& nb_arguments, bool& has_arguments,
+                                        const gmic_image<unsigned int>& selection,
+                                        const gmic_list<T>& images, const gmic_list<char>& images_names);
+  template<typename T>
   gmic& print(const gmic_list<T>& list, const gmic_image<unsigned int> *const callstack_selection,
 	      const char *format, ...);
 
@@ -299,6 +338,8 @@ struct gmic {
                      const gmic_image<unsigned int>& selection,
                      const bool is_header=true);
   template<typename T>
+  gmic& print_memory_profile(const gmic_list<T>& images);
+  template<typename T>
   gmic& display_images(const gmic_list<T>& images,
                        const gmic_list<char>& images_names,
                        const gmic_image<unsigned int>& selection,
@@ -335,21 +376,24 @@ struct gmic {
              gmic_list<T>& images, gmic_list<char>&images_names,
              gmic_list<T>& parent_images, gmic_list<char>& parent_images_names,
              const unsigned int *const variables_sizes,
-             bool *const is_noargs, const char *const parent_arguments);
+             bool *const is_noargs, const char *const parent_arguments,
+             gmic_image<unsigned int> *const p_commands_info=0);
 
   // Class variables.
   static gmic_image<char> stdlib;
 
-  gmic_list<char> *const commands, *const commands_names, *const commands_has_arguments,
+  gmic_list<char> *const commands, *const commands_names, *const commands_has_arguments, *const commands_items,
     *const _variables, *const _variables_names, **const variables, **const variables_names,
     commands_files, callstack;
-  gmic_list<unsigned int> dowhiles, repeatdones;
+  gmic_list<unsigned int> *const commands_ids, dowhiles, repeatdones;
   gmic_image<unsigned char> light3d;
   gmic_image<char> status;
-  void *display_window;
+  void *display_window, *math_cache, *local_variables, *substitution_frames, *run_frames, *deferred_images,
+    *log_ring, *parallel_group, *_atomic_variables, *atomic_variables, *async_jobs, *_mapped_files,
+    *mapped_files, *compact_pending, *memory_profile, *buffer_pool;
 
   float focale3d, light3d_x, light3d_y, light3d_z, specular_lightness3d, specular_shininess3d, _progress, *progress;
-  unsigned long reference_time;
+  unsigned long reference_time, commands_version;
   unsigned int nb_carriages, debug_filename, debug_line, cimg_exception_mode;
   int verbosity, render3d, renderd3d;
   bool is_released, is_debug, is_running, is_start, is_return, is_quit, is_double3d, is_debug_info, check_elif;